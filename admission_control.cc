@@ -0,0 +1,64 @@
+#include <algorithm>
+
+#include "admission_control.h"
+
+namespace {
+
+    // The weight of the latest request in the average time held, as a power of two
+    const unsigned average_shift = 4;
+
+    const std::chrono::milliseconds min_retry_after(1);
+    const std::chrono::milliseconds max_retry_after(1000);
+};  // Anonymous namespace
+
+AdmissionControl::AdmissionControl(std::uint64_t max_bytes)
+    : m_max_bytes(max_bytes)
+    , m_in_flight_bytes(0)
+    , m_in_flight_requests(0)
+    , m_average_held_ns(0)
+    , m_admitted(0)
+    , m_refused(0)
+    , m_peak_bytes(0)
+{
+}
+
+bool AdmissionControl::TryAdmit(std::uint64_t bytes)
+{
+    std::uint64_t in_flight = m_in_flight_bytes.load(std::memory_order_relaxed);
+    do {
+        if ((in_flight > 0) && (bytes > m_max_bytes - std::min(in_flight, m_max_bytes))) {
+            m_refused.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (! m_in_flight_bytes.compare_exchange_weak(in_flight, in_flight + bytes, std::memory_order_relaxed));
+
+    m_in_flight_requests.fetch_add(1, std::memory_order_relaxed);
+    m_admitted.fetch_add(1, std::memory_order_relaxed);
+    std::uint64_t peak = m_peak_bytes.load(std::memory_order_relaxed);
+    while ((in_flight + bytes > peak) && ! m_peak_bytes.compare_exchange_weak(peak, in_flight + bytes, std::memory_order_relaxed)) {
+    }
+    return true;
+}
+
+void AdmissionControl::Release(std::uint64_t bytes, std::chrono::nanoseconds held)
+{
+    m_in_flight_bytes.fetch_sub(bytes, std::memory_order_relaxed);
+    m_in_flight_requests.fetch_sub(1, std::memory_order_relaxed);
+
+    const std::uint64_t held_ns = std::max<std::int64_t>(held.count(), 0);
+    const std::uint64_t average = m_average_held_ns.load(std::memory_order_relaxed);
+    m_average_held_ns.store(average - (average >> average_shift) + (held_ns >> average_shift), std::memory_order_relaxed);
+}
+
+std::chrono::milliseconds AdmissionControl::RetryAfter() const
+{
+    const auto average = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::nanoseconds(m_average_held_ns.load(std::memory_order_relaxed)));
+    return std::min(std::max(average, min_retry_after), max_retry_after);
+}
+
+void AdmissionControl::Report(std::ostream& out) const
+{
+    out << "Admission: " << m_admitted << " requests admitted, " << m_refused << " refused, at most "
+        << m_peak_bytes << " of " << m_max_bytes << " bytes in flight" << std::endl;
+}
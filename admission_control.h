@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <atomic>
+#include <ostream>
+
+// AdmissionControl: Bounds the Put data the server holds at once, from the moment a request is admitted
+// until it is acknowledged, so that a burst from many clients can't grow memory without limit. A request
+// is admitted only if its bytes fit within 'max_bytes' along with those already in flight, and otherwise
+// refused right away rather than queued, so that a server under overload keeps serving what it has at a
+// steady pace and the clients back off. A request larger than the whole budget is admitted when nothing
+// else is in flight, so that it isn't refused forever.
+//
+// RetryAfter() suggests how long a refused client should wait: about as long as requests have recently
+// spent in flight, by which time the ones holding the budget have drained.
+//
+// All methods may be called from several threads concurrently.
+
+class AdmissionControl {
+public:
+    explicit AdmissionControl(std::uint64_t max_bytes);
+
+    AdmissionControl(const AdmissionControl&) = delete;
+    AdmissionControl& operator=(const AdmissionControl&) = delete;
+
+    // Admit a request of 'bytes', or return false if there is no room for it
+    bool TryAdmit(std::uint64_t bytes);
+
+    // Give back the bytes of a request admitted 'held' ago, once it completes
+    void Release(std::uint64_t bytes, std::chrono::nanoseconds held);
+
+    std::chrono::milliseconds RetryAfter() const;
+
+    std::uint64_t InFlightBytes() const
+    {
+        return m_in_flight_bytes.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t InFlightRequests() const
+    {
+        return m_in_flight_requests.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t GetMaxBytes() const
+    {
+        return m_max_bytes;
+    }
+
+    // Print how many requests were admitted and refused, and the most bytes held at once
+    void Report(std::ostream& out) const;
+
+private:
+    const std::uint64_t m_max_bytes;
+    std::atomic<std::uint64_t> m_in_flight_bytes;
+    std::atomic<std::uint64_t> m_in_flight_requests;
+
+    // A moving average of the time requests spend in flight. Updates may be lost to races, which only
+    // makes the average a little less smooth.
+    std::atomic<std::uint64_t> m_average_held_ns;
+
+    std::atomic<std::uint64_t> m_admitted;
+    std::atomic<std::uint64_t> m_refused;
+    std::atomic<std::uint64_t> m_peak_bytes;
+};
@@ -0,0 +1,66 @@
+#include <new>
+#include <cstdlib>
+
+#include "alloc_counter.h"
+
+namespace {
+
+    thread_local std::uint64_t thread_allocations = 0;
+
+    void* counted_malloc(std::size_t size)
+    {
+        ++thread_allocations;
+        void* const p = std::malloc(size > 0 ? size : 1);
+        if (nullptr == p) {
+            throw std::bad_alloc();
+        }
+        return p;
+    }
+};  // Anonymous namespace
+
+std::uint64_t allocations_on_this_thread()
+{
+    return thread_allocations;
+}
+
+void* operator new(std::size_t size)
+{
+    return counted_malloc(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return counted_malloc(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++thread_allocations;
+    return std::malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    ++thread_allocations;
+    return std::malloc(size > 0 ? size : 1);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
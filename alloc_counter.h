@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+
+// Linking alloc_counter.o replaces the global operator new and delete with versions that count the
+// allocations made by every thread. Meant for benchmarks that check a code path doesn't allocate.
+
+// Number of allocations made by the calling thread so far
+std::uint64_t allocations_on_this_thread();
@@ -0,0 +1,385 @@
+#include <algorithm>
+#include <iostream>
+#include <cstring>
+#include <mutex>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <grpc++/server_context.h>
+
+#include "async_server.h"
+
+using grpc::ServerAsyncReaderWriter;
+using grpc::ServerAsyncResponseWriter;
+using grpc::ServerCompletionQueue;
+using grpc::ServerContext;
+using grpc::Status;
+using grpc::StatusCode;
+
+using fileexchange::BulkPutAck;
+using fileexchange::OffsetData;
+using fileexchange::Offsets;
+using fileexchange::success_failure;
+
+namespace {
+
+    using Service = AsyncFileExchangeServer::Service;
+
+    // Number of calls each queue keeps waiting for new requests. A call is replaced as soon as it
+    // receives a request, so a handful is enough to absorb bursts of new calls.
+    const size_t calls_per_queue = 8;
+
+    // AsyncCall: The state of one RPC. Its address is the tag of every operation started on its
+    // behalf, and Proceed() is called when one of them completes.
+    class AsyncCall {
+    public:
+        virtual ~AsyncCall() = default;
+        virtual void Proceed(bool ok) = 0;
+    };
+
+    class PutCall : public AsyncCall {
+    public:
+        PutCall(Service& service, ServerCompletionQueue& cq, PutPipeline& pipeline)
+            : m_service(service)
+            , m_cq(cq)
+            , m_pipeline(pipeline)
+            , m_responder(&m_context)
+            , m_finishing(false)
+        {
+            m_service.RequestPut(&m_context, &m_request, &m_responder, &m_cq, &m_cq, this);
+        }
+
+        void Proceed(bool ok) override
+        {
+            if (m_finishing || ! ok) {
+                // Either the response was sent, or the queue is shutting down
+                delete this;
+                return;
+            }
+
+            // Be ready for the next request while this one waits for the pipeline
+            new PutCall(m_service, m_cq, m_pipeline);
+
+            m_finishing = true;
+            m_pipeline.Submit(m_request, &m_response, [this](const Status& status) {
+                if (StatusCode::RESOURCE_EXHAUSTED == status.error_code()) {
+                    m_pipeline.AddRetryPushback(&m_context);
+                }
+                m_responder.Finish(m_response, status, this);
+            });
+        }
+
+    private:
+        Service& m_service;
+        ServerCompletionQueue& m_cq;
+        PutPipeline& m_pipeline;
+        ServerContext m_context;
+        OffsetData m_request;
+        success_failure m_response;
+        ServerAsyncResponseWriter<success_failure> m_responder;
+        bool m_finishing;
+    };
+
+    class GetCall : public AsyncCall {
+    public:
+        GetCall(Service& service, ServerCompletionQueue& cq, OffsetReader& reader)
+            : m_service(service)
+            , m_cq(cq)
+            , m_reader(reader)
+            , m_responder(&m_context)
+            , m_finishing(false)
+        {
+            m_service.RequestGet(&m_context, &m_request, &m_responder, &m_cq, &m_cq, this);
+        }
+
+        void Proceed(bool ok) override
+        {
+            if (m_finishing || ! ok) {
+                delete this;
+                return;
+            }
+
+            new GetCall(m_service, m_cq, m_reader);
+
+            m_finishing = true;
+            const Status status = m_reader.Get(m_request, &m_response);
+            if (CompressionPolicy* const compression = m_service.GetCompression()) {
+                m_context.set_compression_algorithm(compression->AlgorithmFor(m_response));
+            }
+            m_responder.Finish(m_response, status, this);
+        }
+
+    private:
+        Service& m_service;
+        ServerCompletionQueue& m_cq;
+        OffsetReader& m_reader;
+        ServerContext m_context;
+        Offsets m_request;
+        OffsetData m_response;
+        ServerAsyncResponseWriter<OffsetData> m_responder;
+        bool m_finishing;
+    };
+
+    // MemberTag: A tag that forwards the completion of one kind of operation to a member function, for calls
+    // that have several operations in flight at the same time.
+    template <class Call>
+    class MemberTag : public AsyncCall {
+    public:
+        MemberTag(Call* call, void (Call::*handler)(bool))
+            : m_call(call)
+            , m_handler(handler)
+        {
+        }
+
+        void Proceed(bool ok) override
+        {
+            (m_call->*m_handler)(ok);
+        }
+
+    private:
+        Call* m_call;
+        void (Call::*m_handler)(bool);
+    };
+
+    // BulkPutCall: Keeps one read outstanding at all times, so that batches are submitted to the pipeline
+    // as fast as they arrive, and at most one write of an acknowledgement. Batches that complete while an
+    // acknowledgement is being written are covered by the next one.
+    class BulkPutCall {
+    public:
+        BulkPutCall(Service& service, ServerCompletionQueue& cq, PutPipeline& pipeline)
+            : m_service(service)
+            , m_cq(cq)
+            , m_pipeline(pipeline)
+            , m_stream(&m_context)
+            , m_accept_tag(this, &BulkPutCall::OnAccepted)
+            , m_read_tag(this, &BulkPutCall::OnRead)
+            , m_write_tag(this, &BulkPutCall::OnWritten)
+            , m_finish_tag(this, &BulkPutCall::OnFinished)
+            , m_submitted(0)
+            , m_committed(0)
+            , m_acked(0)
+            , m_reading(false)
+            , m_reads_done(false)
+            , m_writing(false)
+            , m_finishing(false)
+            , m_finished(false)
+        {
+            m_service.RequestBulkPut(&m_context, &m_stream, &m_cq, &m_cq, &m_accept_tag);
+        }
+
+    private:
+        struct Batch {
+            OffsetData request;
+            success_failure response;
+        };
+
+        void OnAccepted(bool ok)
+        {
+            if (! ok) {
+                delete this;
+                return;
+            }
+
+            new BulkPutCall(m_service, m_cq, m_pipeline);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            StartRead();
+        }
+
+        void OnRead(bool ok)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_reading = false;
+            if (! ok || m_finishing) {
+                // The client finished sending, or the call is over anyway
+                m_reads_done = true;
+                Advance();
+                DeleteIfDone(lock);
+                return;
+            }
+
+            std::shared_ptr<Batch> batch(std::move(m_incoming));
+            ++m_submitted;
+            StartRead();
+            lock.unlock();
+
+            m_pipeline.Submit(batch->request, &batch->response, [this, batch](const Status& status) {
+                OnCommitted(status);
+            });
+        }
+
+        void OnCommitted(const Status& status)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            ++m_committed;
+            if (! status.ok() && m_status.ok()) {
+                m_status = status;
+            }
+            Advance();
+            DeleteIfDone(lock);
+        }
+
+        void OnWritten(bool ok)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_writing = false;
+            if (! ok && m_status.ok()) {
+                m_status = Status(StatusCode::CANCELLED, "The client went away.");
+            }
+            Advance();
+        }
+
+        void OnFinished(bool)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_finished = true;
+            DeleteIfDone(lock);
+        }
+
+        // Called with the lock held
+        void StartRead()
+        {
+            m_incoming.reset(new Batch);
+            m_reading = true;
+            m_stream.Read(&m_incoming->request, &m_read_tag);
+        }
+
+        // Acknowledge the batches committed since the last acknowledgement, or end the call if there is
+        // nothing more to do. Only one write may be in flight, so this is deferred until the current one
+        // completes. Called with the lock held.
+        void Advance()
+        {
+            if (m_writing || m_finishing) {
+                return;
+            }
+
+            const bool all_acked = m_reads_done && (m_acked == m_submitted);
+            if (! m_status.ok() || all_acked) {
+                if (StatusCode::RESOURCE_EXHAUSTED == m_status.error_code()) {
+                    m_pipeline.AddRetryPushback(&m_context);
+                }
+                m_finishing = true;
+                m_stream.Finish(m_status, &m_finish_tag);
+            }
+            else if (m_committed > m_acked) {
+                m_acked = m_committed;
+                m_ack.set_committed(m_acked);
+                m_ack.set_queued_bytes(m_pipeline.QueuedBytes());
+                m_ack.set_queue_limit_bytes(m_pipeline.QueueLimitBytes());
+                m_writing = true;
+                m_stream.Write(m_ack, &m_write_tag);
+            }
+        }
+
+        // Delete the call once no operation or batch refers to it any more
+        void DeleteIfDone(std::unique_lock<std::mutex>& lock)
+        {
+            if (m_finished && ! m_reading && (m_committed == m_submitted)) {
+                lock.unlock();
+                delete this;
+            }
+        }
+
+        Service& m_service;
+        ServerCompletionQueue& m_cq;
+        PutPipeline& m_pipeline;
+        ServerContext m_context;
+        ServerAsyncReaderWriter<BulkPutAck, OffsetData> m_stream;
+        MemberTag<BulkPutCall> m_accept_tag;
+        MemberTag<BulkPutCall> m_read_tag;
+        MemberTag<BulkPutCall> m_write_tag;
+        MemberTag<BulkPutCall> m_finish_tag;
+
+        std::mutex m_mutex;
+        std::unique_ptr<Batch> m_incoming;
+        BulkPutAck m_ack;
+        Status m_status;
+        std::uint64_t m_submitted;
+        std::uint64_t m_committed;
+        std::uint64_t m_acked;
+        bool m_reading;
+        bool m_reads_done;
+        bool m_writing;
+        bool m_finishing;
+        bool m_finished;
+    };
+
+    void pin_to_core(std::thread& thread, size_t core)
+    {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(core, &cpus);
+        const int rc = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+        if (0 != rc) {
+            std::cerr << "Failed to pin a polling thread to core " << core << ": " << strerror(rc) << std::endl;
+        }
+#else
+        (void)thread;
+        (void)core;
+#endif
+    }
+};  // Anonymous namespace
+
+AsyncFileExchangeServer::AsyncFileExchangeServer(PutPipeline& pipeline, OffsetReader& reader, size_t num_threads, bool pin_threads)
+    : m_pipeline(pipeline)
+    , m_reader(reader)
+    , m_num_threads(num_threads > 0 ? num_threads : std::max(1U, std::thread::hardware_concurrency()))
+    , m_pin_threads(pin_threads)
+{
+}
+
+AsyncFileExchangeServer::~AsyncFileExchangeServer()
+{
+    Stop();
+}
+
+void AsyncFileExchangeServer::Register(grpc::ServerBuilder& builder)
+{
+    builder.RegisterService(&m_service);
+    for (size_t i = 0; i < m_num_threads; ++i) {
+        m_queues.emplace_back(builder.AddCompletionQueue());
+    }
+}
+
+void AsyncFileExchangeServer::Start()
+{
+    const size_t num_cores = std::max(1U, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < m_num_threads; ++i) {
+        m_threads.emplace_back(&AsyncFileExchangeServer::Poll, this, i);
+        if (m_pin_threads) {
+            pin_to_core(m_threads.back(), i % num_cores);
+        }
+    }
+}
+
+void AsyncFileExchangeServer::Stop()
+{
+    for (auto& cq : m_queues) {
+        cq->Shutdown();
+    }
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+    m_threads.clear();
+    m_queues.clear();
+}
+
+void AsyncFileExchangeServer::Poll(size_t thread_index)
+{
+    ServerCompletionQueue& cq = *m_queues[thread_index];
+    for (size_t i = 0; i < calls_per_queue; ++i) {
+        new PutCall(m_service, cq, m_pipeline);
+        new BulkPutCall(m_service, cq, m_pipeline);
+        new GetCall(m_service, cq, m_reader);
+    }
+
+    void* tag = nullptr;
+    bool ok = false;
+    while (cq.Next(&tag, &ok)) {
+        static_cast<AsyncCall*>(tag)->Proceed(ok);
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <thread>
+
+#include <grpc++/server_builder.h>
+
+#include "put_pipeline.h"
+#include "offset_reader.h"
+#include "file_transfer_service.h"
+#include "file_exchange.grpc.pb.h"
+
+// AsyncFileExchangeServer: Serves the FileExchange RPCs using the asynchronous gRPC API. Every polling
+// thread owns a completion queue of its own, so that threads never contend on a shared queue. A thread
+// is only busy while it is actually handling an event: requests that wait for the journal hold no thread
+// at all, and complete from the journal's callback. Get requests are served on the polling thread, as they
+// either hit the read cache or need a single read of the data file per value. The file transfer RPCs
+// remain synchronous, and are served by gRPC's own threads.
+//
+// Usage: Register() with the ServerBuilder, build and start the server, then Start(). To stop, shut the
+// server down first and then call Stop(), or destroy the object.
+
+class AsyncFileExchangeServer {
+public:
+    using Service = fileexchange::FileExchange::WithAsyncMethod_Put<
+                    fileexchange::FileExchange::WithAsyncMethod_BulkPut<
+                    fileexchange::FileExchange::WithAsyncMethod_Get<FileTransferService> > >;
+
+    // Use 'num_threads' polling threads, or one per core if it's 0. If 'pin_threads' is set, thread i
+    // is bound to core i modulo the number of cores.
+    AsyncFileExchangeServer(PutPipeline& pipeline, OffsetReader& reader, size_t num_threads, bool pin_threads);
+    ~AsyncFileExchangeServer();
+
+    AsyncFileExchangeServer(const AsyncFileExchangeServer&) = delete;
+    AsyncFileExchangeServer& operator=(const AsyncFileExchangeServer&) = delete;
+
+    // The synchronous file transfer methods of the service, to configure before Register()
+    FileTransferService& FileTransfer()
+    {
+        return m_service;
+    }
+
+    void Register(grpc::ServerBuilder& builder);
+    void Start();
+    void Stop();
+
+private:
+    void Poll(size_t thread_index);
+
+    PutPipeline& m_pipeline;
+    OffsetReader& m_reader;
+    const size_t m_num_threads;
+    const bool m_pin_threads;
+    Service m_service;
+    std::vector< std::unique_ptr<grpc::ServerCompletionQueue> > m_queues;
+    std::vector<std::thread> m_threads;
+};
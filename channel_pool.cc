@@ -0,0 +1,107 @@
+#include <stdexcept>
+
+#include <grpc++/create_channel.h>
+
+#include "channel_pool.h"
+
+ChannelPool::Policy ChannelPool::ParsePolicy(const std::string& name)
+{
+    if ("round_robin" == name) {
+        return Policy::RoundRobin;
+    }
+    if ("least_outstanding" == name) {
+        return Policy::LeastOutstanding;
+    }
+    throw std::invalid_argument("Unknown channel policy \"" + name + "\". Expected round_robin or least_outstanding.");
+}
+
+ChannelPool::ChannelPool(const std::string& target, std::shared_ptr<grpc::ChannelCredentials> credentials,
+                         const grpc::ChannelArguments& arguments, size_t size, Policy policy)
+    : m_policy(policy)
+    , m_outstanding(new std::atomic<size_t>[size > 0 ? size : 1])
+    , m_next(0)
+{
+    for (size_t i = 0; i < (size > 0 ? size : 1); ++i) {
+        // Subchannels are shared between channels with the same target and arguments, so an argument that
+        // differs keeps the connections apart. The local subchannel pool makes sure of it where it exists.
+        grpc::ChannelArguments channel_arguments(arguments);
+        channel_arguments.SetInt("fileexchange.channel_index", static_cast<int>(i));
+#ifdef GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL
+        channel_arguments.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+#endif
+        m_channels.push_back(grpc::CreateCustomChannel(target, credentials, channel_arguments));
+        m_outstanding[i] = 0;
+    }
+}
+
+ChannelPool::ChannelPool(std::vector< std::shared_ptr<grpc::Channel> > channels, Policy policy)
+    : m_policy(policy)
+    , m_channels(std::move(channels))
+    , m_outstanding(new std::atomic<size_t>[m_channels.size()])
+    , m_next(0)
+{
+    if (m_channels.empty()) {
+        throw std::invalid_argument("A channel pool needs at least one channel.");
+    }
+    for (size_t i = 0; i < m_channels.size(); ++i) {
+        m_outstanding[i] = 0;
+    }
+}
+
+ChannelPool::Lease ChannelPool::Acquire()
+{
+    const size_t size = m_channels.size();
+    const size_t first = m_next.fetch_add(1, std::memory_order_relaxed) % size;
+    size_t index = first;
+    if (Policy::LeastOutstanding == m_policy) {
+        // Start from a different channel every time, so that ties are broken in turn
+        size_t fewest = m_outstanding[first].load(std::memory_order_relaxed);
+        for (size_t i = 1; (i < size) && (0 != fewest); ++i) {
+            const size_t candidate = (first + i) % size;
+            const size_t outstanding = m_outstanding[candidate].load(std::memory_order_relaxed);
+            if (outstanding < fewest) {
+                fewest = outstanding;
+                index = candidate;
+            }
+        }
+    }
+    m_outstanding[index].fetch_add(1, std::memory_order_relaxed);
+    return Lease(this, index);
+}
+
+ChannelPool::Lease::Lease(ChannelPool* pool, size_t index)
+    : m_pool(pool)
+    , m_index(index)
+{
+}
+
+ChannelPool::Lease::Lease(Lease&& other) noexcept
+    : m_pool(other.m_pool)
+    , m_index(other.m_index)
+{
+    other.m_pool = nullptr;
+}
+
+ChannelPool::Lease& ChannelPool::Lease::operator=(Lease&& other) noexcept
+{
+    if (this != &other) {
+        Release();
+        m_pool = other.m_pool;
+        m_index = other.m_index;
+        other.m_pool = nullptr;
+    }
+    return *this;
+}
+
+ChannelPool::Lease::~Lease()
+{
+    Release();
+}
+
+void ChannelPool::Lease::Release()
+{
+    if (m_pool) {
+        m_pool->m_outstanding[m_index].fetch_sub(1, std::memory_order_relaxed);
+        m_pool = nullptr;
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+
+#include <grpc++/channel.h>
+#include <grpc++/security/credentials.h>
+#include <grpc++/support/channel_arguments.h>
+
+// ChannelPool: Several channels to the same server, so that the calls are spread over as many HTTP/2
+// connections rather than funnelled through one, with its single congestion window, its limit on
+// concurrent streams and its one transport thread on either side. Each channel is created with arguments
+// of its own, so that gRPC doesn't share a subchannel, and thus a connection, between them.
+//
+// A call takes a Lease on a channel, picked in turn ("round_robin") or as the one with the fewest leases
+// outstanding ("least_outstanding"), and returns it when it is done. Acquire() may be called from several
+// threads concurrently.
+
+class ChannelPool {
+public:
+    enum class Policy { RoundRobin, LeastOutstanding };
+
+    // Parse "round_robin" or "least_outstanding". Throws std::invalid_argument on anything else.
+    static Policy ParsePolicy(const std::string& name);
+
+    ChannelPool(const std::string& target, std::shared_ptr<grpc::ChannelCredentials> credentials,
+                const grpc::ChannelArguments& arguments, size_t size, Policy policy);
+
+    // A pool of channels made elsewhere, such as in-process channels to a server in the same binary
+    ChannelPool(std::vector< std::shared_ptr<grpc::Channel> > channels, Policy policy);
+
+    ChannelPool(const ChannelPool&) = delete;
+    ChannelPool& operator=(const ChannelPool&) = delete;
+
+    size_t Size() const
+    {
+        return m_channels.size();
+    }
+
+    const std::shared_ptr<grpc::Channel>& GetChannel(size_t index) const
+    {
+        return m_channels[index];
+    }
+
+    // The channel picked for a call, counted as outstanding until the lease is destroyed
+    class Lease {
+    public:
+        Lease(Lease&& other) noexcept;
+        Lease& operator=(Lease&& other) noexcept;
+        ~Lease();
+
+        size_t Index() const
+        {
+            return m_index;
+        }
+
+    private:
+        friend class ChannelPool;
+        Lease(ChannelPool* pool, size_t index);
+
+        void Release();
+
+        ChannelPool* m_pool;
+        size_t m_index;
+    };
+
+    Lease Acquire();
+
+private:
+    const Policy m_policy;
+    std::vector< std::shared_ptr<grpc::Channel> > m_channels;
+    std::unique_ptr< std::atomic<size_t>[] > m_outstanding;
+    std::atomic<size_t> m_next;
+};
@@ -0,0 +1,433 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "checkpoint.h"
+#include "sequential_file_reader.h"
+#include "crc32c.h"
+#include "utils.h"
+
+using fileexchange::OffsetData;
+
+namespace {
+
+    // A checkpoint is the magic number and the segment to replay from, then an offset and a length for
+    // every entry of the index, then the number of entries and a CRC-32C of everything before it
+    const char checkpoint_magic[8] = { 'F', 'X', 'C', 'K', 'P', 'T', '0', '1' };
+    const size_t checkpoint_header_size = sizeof(checkpoint_magic) + sizeof(std::uint64_t);
+    const size_t checkpoint_entry_size = sizeof(std::uint64_t) + sizeof(std::uint32_t);
+    const size_t checkpoint_trailer_size = sizeof(std::uint64_t) + sizeof(std::uint32_t);
+
+    // The index is written out in pieces of about this size
+    const size_t checkpoint_buffer_size = 1 << 20;
+
+    // While replaying, each thread applies the bytes of the data file that fall into every num_threads-th
+    // stripe of this size
+    const unsigned stripe_shift = 20;
+
+    // How often the checkpointer looks at the size of the journal
+    const std::chrono::seconds poll_interval(1);
+
+    // A whole file mapped into memory
+    class MappedFile : public SequentialFileReader {
+    public:
+        explicit MappedFile(const std::string& file_name)
+            : SequentialFileReader(file_name)
+        {
+        }
+
+        const std::uint8_t* Data() const
+        {
+            return GetMapping().get();
+        }
+
+    protected:
+        virtual void OnChunkAvailable(const void*, size_t) override
+        {
+        }
+    };
+
+    // Closes the descriptor when it goes out of scope
+    struct FileDescriptor {
+        int fd;
+
+        ~FileDescriptor()
+        {
+            if (-1 != fd) {
+                close(fd);
+            }
+        }
+    };
+
+    template <typename T>
+    T load(const std::uint8_t* p)
+    {
+        T value;
+        memcpy(&value, p, sizeof(value));
+        return value;
+    }
+
+    template <typename T>
+    void append(std::string& buffer, T value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void write_all(int fd, const std::string& buffer, const std::string& path)
+    {
+        const char* data = buffer.data();
+        size_t remaining = buffer.size();
+        while (remaining > 0) {
+            const ssize_t written = write(fd, data, remaining);
+            if (-1 == written) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                raise_from_errno("Failed to write to " + path + '.');
+            }
+            data += written;
+            remaining -= written;
+        }
+    }
+
+    void sync_directory_of(const std::string& path)
+    {
+        const size_t slash = path.rfind('/');
+        const std::string directory = (std::string::npos == slash) ? "." : path.substr(0, std::max<size_t>(slash, 1));
+        FileDescriptor dir { open(directory.c_str(), O_RDONLY | O_DIRECTORY) };
+        if (-1 != dir.fd) {
+            fsync(dir.fd);
+        }
+    }
+
+    // Run 'work' on 'num_threads' threads, passing each its number
+    template <typename Work>
+    void run_in_parallel(size_t num_threads, const Work& work)
+    {
+        std::vector<std::thread> threads;
+        for (size_t t = 1; t < num_threads; ++t) {
+            threads.emplace_back(work, t);
+        }
+        work(0);
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+
+    // A record of the journal, as found in its mapped segment
+    struct Record {
+        const std::uint8_t* payload;
+        std::uint32_t size;
+        std::uint32_t checksum;
+        size_t segment;             // Index into the segments replayed
+        std::uint64_t position;     // Of the record's header within the segment
+    };
+};  // Anonymous namespace
+
+std::string Checkpointer::CheckpointPath(const std::string& journal_path)
+{
+    return journal_path + ".checkpoint";
+}
+
+Checkpointer::Recovery Checkpointer::Recover(const std::string& journal_path, DataStore& store, OffsetIndex& index, size_t num_threads)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    if (0 == num_threads) {
+        num_threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    Recovery recovery;
+
+    // Load the checkpoint, if there is one, into the index
+    const std::string checkpoint_path = CheckpointPath(journal_path);
+    std::uint64_t first_segment = 1;
+    if (0 == access(checkpoint_path.c_str(), F_OK)) {
+        MappedFile checkpoint(checkpoint_path);
+        const std::uint8_t* const data = checkpoint.Data();
+        const size_t size = checkpoint.GetSize();
+        if ((size < checkpoint_header_size + checkpoint_trailer_size) || (0 != memcmp(data, checkpoint_magic, sizeof(checkpoint_magic))) ||
+            (crc32c(data, size - sizeof(std::uint32_t)) != load<std::uint32_t>(data + size - sizeof(std::uint32_t)))) {
+            throw std::runtime_error("The checkpoint " + checkpoint_path + " is corrupt.");
+        }
+        const std::uint64_t count = load<std::uint64_t>(data + size - checkpoint_trailer_size);
+        if (count * checkpoint_entry_size != size - checkpoint_header_size - checkpoint_trailer_size) {
+            throw std::runtime_error("The checkpoint " + checkpoint_path + " is corrupt.");
+        }
+        first_segment = load<std::uint64_t>(data + sizeof(checkpoint_magic));
+
+        const std::uint8_t* const entries = data + checkpoint_header_size;
+        run_in_parallel(num_threads, [&](size_t thread) {
+            const std::uint64_t end = count * (thread + 1) / num_threads;
+            for (std::uint64_t i = count * thread / num_threads; i < end; ++i) {
+                const std::uint8_t* const entry = entries + i * checkpoint_entry_size;
+                index.Insert(load<std::uint64_t>(entry), load<std::uint32_t>(entry + sizeof(std::uint64_t)));
+            }
+        });
+        recovery.checkpoint_offsets = count;
+    }
+    recovery.segment = first_segment;
+
+    // Segments before the checkpoint's are left over from a checkpoint that didn't get to delete them
+    std::vector<std::uint64_t> segment_numbers = Journal::ListSegments(journal_path);
+    std::vector<std::unique_ptr<MappedFile>> segments;
+    for (const std::uint64_t segment : segment_numbers) {
+        const std::string segment_path = Journal::SegmentPath(journal_path, segment);
+        if (segment < first_segment) {
+            unlink(segment_path.c_str());
+            continue;
+        }
+        segments.emplace_back(new MappedFile(segment_path));
+    }
+    segment_numbers.erase(std::remove_if(segment_numbers.begin(), segment_numbers.end(),
+                                         [first_segment](std::uint64_t segment) { return segment < first_segment; }),
+                          segment_numbers.end());
+
+    // Find the records. This only hops from one length to the next; the records are checked in parallel.
+    // The journal ends at the first record that doesn't fit in its segment.
+    std::vector<Record> records;
+    size_t end_segment = 0;
+    std::uint64_t end_position = 0;
+    for (size_t s = 0; s < segments.size(); ++s) {
+        const std::uint8_t* const data = segments[s]->Data();
+        const std::uint64_t size = segments[s]->GetSize();
+        std::uint64_t position = 0;
+        while (position + Journal::header_size <= size) {
+            const std::uint32_t payload_size = load<std::uint32_t>(data + position);
+            if (payload_size > size - position - Journal::header_size) {
+                break;
+            }
+            records.push_back({ data + position + Journal::header_size, payload_size,
+                                load<std::uint32_t>(data + position + sizeof(std::uint32_t)), s, position });
+            position += Journal::header_size + payload_size;
+        }
+        end_segment = s;
+        end_position = position;
+        if (position < size) {
+            break;
+        }
+    }
+
+    // Check and parse the records. The journal ends at the first one that was torn.
+    std::vector<OffsetData> requests(records.size());
+    std::atomic<size_t> first_invalid(records.size());
+    run_in_parallel(num_threads, [&](size_t thread) {
+        const size_t end = records.size() * (thread + 1) / num_threads;
+        for (size_t i = records.size() * thread / num_threads; (i < end) && (i < first_invalid.load(std::memory_order_relaxed)); ++i) {
+            const Record& record = records[i];
+            if ((Journal::RecordChecksum(record.payload, record.size) == record.checksum) &&
+                requests[i].ParseFromArray(record.payload, record.size) &&
+                (requests[i].offsets_size() == requests[i].values_size())) {
+                continue;
+            }
+            size_t invalid = first_invalid.load(std::memory_order_relaxed);
+            while ((i < invalid) && ! first_invalid.compare_exchange_weak(invalid, i)) {
+            }
+            break;
+        }
+    });
+    const size_t valid = first_invalid.load();
+    if (valid < records.size()) {
+        end_segment = records[valid].segment;
+        end_position = records[valid].position;
+    }
+
+    // Apply them. Each thread takes the bytes in its own stripes of the data file, and the offsets that
+    // start in them, in the order they were logged.
+    std::atomic<int> apply_error(0);
+    run_in_parallel(num_threads, [&](size_t thread) {
+        OffsetData pieces;
+        for (size_t i = 0; (i < valid) && (0 == apply_error.load(std::memory_order_relaxed)); ++i) {
+            const OffsetData& request = requests[i];
+            if (0 == request.offsets_size()) {
+                continue;
+            }
+
+            // Most records fall within a single stripe, and are applied as they are
+            bool whole = true;
+            pieces.Clear();
+            for (int e = 0; whole && (e < request.offsets_size()); ++e) {
+                whole = DataStore::AddStripePieces(request.offsets(e), request.values(e), stripe_shift, thread, num_threads, &pieces);
+            }
+            if (! whole) {
+                pieces.Clear();
+                for (int e = 0; e < request.offsets_size(); ++e) {
+                    DataStore::AddStripePieces(request.offsets(e), request.values(e), stripe_shift, thread, num_threads, &pieces);
+                }
+                if (0 == pieces.offsets_size()) {
+                    continue;
+                }
+            }
+
+            const int err = store.Apply(whole ? request : pieces);
+            if (0 != err) {
+                int expected = 0;
+                apply_error.compare_exchange_strong(expected, err);
+                break;
+            }
+            for (int e = 0; e < request.offsets_size(); ++e) {
+                if (((request.offsets(e) >> stripe_shift) % num_threads) == thread) {
+                    index.Insert(request.offsets(e), request.values(e).size());
+                }
+            }
+        }
+    });
+    if (0 != apply_error) {
+        raise_from_system_error_code("Failed to replay the journal " + journal_path + " into " + store.GetFilePath() + '.', apply_error);
+    }
+
+    // Cut the journal off where it ends, so that new records follow the last valid one
+    for (size_t s = 0; s < segments.size(); ++s) {
+        recovery.journal_bytes += segments[s]->GetSize();
+        if (s < end_segment) {
+            continue;
+        }
+        const std::uint64_t keep = (s == end_segment) ? end_position : 0;
+        recovery.truncated_bytes += segments[s]->GetSize() - keep;
+    }
+    const size_t num_segments = segments.size();
+    segments.clear();
+    for (size_t s = end_segment; s < num_segments; ++s) {
+        const std::string segment_path = Journal::SegmentPath(journal_path, segment_numbers[s]);
+        if (s > end_segment) {
+            if (-1 == unlink(segment_path.c_str())) {
+                raise_from_errno("Failed to delete " + segment_path + '.');
+            }
+            continue;
+        }
+        if (-1 == truncate(segment_path.c_str(), end_position)) {
+            raise_from_errno("Failed to truncate " + segment_path + '.');
+        }
+    }
+    if (num_segments > 0) {
+        recovery.segment = segment_numbers[end_segment];
+    }
+
+    recovery.segments = std::min(num_segments, end_segment + 1);
+    recovery.records = valid;
+    recovery.journal_bytes -= recovery.truncated_bytes;
+    recovery.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return recovery;
+}
+
+Checkpointer::Checkpointer(PutPipeline& pipeline, Journal& journal, DataStore& store, const OffsetIndex& index,
+                           std::uint64_t segment_bytes)
+    : m_pipeline(pipeline)
+    , m_journal(journal)
+    , m_store(store)
+    , m_index(index)
+    , m_segment_bytes(segment_bytes)
+    , m_stopping(false)
+{
+    m_thread = std::thread(&Checkpointer::Loop, this);
+}
+
+Checkpointer::~Checkpointer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_stop_cv.notify_one();
+    m_thread.join();
+}
+
+void Checkpointer::Checkpoint()
+{
+    const auto start_time = std::chrono::steady_clock::now();
+
+    // Everything in the segments before the new one is in the data file and the index once it's published
+    const std::uint64_t segment = m_journal.Rotate();
+    m_pipeline.WaitForPublished();
+    const int err = m_store.Sync();
+    if (0 != err) {
+        raise_from_system_error_code("Failed to sync " + m_store.GetFilePath() + '.', err);
+    }
+
+    const std::string checkpoint_path = CheckpointPath(m_journal.GetFilePath());
+    const std::string temporary_path = checkpoint_path + ".tmp";
+    FileDescriptor file { open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644) };
+    if (-1 == file.fd) {
+        raise_from_errno("Failed to create " + temporary_path + '.');
+    }
+
+    std::string buffer(checkpoint_magic, sizeof(checkpoint_magic));
+    append<std::uint64_t>(buffer, segment);
+    buffer.reserve(checkpoint_buffer_size + checkpoint_entry_size);
+    std::uint32_t checksum = 0;
+    std::uint64_t count = 0;
+    auto flush = [&] {
+        checksum = crc32c(buffer.data(), buffer.size(), checksum);
+        write_all(file.fd, buffer, temporary_path);
+        buffer.clear();
+    };
+
+    // The index is copied a segment at a time, and written out between segments so that no lock is held
+    // while writing
+    for (size_t s = 0; s < m_index.NumSegments(); ++s) {
+        m_index.ForEach(s, [&](std::uint64_t offset, std::uint32_t length) {
+            append(buffer, offset);
+            append(buffer, length);
+            ++count;
+        });
+        if (buffer.size() >= checkpoint_buffer_size) {
+            flush();
+        }
+    }
+    append(buffer, count);
+    checksum = crc32c(buffer.data(), buffer.size(), checksum);
+    append(buffer, checksum);
+    write_all(file.fd, buffer, temporary_path);
+
+    if (-1 == fdatasync(file.fd)) {
+        raise_from_errno("Failed to sync " + temporary_path + '.');
+    }
+    if (-1 == rename(temporary_path.c_str(), checkpoint_path.c_str())) {
+        raise_from_errno("Failed to rename " + temporary_path + " to " + checkpoint_path + '.');
+    }
+    sync_directory_of(checkpoint_path);
+
+    // Only now are the earlier segments no longer needed
+    for (const std::uint64_t old_segment : Journal::ListSegments(m_journal.GetFilePath())) {
+        if (old_segment < segment) {
+            unlink(Journal::SegmentPath(m_journal.GetFilePath(), old_segment).c_str());
+        }
+    }
+
+    const double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "Checkpoint of " << count << " offsets, replaying from journal segment " << segment << ", took "
+              << elapsed_ms << " ms" << std::endl;
+}
+
+void Checkpointer::Loop()
+{
+    std::uint64_t threshold = m_segment_bytes;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (! m_stop_cv.wait_for(lock, poll_interval, [this] { return m_stopping; })) {
+        if (m_journal.SegmentBytes() < threshold) {
+            continue;
+        }
+
+        lock.unlock();
+        try {
+            Checkpoint();
+            threshold = m_segment_bytes;
+        }
+        catch (const std::system_error& ex) {
+            // Try again once as much has been logged again
+            std::cerr << "Checkpoint failed: " << ex.what() << std::endl;
+            threshold = m_journal.SegmentBytes() + m_segment_bytes;
+        }
+        lock.lock();
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "journal.h"
+#include "data_store.h"
+#include "offset_index.h"
+#include "put_pipeline.h"
+
+// Checkpointer: Bounds the time the server takes to restart, however much was ever written to it. Once
+// 'segment_bytes' have been logged to the current segment of the journal, a checkpoint is taken:
+//   1. The journal is rotated, and the checkpointer waits until 'pipeline' has applied every record in the
+//      earlier segments to the data file and to the index, or failed it. With replication, the records
+//      the followers haven't acknowledged yet are only applied once a quorum has them.
+//   2. The data file is synced, so that those writes are on the disk.
+//   3. The index is saved to the journal's path followed by ".checkpoint", along with the number of the
+//      new segment, through a temporary file that is renamed over the previous checkpoint.
+//   4. The earlier segments are deleted.
+// The index and the data file may already hold writes logged after the rotation. Replaying them from the
+// new segment on leaves the same state, since PutPipeline applies the writes to every byte in the order
+// they were logged, as replay does. recovery_check checks this after concurrent writes to the same offsets.
+//
+// Recover() restores that state at startup, before the journal is opened for appending: it loads the
+// checkpoint into the index, and replays the segments from the one it names. The records are checked and
+// parsed by several threads, each taking a run of them, and then applied by several threads, each taking
+// the bytes of the data file that fall into its stripes, so that the writes to any byte are still applied
+// in order. The journal ends at the first record that is incomplete or fails its CRC, as a crash in the
+// middle of a write leaves it: its segment is truncated there, and any later segments are deleted.
+
+class Checkpointer {
+public:
+    struct Recovery {
+        std::uint64_t segment = 1;              // The segment the journal is to continue with
+        std::uint64_t checkpoint_offsets = 0;   // Loaded from the checkpoint
+        std::uint64_t segments = 0;             // Replayed
+        std::uint64_t records = 0;
+        std::uint64_t journal_bytes = 0;
+        std::uint64_t truncated_bytes = 0;      // Dropped from the first invalid record on
+        double seconds = 0;
+    };
+
+    // Restore 'store' and 'index' from the checkpoint and the journal at 'journal_path', using
+    // 'num_threads' threads, or one per core if it is 0. Throws std::system_error if a file can't be read
+    // or a write can't be applied, and std::runtime_error if the checkpoint is corrupt.
+    static Recovery Recover(const std::string& journal_path, DataStore& store, OffsetIndex& index, size_t num_threads);
+
+    // The file name of the checkpoint of the journal at 'journal_path'
+    static std::string CheckpointPath(const std::string& journal_path);
+
+    // Take a checkpoint in the background whenever the current segment of 'journal' holds 'segment_bytes'.
+    // 'pipeline' is the one that logs to 'journal' and applies the records to 'store' and 'index'.
+    Checkpointer(PutPipeline& pipeline, Journal& journal, DataStore& store, const OffsetIndex& index,
+                 std::uint64_t segment_bytes);
+    ~Checkpointer();
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    // Take a checkpoint now. Throws std::system_error if it fails, in which case the previous checkpoint
+    // and the segments it needs are left in place.
+    void Checkpoint();
+
+private:
+    void Loop();
+
+    PutPipeline& m_pipeline;
+    Journal& m_journal;
+    DataStore& m_store;
+    const OffsetIndex& m_index;
+    const std::uint64_t m_segment_bytes;
+
+    std::mutex m_mutex;
+    std::condition_variable m_stop_cv;
+    bool m_stopping;
+    std::thread m_thread;
+};
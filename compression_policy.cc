@@ -0,0 +1,192 @@
+#include <stdexcept>
+#include <algorithm>
+#include <vector>
+#include <iomanip>
+
+#include <time.h>
+#include <zlib.h>
+
+#include "compression_policy.h"
+
+using fileexchange::OffsetData;
+
+namespace {
+
+    // The weight of a new sample in the running estimates
+    const double sample_weight = 0.25;
+
+    std::uint64_t thread_cpu_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return static_cast<std::uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    double megabytes(std::uint64_t bytes)
+    {
+        return static_cast<double>(bytes) / (1 << 20);
+    }
+};  // Anonymous namespace
+
+CompressionPolicy::Mode CompressionPolicy::ParseMode(const std::string& name)
+{
+    if ("off" == name) {
+        return Mode::Off;
+    }
+    if ("on" == name) {
+        return Mode::On;
+    }
+    if ("adaptive" == name) {
+        return Mode::Adaptive;
+    }
+    throw std::invalid_argument("Unknown compression mode \"" + name + "\". Expected off, on or adaptive.");
+}
+
+grpc_compression_algorithm CompressionPolicy::ParseAlgorithm(const std::string& name)
+{
+    if ("gzip" == name) {
+        return GRPC_COMPRESS_GZIP;
+    }
+    if ("deflate" == name) {
+        return GRPC_COMPRESS_DEFLATE;
+    }
+    throw std::invalid_argument("Unknown compression algorithm \"" + name + "\". Expected gzip or deflate.");
+}
+
+CompressionPolicy::CompressionPolicy(Mode mode, grpc_compression_algorithm algorithm, double min_saving, double link_bytes_per_second)
+    : m_mode(mode)
+    , m_algorithm(algorithm)
+    , m_min_saving(min_saving)
+    , m_link_bytes_per_second(link_bytes_per_second)
+    , m_ratio(1.0)
+    , m_ns_per_byte(0.0)
+    , m_worthwhile(true)
+    , m_measured(false)
+    , m_candidates(0)
+    , m_messages(0)
+    , m_bytes(0)
+    , m_compressed_messages(0)
+    , m_compressed_bytes(0)
+    , m_saved_bytes(0)
+    , m_compression_ns(0)
+    , m_sampling_ns(0)
+{
+}
+
+bool CompressionPolicy::ShouldCompress(const void* data, size_t size)
+{
+    if (Mode::Off == m_mode) {
+        return false;
+    }
+    if (IsSampled(size)) {
+        Measure(data, std::min(size, max_sample_size));
+    }
+    return Account(size);
+}
+
+bool CompressionPolicy::ShouldCompress(const OffsetData& message)
+{
+    if (Mode::Off == m_mode) {
+        return false;
+    }
+    const size_t size = message.ByteSizeLong();
+    if (IsSampled(size)) {
+        // The values are what compresses, so the sample is made of them
+        thread_local std::string sample;
+        sample.clear();
+        for (const std::string& value : message.values()) {
+            sample.append(value, 0, max_sample_size - sample.size());
+            if (sample.size() == max_sample_size) {
+                break;
+            }
+        }
+        Measure(sample.data(), sample.size());
+    }
+    return Account(size);
+}
+
+bool CompressionPolicy::IsSampled(size_t size)
+{
+    if (size < min_message_size) {
+        return false;
+    }
+    return 0 == m_candidates.fetch_add(1, std::memory_order_relaxed) % sample_interval;
+}
+
+void CompressionPolicy::Measure(const void* sample, size_t sample_size)
+{
+    if (0 == sample_size) {
+        return;
+    }
+
+    // Compress at the level gRPC uses
+    thread_local std::vector<Bytef> compressed;
+    uLongf compressed_size = compressBound(sample_size);
+    compressed.resize(compressed_size);
+    const std::uint64_t start = thread_cpu_ns();
+    const int rc = compress2(compressed.data(), &compressed_size, static_cast<const Bytef*>(sample), sample_size, Z_DEFAULT_COMPRESSION);
+    const std::uint64_t elapsed = thread_cpu_ns() - start;
+    m_sampling_ns.fetch_add(elapsed, std::memory_order_relaxed);
+    if (Z_OK != rc) {
+        return;
+    }
+
+    const double ratio = static_cast<double>(compressed_size) / sample_size;
+    const double ns_per_byte = static_cast<double>(elapsed) / sample_size;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_measured) {
+        m_ratio = m_ratio + sample_weight * (ratio - m_ratio);
+        m_ns_per_byte = m_ns_per_byte + sample_weight * (ns_per_byte - m_ns_per_byte);
+    }
+    else {
+        m_ratio = ratio;
+        m_ns_per_byte = ns_per_byte;
+        m_measured = true;
+    }
+
+    // The decision follows the latest sample, so that it turns as soon as the data does, while the timing
+    // is smoothed. Sending N bytes saves N * saving / bandwidth seconds, and compressing them costs
+    // N * ns_per_byte.
+    const double saving = 1.0 - ratio;
+    m_worthwhile = (saving >= m_min_saving) &&
+                   ((m_link_bytes_per_second <= 0) || (saving * 1e9 / m_link_bytes_per_second >= m_ns_per_byte));
+}
+
+bool CompressionPolicy::Account(size_t size)
+{
+    m_messages.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(size, std::memory_order_relaxed);
+
+    const bool compress = (Mode::On == m_mode) || ((size >= min_message_size) && m_worthwhile);
+    if (! compress) {
+        return false;
+    }
+    m_compressed_messages.fetch_add(1, std::memory_order_relaxed);
+    m_compressed_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (m_measured) {
+        m_saved_bytes.fetch_add(static_cast<std::uint64_t>(size * (1.0 - m_ratio)), std::memory_order_relaxed);
+        m_compression_ns.fetch_add(static_cast<std::uint64_t>(size * m_ns_per_byte), std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void CompressionPolicy::Report(std::ostream& out) const
+{
+    const char* algorithm = "none";
+    grpc_compression_algorithm_name(Algorithm(), &algorithm);
+    const char* const mode = (Mode::Off == m_mode) ? "off" : ((Mode::On == m_mode) ? "on" : "adaptive");
+
+    const std::uint64_t bytes = m_bytes;
+    const std::uint64_t saved = m_saved_bytes;
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    out << "Compression " << mode << " (" << algorithm << "): " << m_compressed_messages << " of " << m_messages
+        << " messages compressed, " << megabytes(m_compressed_bytes) << " of " << megabytes(bytes) << " MB" << std::endl;
+    out << "  Estimated " << megabytes(saved) << " MB saved ("
+        << ((bytes > 0) ? 100.0 * saved / bytes : 0.0) << "% of the bytes sent), for "
+        << std::setprecision(3) << m_compression_ns / 1e9 << " s of CPU time compressing, and "
+        << m_sampling_ns / 1e9 << " s sampling" << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}
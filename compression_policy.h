@@ -0,0 +1,122 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <ostream>
+
+#include <grpc/compression.h>
+#include <grpc++/support/sync_stream.h>
+
+#include "file_exchange.pb.h"
+
+// CompressionPolicy: Decides which messages are compressed with gRPC's built-in message compression, and
+// accounts for what it saves and costs. The channel is created with the policy's algorithm as its default,
+// and every call or message is then compressed or not as AlgorithmFor() or WriteOptionsFor() say:
+//   "off"       Nothing is compressed.
+//   "on"        Every message is compressed.
+//   "adaptive"  Messages are compressed while it pays off. Every 16th message is compressed on the side
+//               with zlib, on a sample of up to 64KB, to measure the ratio achieved and the CPU time per
+//               byte. Compression stays on while the latest sample saved at least 'min_saving' of the
+//               bytes and, if the bandwidth of the link is given, while sending the bytes saved would take
+//               longer than compressing them. Small messages aren't worth the header, and are never
+//               compressed.
+//
+// gRPC doesn't tell how many bytes a message took on the wire, so the bytes saved and the CPU time spent
+// are extrapolated from the samples. All methods may be called from several threads concurrently.
+
+class CompressionPolicy {
+public:
+    enum class Mode { Off, On, Adaptive };
+
+    // Parse "off", "on" or "adaptive". Throws std::invalid_argument on anything else.
+    static Mode ParseMode(const std::string& name);
+
+    // Parse "gzip" or "deflate". Throws std::invalid_argument on anything else.
+    static grpc_compression_algorithm ParseAlgorithm(const std::string& name);
+
+    // 'link_bytes_per_second' of 0 leaves the CPU time out of the decision
+    CompressionPolicy(Mode mode, grpc_compression_algorithm algorithm, double min_saving, double link_bytes_per_second);
+
+    CompressionPolicy(const CompressionPolicy&) = delete;
+    CompressionPolicy& operator=(const CompressionPolicy&) = delete;
+
+    Mode GetMode() const
+    {
+        return m_mode;
+    }
+
+    // The default algorithm of the channel, or of the calls that decide per message
+    grpc_compression_algorithm Algorithm() const
+    {
+        return (Mode::Off == m_mode) ? GRPC_COMPRESS_NONE : m_algorithm;
+    }
+
+    // Decide whether to compress a message holding 'data', and account for it
+    bool ShouldCompress(const void* data, size_t size);
+    bool ShouldCompress(const fileexchange::OffsetData& message);
+
+    // The algorithm to set on the context of a unary call sending or returning 'message'
+    grpc_compression_algorithm AlgorithmFor(const fileexchange::OffsetData& message)
+    {
+        return ShouldCompress(message) ? Algorithm() : GRPC_COMPRESS_NONE;
+    }
+
+    // The options to write a streamed message holding 'data', or 'message', with
+    grpc::WriteOptions WriteOptionsFor(const void* data, size_t size)
+    {
+        return MakeWriteOptions(ShouldCompress(data, size));
+    }
+
+    grpc::WriteOptions WriteOptionsFor(const fileexchange::OffsetData& message)
+    {
+        return MakeWriteOptions(ShouldCompress(message));
+    }
+
+    // Print the messages compressed, and the estimated bytes saved and CPU time spent
+    void Report(std::ostream& out) const;
+
+private:
+    static grpc::WriteOptions MakeWriteOptions(bool compress)
+    {
+        grpc::WriteOptions options;
+        if (! compress) {
+            options.set_no_compression();
+        }
+        return options;
+    }
+
+    static const size_t sample_interval = 16;
+    static const size_t max_sample_size = 64 * 1024;
+    static const size_t min_message_size = 256;
+
+    // Whether to measure on a message of 'size' bytes
+    bool IsSampled(size_t size);
+    void Measure(const void* sample, size_t sample_size);
+
+    // Decide on a message of 'size' bytes, and account for it
+    bool Account(size_t size);
+
+    const Mode m_mode;
+    const grpc_compression_algorithm m_algorithm;
+    const double m_min_saving;
+    const double m_link_bytes_per_second;
+
+    // Running estimates, updated under the mutex from the samples
+    std::mutex m_mutex;
+    std::atomic<double> m_ratio;            // Compressed size over original size
+    std::atomic<double> m_ns_per_byte;
+    std::atomic<bool> m_worthwhile;
+    std::atomic<bool> m_measured;
+
+    std::atomic<std::uint64_t> m_candidates;     // Messages large enough to compress
+    std::atomic<std::uint64_t> m_messages;
+    std::atomic<std::uint64_t> m_bytes;
+    std::atomic<std::uint64_t> m_compressed_messages;
+    std::atomic<std::uint64_t> m_compressed_bytes;
+    std::atomic<std::uint64_t> m_saved_bytes;
+    std::atomic<std::uint64_t> m_compression_ns;
+    std::atomic<std::uint64_t> m_sampling_ns;
+};
@@ -0,0 +1,92 @@
+#include <cstring>
+
+#include "crc32c.h"
+
+namespace {
+
+    // The reflected Castagnoli polynomial
+    const std::uint32_t polynomial = 0x82f63b78;
+
+    // tables[k][b] is the CRC of byte b followed by k zero bytes, to process eight bytes at a time
+    struct Tables {
+        std::uint32_t t[8][256];
+
+        Tables()
+        {
+            for (std::uint32_t b = 0; b < 256; ++b) {
+                std::uint32_t crc = b;
+                for (int bit = 0; bit < 8; ++bit) {
+                    crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
+                }
+                t[0][b] = crc;
+            }
+            for (std::uint32_t b = 0; b < 256; ++b) {
+                for (int k = 1; k < 8; ++k) {
+                    t[k][b] = (t[k - 1][b] >> 8) ^ t[0][t[k - 1][b] & 0xff];
+                }
+            }
+        }
+    };
+
+    std::uint32_t crc32c_tables(const std::uint8_t* p, size_t size, std::uint32_t crc)
+    {
+        static const Tables tables;
+        const auto& t = tables.t;
+        for (; (size > 0) && (0 != (reinterpret_cast<std::uintptr_t>(p) & 7)); --size) {
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+        }
+        for (; size >= 8; size -= 8, p += 8) {
+            std::uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            word ^= crc;
+            crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+                  t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        }
+        for (; size > 0; --size) {
+            crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+        }
+        return crc;
+    }
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __attribute__((target("sse4.2")))
+    std::uint32_t crc32c_sse42(const std::uint8_t* p, size_t size, std::uint32_t crc)
+    {
+        for (; (size > 0) && (0 != (reinterpret_cast<std::uintptr_t>(p) & 7)); --size) {
+            crc = __builtin_ia32_crc32qi(crc, *p++);
+        }
+        std::uint64_t crc64 = crc;
+        for (; size >= 8; size -= 8, p += 8) {
+            std::uint64_t word;
+            memcpy(&word, p, sizeof(word));
+            crc64 = __builtin_ia32_crc32di(crc64, word);
+        }
+        crc = static_cast<std::uint32_t>(crc64);
+        for (; size > 0; --size) {
+            crc = __builtin_ia32_crc32qi(crc, *p++);
+        }
+        return crc;
+    }
+
+    bool detect_sse42()
+    {
+        // Needed before __builtin_cpu_supports() in code that may run before main()
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.2");
+    }
+
+    const bool has_sse42 = detect_sse42();
+#endif
+};  // Anonymous namespace
+
+std::uint32_t crc32c(const void* data, size_t size, std::uint32_t crc)
+{
+    const std::uint8_t* const p = static_cast<const std::uint8_t*>(data);
+    crc = ~crc;
+#if defined(__x86_64__) && defined(__GNUC__)
+    if (has_sse42) {
+        return ~crc32c_sse42(p, size, crc);
+    }
+#endif
+    return ~crc32c_tables(p, size, crc);
+}
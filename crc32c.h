@@ -0,0 +1,9 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+// CRC-32C (Castagnoli), as used by iSCSI, ext4 and many storage formats. Uses the crc32 instruction of
+// SSE 4.2 where the CPU has it, and tables otherwise. To checksum data in pieces, pass the CRC of what came
+// before as 'crc'.
+std::uint32_t crc32c(const void* data, size_t size, std::uint32_t crc = 0);
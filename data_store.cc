@@ -0,0 +1,477 @@
+#include <stdexcept>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <iostream>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "data_store.h"
+#include "utils.h"
+
+using fileexchange::OffsetData;
+
+namespace {
+
+    // Open the data file and preallocate it, so that in-place writes never have to extend it
+    int open_preallocated(const std::string& path, std::uint64_t capacity)
+    {
+        const int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (-1 == fd) {
+            raise_from_errno("Failed to open the data file " + path + '.');
+        }
+
+        const int rc = (capacity > 0) ? posix_fallocate(fd, 0, capacity) : 0;
+        if (0 != rc) {
+            close(fd);
+            raise_from_system_error_code("Failed to preallocate the data file " + path + '.', rc);
+        }
+        return fd;
+    }
+
+    // Write the whole buffer at 'offset', resuming after short writes. Returns 0 or an errno value.
+    int pwrite_fully(int fd, const char* data, size_t size, std::uint64_t offset)
+    {
+        while (size > 0) {
+            const ssize_t written = pwrite(fd, data, size, offset);
+            if (-1 == written) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                return errno;
+            }
+            data += written;
+            size -= written;
+            offset += written;
+        }
+        return 0;
+    }
+
+    // Read the whole range at 'offset', resuming after short reads. Returns 0 or an errno value.
+    int pread_fully(int fd, char* data, size_t size, std::uint64_t offset)
+    {
+        while (size > 0) {
+            const ssize_t bytes_read = pread(fd, data, size, offset);
+            if (-1 == bytes_read) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                return errno;
+            }
+            if (0 == bytes_read) {
+                return EIO;     // The file was truncated behind our back
+            }
+            data += bytes_read;
+            size -= bytes_read;
+            offset += bytes_read;
+        }
+        return 0;
+    }
+
+    class PwriteStore : public DataStore {
+    public:
+        PwriteStore(const std::string& path, std::uint64_t capacity)
+            : DataStore(path, capacity)
+            , m_fd(open_preallocated(path, capacity))
+        {
+        }
+
+        ~PwriteStore()
+        {
+            close(m_fd);
+        }
+
+        int Apply(const OffsetData& request) override
+        {
+            if (! Fits(request)) {
+                return ERANGE;
+            }
+            for (int i = 0; i < request.offsets_size(); ++i) {
+                const std::string& value = request.values(i);
+                const int err = pwrite_fully(m_fd, value.data(), value.size(), request.offsets(i));
+                if (0 != err) {
+                    return err;
+                }
+            }
+            return 0;
+        }
+
+        int Read(std::uint64_t offset, size_t size, std::string* value) override
+        {
+            if (! Fits(offset, size)) {
+                return ERANGE;
+            }
+            value->resize(size);
+            return pread_fully(m_fd, &(*value)[0], size, offset);
+        }
+
+        int Sync() override
+        {
+            return (-1 == fdatasync(m_fd)) ? errno : 0;
+        }
+
+    protected:
+        const int m_fd;
+    };
+
+    class MmapStore : public DataStore {
+    public:
+        MmapStore(const std::string& path, std::uint64_t capacity)
+            : DataStore(path, capacity)
+            , m_fd(open_preallocated(path, capacity))
+            , m_data(nullptr)
+        {
+            if (capacity > 0) {
+                void* const mapping = mmap(0, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+                if (MAP_FAILED == mapping) {
+                    const int err = errno;
+                    close(m_fd);
+                    raise_from_system_error_code("Failed to map the data file " + path + '.', err);
+                }
+                m_data = static_cast<char*>(mapping);
+                // The writes go to random offsets, so don't let the kernel read around them
+                posix_madvise(mapping, capacity, POSIX_MADV_RANDOM);
+            }
+        }
+
+        ~MmapStore()
+        {
+            if (nullptr != m_data) {
+                munmap(m_data, m_capacity);
+            }
+            close(m_fd);
+        }
+
+        int Apply(const OffsetData& request) override
+        {
+            if (! Fits(request)) {
+                return ERANGE;
+            }
+            for (int i = 0; i < request.offsets_size(); ++i) {
+                const std::string& value = request.values(i);
+                memcpy(m_data + request.offsets(i), value.data(), value.size());
+            }
+            return 0;
+        }
+
+        int Read(std::uint64_t offset, size_t size, std::string* value) override
+        {
+            if (! Fits(offset, size)) {
+                return ERANGE;
+            }
+            value->assign(m_data + offset, size);
+            return 0;
+        }
+
+        int Sync() override
+        {
+            if ((nullptr != m_data) && (-1 == msync(m_data, m_capacity, MS_SYNC))) {
+                return errno;
+            }
+            return 0;
+        }
+
+    private:
+        const int m_fd;
+        char* m_data;
+    };
+
+#ifdef __linux__
+    // UringStore: Submits the values of a request as one batch of IORING_OP_WRITE operations with a single
+    // io_uring_enter(), and waits for them all. The ring is set up directly through the system calls, so
+    // there is no dependency on liburing. If the kernel can't provide a ring with IORING_OP_WRITE
+    // (Linux 5.6 or later), every request goes through pwrite() instead, and so do all the requests after
+    // io_uring_enter() itself fails.
+    class UringStore : public PwriteStore {
+    public:
+        UringStore(const std::string& path, std::uint64_t capacity)
+            : PwriteStore(path, capacity)
+            , m_ring_fd(-1)
+        {
+            SetUpRing();
+            m_use_ring.store(-1 != m_ring_fd, std::memory_order_relaxed);
+        }
+
+        ~UringStore()
+        {
+            CloseRing();
+        }
+
+        int Apply(const OffsetData& request) override
+        {
+            if (! m_use_ring.load(std::memory_order_acquire)) {
+                return PwriteStore::Apply(request);
+            }
+            if (! Fits(request)) {
+                return ERANGE;
+            }
+
+            // The ring has a single submitter and reaper at a time
+            std::unique_lock<std::mutex> lock(m_mutex);
+            const unsigned count = request.offsets_size();
+            for (unsigned first = 0; (first < count) && (-1 != m_ring_fd); first += m_sq_entries) {
+                const unsigned batch = std::min(count - first, m_sq_entries);
+                const int err = SubmitAndWait(request, first, batch);
+                if (0 != err) {
+                    return err;
+                }
+            }
+            if (-1 != m_ring_fd) {
+                return 0;
+            }
+
+            // The ring failed, before or during this request, so its values are written again
+            lock.unlock();
+            return PwriteStore::Apply(request);
+        }
+
+    private:
+        void SetUpRing()
+        {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            const int fd = syscall(__NR_io_uring_setup, ring_entries, &params);
+            if (-1 == fd) {
+                return;
+            }
+            if (0 == (params.features & IORING_FEAT_RW_CUR_POS)) {
+                close(fd);  // Older than 5.6, so no IORING_OP_WRITE
+                return;
+            }
+
+            m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            const bool single_mmap = (0 != (params.features & IORING_FEAT_SINGLE_MMAP));
+            if (single_mmap) {
+                m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+            }
+
+            void* sq_ring = mmap(0, m_sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (MAP_FAILED == sq_ring) {
+                close(fd);
+                return;
+            }
+            void* cq_ring = sq_ring;
+            if (! single_mmap) {
+                cq_ring = mmap(0, m_cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+                if (MAP_FAILED == cq_ring) {
+                    munmap(sq_ring, m_sq_ring_size);
+                    close(fd);
+                    return;
+                }
+            }
+            m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            void* sqes = mmap(0, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (MAP_FAILED == sqes) {
+                if (cq_ring != sq_ring) {
+                    munmap(cq_ring, m_cq_ring_size);
+                }
+                munmap(sq_ring, m_sq_ring_size);
+                close(fd);
+                return;
+            }
+
+            char* const sq = static_cast<char*>(sq_ring);
+            char* const cq = static_cast<char*>(cq_ring);
+            m_sq_ring = sq_ring;
+            m_cq_ring = cq_ring;
+            m_sqes = static_cast<io_uring_sqe*>(sqes);
+            m_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+            m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            m_sq_entries = params.sq_entries;
+            m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            m_ring_fd = fd;
+        }
+
+        void CloseRing()
+        {
+            if (-1 != m_ring_fd) {
+                munmap(m_sqes, m_sqes_size);
+                munmap(m_sq_ring, m_sq_ring_size);
+                if (m_cq_ring != m_sq_ring) {
+                    munmap(m_cq_ring, m_cq_ring_size);
+                }
+                close(m_ring_fd);
+                m_ring_fd = -1;
+            }
+        }
+
+        // Called with the lock held. Returns 0, or the error of the first write that failed. If the ring
+        // itself fails, it is closed, once every write it took has completed, and 0 is returned.
+        int SubmitAndWait(const OffsetData& request, unsigned first, unsigned count)
+        {
+            unsigned tail = *m_sq_tail;
+            for (unsigned i = first; i < first + count; ++i) {
+                const unsigned index = tail & m_sq_mask;
+                io_uring_sqe& sqe = m_sqes[index];
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_WRITE;
+                sqe.fd = m_fd;
+                sqe.addr = reinterpret_cast<std::uint64_t>(request.values(i).data());
+                sqe.len = request.values(i).size();
+                sqe.off = request.offsets(i);
+                sqe.user_data = i;
+                m_sq_array[index] = index;
+                ++tail;
+            }
+            __atomic_store_n(m_sq_tail, tail, __ATOMIC_RELEASE);
+
+            int err = 0;
+            unsigned to_submit = count;
+            unsigned reaped = 0;
+            while (reaped < count) {
+                const int rc = syscall(__NR_io_uring_enter, m_ring_fd, to_submit, count - reaped, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (-1 == rc) {
+                    if (EINTR == errno) {
+                        continue;
+                    }
+                    const int ring_err = errno;
+                    std::cerr << "io_uring_enter() failed on " << m_file_path << ": " << strerror(ring_err)
+                              << ". Falling back to pwrite()." << std::endl;
+                    Abandon(request, count, tail, reaped);
+                    return 0;
+                }
+                to_submit -= std::min<unsigned>(rc, to_submit);
+                reaped += Reap(request, &err);
+            }
+            return err;
+        }
+
+        // Handle the completions waiting in the ring, finishing short writes synchronously. Returns their
+        // number, and sets 'err' to the first error unless it's set already.
+        unsigned Reap(const OffsetData& request, int* err)
+        {
+            unsigned head = *m_cq_head;
+            const unsigned cq_tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+            unsigned reaped = 0;
+            for (; head != cq_tail; ++head, ++reaped) {
+                const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+                const unsigned i = cqe.user_data;
+                const std::string& value = request.values(i);
+                if (cqe.res < 0) {
+                    *err = (0 == *err) ? -cqe.res : *err;
+                }
+                else if (static_cast<size_t>(cqe.res) < value.size()) {
+                    // Finish short writes synchronously
+                    const int rest_err = pwrite_fully(m_fd, value.data() + cqe.res, value.size() - cqe.res, request.offsets(i) + cqe.res);
+                    *err = (0 == *err) ? rest_err : *err;
+                }
+            }
+            __atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+            return reaped;
+        }
+
+        // Stop using the ring after io_uring_enter() failed with 'reaped' of the 'count' writes up to
+        // 'tail' completed. The kernel may still be writing from the request's buffers for the entries it
+        // took, so those are waited for before the ring is closed; it won't take the others any more.
+        void Abandon(const OffsetData& request, unsigned count, unsigned tail, unsigned reaped)
+        {
+            m_use_ring.store(false, std::memory_order_release);
+            const unsigned submitted = count - (tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE));
+            int ignored = 0;
+            while (reaped < submitted) {
+                reaped += Reap(request, &ignored);
+                if ((reaped < submitted) &&
+                    (-1 == syscall(__NR_io_uring_enter, m_ring_fd, 0, submitted - reaped, IORING_ENTER_GETEVENTS, nullptr, 0)) &&
+                    (EINTR != errno)) {
+                    usleep(1000);   // The completions are still posted to the ring, so poll for them
+                }
+            }
+            CloseRing();
+        }
+
+        static const unsigned ring_entries = 256;
+
+        std::atomic<bool> m_use_ring;
+        std::mutex m_mutex;
+        int m_ring_fd;
+        void* m_sq_ring;
+        void* m_cq_ring;
+        size_t m_sq_ring_size;
+        size_t m_cq_ring_size;
+        io_uring_sqe* m_sqes;
+        size_t m_sqes_size;
+        unsigned* m_sq_head;
+        unsigned* m_sq_tail;
+        unsigned m_sq_mask;
+        unsigned* m_sq_array;
+        unsigned m_sq_entries;
+        unsigned* m_cq_head;
+        unsigned* m_cq_tail;
+        unsigned m_cq_mask;
+        io_uring_cqe* m_cqes;
+    };
+#endif
+};  // Anonymous namespace
+
+DataStore::DataStore(const std::string& path, std::uint64_t capacity)
+    : m_file_path(path)
+    , m_capacity(capacity)
+{
+}
+
+bool DataStore::Fits(const OffsetData& request) const
+{
+    for (int i = 0; i < request.offsets_size(); ++i) {
+        if (! Fits(request.offsets(i), request.values(i).size())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DataStore::AddStripePieces(std::uint64_t offset, const std::string& value, unsigned stripe_shift, size_t owner,
+                                size_t num_owners, OffsetData* pieces)
+{
+    const std::uint64_t first_stripe = offset >> stripe_shift;
+    const std::uint64_t last_stripe = value.empty() ? first_stripe : (offset + value.size() - 1) >> stripe_shift;
+    if ((first_stripe == last_stripe) && (first_stripe % num_owners == owner)) {
+        pieces->add_offsets(offset);
+        pieces->add_values(value);
+        return true;
+    }
+    for (std::uint64_t stripe = first_stripe; stripe <= last_stripe; ++stripe) {
+        if (stripe % num_owners != owner) {
+            continue;
+        }
+        const std::uint64_t begin = std::max(offset, stripe << stripe_shift);
+        const std::uint64_t end = std::min(offset + value.size(), (stripe + 1) << stripe_shift);
+        pieces->add_offsets(begin);
+        pieces->add_values(value.data() + (begin - offset), end - begin);
+    }
+    return false;
+}
+
+std::unique_ptr<DataStore> DataStore::Create(const std::string& engine, const std::string& path, std::uint64_t capacity)
+{
+    if ("pwrite" == engine) {
+        return std::unique_ptr<DataStore>(new PwriteStore(path, capacity));
+    }
+    if ("mmap" == engine) {
+        return std::unique_ptr<DataStore>(new MmapStore(path, capacity));
+    }
+    if ("io_uring" == engine) {
+#ifdef __linux__
+        return std::unique_ptr<DataStore>(new UringStore(path, capacity));
+#else
+        return std::unique_ptr<DataStore>(new PwriteStore(path, capacity));
+#endif
+    }
+    throw std::invalid_argument("Unknown storage engine " + engine + '.');
+}
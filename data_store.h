@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <memory>
+
+#include "file_exchange.pb.h"
+
+// DataStore: Where the values written by Put end up. Every value is written in place, at its offset in a
+// data file that is preallocated to 'capacity' bytes when it's opened. Writes that would go past the
+// capacity are refused.
+//
+// The engines differ in how the bytes get there:
+//   "pwrite"    One pwrite() per value.
+//   "mmap"      The file is mapped, and the values are copied into the mapping.
+//   "io_uring"  The values of a request are submitted as a single batch of writes. If the kernel doesn't
+//               support io_uring, this falls back to pwrite.
+//
+// Apply() and Read() may be called from several threads concurrently. Writes to the data file are not durable
+// before Sync(); durability of individual requests is the journal's job.
+
+class DataStore {
+public:
+    virtual ~DataStore() = default;
+
+    // Write every value of 'request' at its offset. Returns 0 on success, ERANGE if a value doesn't fit
+    // within the capacity, or another errno value if the write failed.
+    virtual int Apply(const fileexchange::OffsetData& request) = 0;
+
+    // Read 'size' bytes at 'offset' into 'value'. Returns 0 on success, ERANGE if the range is beyond the
+    // capacity, or another errno value if the read failed.
+    virtual int Read(std::uint64_t offset, size_t size, std::string* value) = 0;
+
+    // Flush the writes applied so far to the disk. Returns 0 or an errno value.
+    virtual int Sync() = 0;
+
+    std::string GetFilePath() const
+    {
+        return m_file_path;
+    }
+
+    std::uint64_t GetCapacity() const
+    {
+        return m_capacity;
+    }
+
+    // Check that every value of 'request' fits within the capacity
+    bool Fits(const fileexchange::OffsetData& request) const;
+    bool Fits(std::uint64_t offset, std::uint64_t size) const
+    {
+        return (offset <= m_capacity) && (size <= m_capacity - offset);
+    }
+
+    // The data file can be divided into stripes of 2^'stripe_shift' bytes, dealt out in turn to 'num_owners'
+    // threads that each write their own. Add the bytes of 'value' at 'offset' that fall into the stripes of
+    // 'owner' to 'pieces'. Returns whether the owner has all of them.
+    static bool AddStripePieces(std::uint64_t offset, const std::string& value, unsigned stripe_shift, size_t owner,
+                                size_t num_owners, fileexchange::OffsetData* pieces);
+
+    // Open the data file at 'path' with the given engine. Throws std::invalid_argument if the engine is
+    // unknown, and std::system_error if the file can't be opened or preallocated.
+    static std::unique_ptr<DataStore> Create(const std::string& engine, const std::string& path, std::uint64_t capacity);
+
+protected:
+    DataStore(const std::string& path, std::uint64_t capacity);
+
+    const std::string m_file_path;
+    const std::uint64_t m_capacity;
+};
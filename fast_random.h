@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+
+// FastRandom: The xoshiro256** generator, seeded through splitmix64. It takes a few nanoseconds per number
+// and holds 32 bytes of state, so unlike std::mt19937 with a std::random_device it costs next to nothing to
+// draw from, and a thread can keep one of its own rather than share one under a lock.
+
+class FastRandom {
+public:
+    explicit FastRandom(std::uint64_t seed)
+    {
+        for (std::uint64_t& word : m_state) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            std::uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            word = z ^ (z >> 31);
+        }
+    }
+
+    std::uint64_t Next()
+    {
+        const std::uint64_t result = Rotate(m_state[1] * 5, 7) * 9;
+        const std::uint64_t t = m_state[1] << 17;
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= t;
+        m_state[3] = Rotate(m_state[3], 45);
+        return result;
+    }
+
+    // A number in [0, bound), by Lemire's multiply and shift. The bias is below bound / 2^64.
+    std::uint64_t Below(std::uint64_t bound)
+    {
+        return static_cast<std::uint64_t>((static_cast<unsigned __int128>(Next()) * bound) >> 64);
+    }
+
+    // A number in [0, 1)
+    double Uniform()
+    {
+        return (Next() >> 11) * 0x1.0p-53;
+    }
+
+    // The generator of the calling thread, seeded differently in every thread and every run
+    static FastRandom& ForThisThread()
+    {
+        thread_local FastRandom generator((static_cast<std::uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}());
+        return generator;
+    }
+
+private:
+    static std::uint64_t Rotate(std::uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    std::uint64_t m_state[4];
+};
@@ -11,6 +11,10 @@
 #include <chrono>
 #include <random>
 #include <limits>
+#include <algorithm>
+#include <cstring>
+#include <cerrno>
+#include <sys/stat.h>
 
 #include <grpc/grpc.h>
 #include <grpc++/channel.h>
@@ -29,13 +33,21 @@
 
 #include "utils.h"
 #include "sequential_file_writer.h"
+#include "positional_file_writer.h"
 #include "file_reader_into_stream.h"
-
+#include "compression_policy.h"
+#include "crc32c.h"
+#include "retry_policy.h"
+#include "put_caller.h"
+#include "channel_pool.h"
+#include "generic_client_writer.h"
+#include "fast_random.h"
+
+using grpc::ByteBuffer;
 using grpc::Channel;
 using grpc::ClientContext;
 using grpc::ClientReader;
 using grpc::ClientReaderWriter;
-using grpc::ClientWriter;
 using grpc::Status;
 
 using fileexchange::FileId;
@@ -47,105 +59,329 @@ using fileexchange::success_failure;
 
 class FileExchangeClient {
 public:
-    FileExchangeClient(std::shared_ptr<Channel> channel)
-        : m_stub(FileExchange::NewStub(channel))
+    // The calls, and the ranges of a file, are spread over 'channels'. Files are sent in chunks of up to
+    // 'chunk_size' bytes. With 'pread_files', files are read with pread() into a buffer rather than mapped
+    // into memory. Downloaded files are synced as 'sync_policy' says, and what is sent is compressed as
+    // 'compression' decides. Puts, and ranges of files that fail to transfer, are retried as 'retry_policy'
+    // says.
+    FileExchangeClient(ChannelPool& channels, size_t chunk_size, bool pread_files,
+                       PositionalFileWriter::SyncPolicy sync_policy, CompressionPolicy& compression,
+                       RetryPolicy& retry_policy)
+        : m_channels(channels)
+        , m_chunk_size(chunk_size)
+        , m_pread_files(pread_files)
+        , m_sync_policy(sync_policy)
+        , m_compression(compression)
+        , m_retry_policy(retry_policy)
+        , m_put_caller(channels, retry_policy, compression)
+    {
+        for (size_t i = 0; i < channels.Size(); ++i) {
+            m_stubs.push_back(FileExchange::NewStub(channels.GetChannel(i)));
+            m_generic_stubs.emplace_back(new grpc::GenericStub(channels.GetChannel(i)));
+        }
+    }
+
+    // Upload the file over 'streams' concurrent calls, each sending a range of it. The ranges are multiples
+    // of the chunk size, so small files use fewer calls. A range that fails is resumed from where the
+    // server stopped verifying it.
+    bool PutFile(std::int32_t id, const std::string& filename, size_t streams)
+    {
+        struct stat st {};
+        if (-1 == stat(filename.c_str(), &st)) {
+            std::cerr << "Failed to read the size of " << filename << ": " << strerror(errno) << std::endl;
+            return false;
+        }
+        const size_t file_size = st.st_size;
+        const size_t range_size = RangeSize(file_size, streams);
+        const std::uint64_t upload_id = NewUploadId();
+        if (range_size >= file_size) {
+            return SendRange(id, filename, upload_id, 0, file_size);
+        }
+
+        std::vector<std::thread> senders;
+        std::vector<char> succeeded((file_size + range_size - 1) / range_size, false);
+        for (size_t i = 0; i < succeeded.size(); ++i) {
+            senders.emplace_back([this, id, &filename, upload_id, &succeeded, i, range_size, file_size] {
+                const size_t offset = i * range_size;
+                succeeded[i] = SendRange(id, filename, upload_id, offset, std::min(range_size, file_size - offset));
+            });
+        }
+        for (auto& sender : senders) {
+            sender.join();
+        }
+        return std::all_of(succeeded.begin(), succeeded.end(), [](char ok) { return ok; });
+    }
+
+    // Upload a range, and after each failure resume it past the part that the server verified
+    bool SendRange(std::int32_t id, const std::string& filename, std::uint64_t upload_id, size_t offset, size_t length)
+    {
+        const size_t end = offset + length;
+        for (size_t attempt = 0; ; ++attempt) {
+            if (PutFileRange(id, filename, upload_id, offset, end - offset)) {
+                return true;
+            }
+            if ((attempt == m_retry_policy.GetOptions().max_retries) || ! m_retry_policy.AllowRetry()) {
+                return false;
+            }
+            std::this_thread::sleep_for(m_retry_policy.Backoff(attempt));
+
+            offset = VerifiedUpTo(id, upload_id, offset);
+            if (offset >= end) {
+                return true;
+            }
+            std::cout << "Resuming the upload of " << filename << " at offset " << offset << std::endl;
+        }
+    }
+
+    // Where the verified part of the upload that contains 'offset' ends, or 'offset' if the server can't tell
+    std::uint64_t VerifiedUpTo(std::int32_t id, std::uint64_t upload_id, std::uint64_t offset)
     {
-        
+        ClientContext context;
+        fileexchange::UploadStatus status;
+        const ChannelPool::Lease lease = m_channels.Acquire();
+        if (! StubFor(lease).GetUploadStatus(&context, MakeFileId(id), &status).ok() || (status.upload_id() != upload_id)) {
+            return offset;
+        }
+        for (int i = 0; i < std::min(status.verified_offsets_size(), status.verified_lengths_size()); ++i) {
+            const std::uint64_t start = status.verified_offsets(i);
+            const std::uint64_t end = start + status.verified_lengths(i);
+            if ((start <= offset) && (offset < end)) {
+                return end;
+            }
+        }
+        return offset;
     }
 
-    bool PutFile(std::int32_t id, const std::string& filename)
+    bool PutFileRange(std::int32_t id, const std::string& filename, std::uint64_t upload_id, size_t offset, size_t length)
     {
         FileId returnedId;
         ClientContext context;
+        context.set_compression_algorithm(m_compression.Algorithm());
 
-        std::unique_ptr<ClientWriter<FileContent>> writer(m_stub->PutFile(&context, &returnedId));
+        // The chunks are written as pre-serialised FileContent messages that refer to the mapped file,
+        // which the generated stub can't do, so the call is made through the generic stub.
+        const ChannelPool::Lease lease = m_channels.Acquire();
+        GenericClientWriter writer(*m_generic_stubs[lease.Index()], &context, "/fileexchange.FileExchange/PutFile");
         try {
-            FileReaderIntoStream< ClientWriter<FileContent> > reader(filename, id, *writer);
-
-            // TODO: Make the chunk size configurable
-            const size_t chunk_size = 1UL << 20;    // Hardcoded to 1MB, which seems to be recommended from experience.
-            reader.Read(chunk_size);
+            if (m_pread_files) {
+                FileReaderIntoStream< GenericClientWriter, PreadFileReader > reader(filename, id, writer);
+                reader.SetCompression(&m_compression);
+                reader.SetUploadId(upload_id);
+                reader.SendRange(offset, length, m_chunk_size);
+            }
+            else {
+                FileReaderIntoStream< GenericClientWriter > reader(filename, id, writer);
+                reader.SetCompression(&m_compression);
+                reader.SetUploadId(upload_id);
+                reader.SendRange(offset, length, m_chunk_size);
+            }
         }
         catch (const std::exception& ex) {
             std::cerr << "Failed to send the file " << filename << ": " << ex.what() << std::endl;
-            // FIXME: Indicate to the server that something went wrong and that the trasfer should be aborted.
+            // The server keeps what it verified so far, so that a retry can resume after it
+            context.TryCancel();
         }
     
-        writer->WritesDone();
-        Status status = writer->Finish();
+        writer.WritesDone();
+        ByteBuffer response;
+        Status status = writer.Finish(&response);
+        if (status.ok() && ! grpc::SerializationTraits<FileId>::Deserialize(&response, &returnedId).ok()) {
+            status = Status(grpc::StatusCode::INTERNAL, "Failed to parse the response.");
+        }
         if (!status.ok()) {
             std::cerr << "File Exchange rpc failed: " << status.error_message() << std::endl;
             return false;
         }
-        else {
+        else if (0 == offset) {
             std::cout << "Finished sending file with id " << returnedId.id() << std::endl;
         }
 
         return true;
     }
 
-bool Put(std::int32_t offset, const std::string& data) {
-std::cout<<"in puts";
-    OffsetData request;
-    request.set_offset(offset);
-    request.set_data(data);
+    // Write 'data' at 'offset'. Every attempt has a fresh context, and is retried or hedged as the retry
+    // policy says.
+    bool Put(std::int32_t offset, const std::string& data)
+    {
+        OffsetData request;
+        request.add_offsets(offset);
+        request.add_values(data);
+
+        success_failure response;
+        const Status status = m_put_caller.Put(request, &response);
+        if (status.ok()) {
+            std::cout << "Data inserted successfully at offset " << response.id() << std::endl;
+            std::cout << response.id() << std::endl;
+            return true;
+        } else {
+            std::cerr << "RPC failed: " << status.error_message() << std::endl;
+            return false;
+        }
+    }
 
-    success_failure response;
-    grpc::ClientContext context;
+    // A number in [0, max], from the calling thread's generator
+    unsigned long long generateRandomNumber(unsigned long long max)
+    {
+        FastRandom& random = FastRandom::ForThisThread();
+        return (std::numeric_limits<unsigned long long>::max() == max) ? random.Next() : random.Below(max + 1);
+    }
 
-    grpc::Status status;
-int max_retry_attempts = 3;
-int retry_count = 0;
 
-while (retry_count < max_retry_attempts) {
-    // Make your RPC call here.
-    // Replace YourRpcMethod with your actual RPC method.
-    status =  m_stub->Put(&context, request, &response);
-int backoff_duration_ms = 10;  
-    if (status.ok()) {
-        break;
-    } else {
-        retry_count++;
-        std::this_thread::sleep_for(std::chrono::milliseconds(backoff_duration_ms));
-    }
-}
-    if (status.ok()) {
-        std::cout << "Data inserted successfully at offset " << response.id() << std::endl;
-        std::cout << response.id() << std::endl;
+    // Download the file over 'streams' concurrent calls, each receiving a range of it, and write the ranges
+    // at their positions in the local file. A range that fails is resumed past what was received of it.
+    bool GetFileContent(std::int32_t id, size_t streams)
+    {
+        if (streams <= 1) {
+            return GetFileContent(id);
+        }
+
+        FileId requestedId;
+        fileexchange::FileInfo info;
+        ClientContext context;
+        requestedId.set_id(id);
+        const Status status = StubFor(m_channels.Acquire()).GetFileInfo(&context, requestedId, &info);
+        if (! status.ok()) {
+            std::cerr << "Failed to get the file with id " << id << ": " << status.error_message() << std::endl;
+            return false;
+        }
+
+        const size_t file_size = info.size();
+        const size_t range_size = RangeSize(file_size, streams);
+        PositionalFileWriter writer(m_sync_policy);
+        try {
+            writer.Open(info.name(), file_size);
+        }
+        catch (const std::system_error& ex) {
+            std::cerr << "Failed to receive " << info.name() << ": " << ex.what() << std::endl;
+            return false;
+        }
+
+        std::vector<std::thread> receivers;
+        std::vector<char> succeeded((file_size + range_size - 1) / range_size, false);
+        for (size_t i = 0; i < succeeded.size(); ++i) {
+            receivers.emplace_back([this, id, &writer, &succeeded, i, range_size, file_size] {
+                const size_t offset = i * range_size;
+                succeeded[i] = ReceiveRange(id, offset, std::min(range_size, file_size - offset), writer);
+            });
+        }
+        for (auto& receiver : receivers) {
+            receiver.join();
+        }
+        if (! std::all_of(succeeded.begin(), succeeded.end(), [](char ok) { return ok; })) {
+            return false;
+        }
+        try {
+            writer.Close();
+        }
+        catch (const std::system_error& ex) {
+            std::cerr << "Failed to receive " << info.name() << ": " << ex.what() << std::endl;
+            return false;
+        }
+        std::cout << "Finished receiving the file "  << info.name() << " id: " << id << std::endl;
         return true;
-    } else {
-        std::cerr << "RPC failed: " << status.error_message() << std::endl;
-        return false;
     }
-    
-}
-unsigned long long generateRandomNumber(unsigned long long max) {
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<unsigned long long> distribution(0, max);
-    return distribution(gen);
-}
 
+    // Download a range, and after each failure resume it past the chunks received
+    bool ReceiveRange(std::int32_t id, size_t offset, size_t length, PositionalFileWriter& writer)
+    {
+        const size_t end = offset + length;
+        for (size_t attempt = 0; ; ++attempt) {
+            std::uint64_t position = offset;
+            const bool received = GetFileRange(id, offset, end - offset, writer, &position);
+            // A range of length 0 would stand for the rest of the file
+            if (received || (position >= end)) {
+                return true;
+            }
+            if ((attempt == m_retry_policy.GetOptions().max_retries) || ! m_retry_policy.AllowRetry()) {
+                return false;
+            }
+            std::this_thread::sleep_for(m_retry_policy.Backoff(attempt));
+            offset = position;
+            std::cout << "Resuming the download of " << writer.GetFilePath() << " at offset " << offset << std::endl;
+        }
+    }
+
+    // Receive a range, and set 'position' to the end of the chunks that passed their checksum and were
+    // handed to 'writer'
+    bool GetFileRange(std::int32_t id, size_t offset, size_t length, PositionalFileWriter& writer, std::uint64_t* position)
+    {
+        fileexchange::FileRange range;
+        FileContent contentPart;
+        ClientContext context;
+
+        range.set_id(id);
+        range.set_offset(offset);
+        range.set_length(length);
+        const ChannelPool::Lease lease = m_channels.Acquire();
+        std::unique_ptr<ClientReader<FileContent> > reader(StubFor(lease).GetFileRange(&context, range));
+        try {
+            bool first_chunk = true;
+            while (reader->Read(&contentPart)) {
+                if (first_chunk) {
+                    *position = contentPart.offset();
+                    first_chunk = false;
+                }
+                const std::string& content = contentPart.content();
+                if (crc32c(content.data(), content.size()) != contentPart.crc32c()) {
+                    std::cerr << "The chunk of " << writer.GetFilePath() << " at offset " << *position << " failed its checksum" << std::endl;
+                    context.TryCancel();
+                    reader->Finish();
+                    return false;
+                }
+                const size_t size = content.size();
+                writer.Write(*position, *contentPart.mutable_content());
+                *position += size;
+            }
+        }
+        catch (const std::system_error& ex) {
+            std::cerr << "Failed to receive " << writer.GetFilePath() << ": " << ex.what() << std::endl;
+            context.TryCancel();
+            reader->Finish();
+            return false;
+        }
+
+        const auto status = reader->Finish();
+        if (! status.ok()) {
+            std::cerr << "Failed to get the file " << writer.GetFilePath() << " with id " << id << ": " << status.error_message() << std::endl;
+            return false;
+        }
+        return true;
+    }
 
     bool GetFileContent(std::int32_t id)
     {
         FileId requestedId;
         FileContent contentPart;
         ClientContext context;
-        SequentialFileWriter writer;
+        SequentialFileWriter writer(m_sync_policy);
         std::string filename;
 
         requestedId.set_id(id);
-        std::unique_ptr<ClientReader<FileContent> > reader(m_stub->GetFileContent(&context, requestedId));
+        const ChannelPool::Lease lease = m_channels.Acquire();
+        std::unique_ptr<ClientReader<FileContent> > reader(StubFor(lease).GetFileContent(&context, requestedId));
         try {
             while (reader->Read(&contentPart)) {
                 assert(contentPart.id() == id);
-                filename = contentPart.name();
-                writer.OpenIfNecessary(contentPart.name());
+                // Only the first chunk carries the name
+                if (filename.empty()) {
+                    filename = contentPart.name();
+                }
+                const std::string& content = contentPart.content();
+                if (crc32c(content.data(), content.size()) != contentPart.crc32c()) {
+                    std::cerr << "A chunk of " << filename << " failed its checksum" << std::endl;
+                    context.TryCancel();
+                    reader->Finish();
+                    return false;
+                }
+                // The first chunk also carries the size of the file, so that it is preallocated
+                writer.OpenIfNecessary(filename, contentPart.file_size());
                 auto* const data = contentPart.mutable_content();
                 writer.Write(*data);
             };
             const auto status = reader->Finish();
+            if (status.ok()) {
+                writer.Close();
+            }
             if (! status.ok()) {
                 std::cerr << "Failed to get the file ";
                 if (! filename.empty()) {
@@ -164,7 +400,36 @@ unsigned long long generateRandomNumber(unsigned long long max) {
         return true;
     }
 private:
-    std::unique_ptr<fileexchange::FileExchange::Stub> m_stub;
+    // Identifies an upload to the server, which resumes it rather than starting over if it sees it again
+    static std::uint64_t NewUploadId()
+    {
+        std::random_device rd;
+        return (static_cast<std::uint64_t>(rd()) << 32) | rd();
+    }
+
+    // Split a file into 'streams' ranges of whole chunks
+    size_t RangeSize(size_t file_size, size_t streams) const
+    {
+        const size_t chunks = (file_size + m_chunk_size - 1) / m_chunk_size;
+        const size_t chunks_per_range = (chunks + std::max<size_t>(streams, 1) - 1) / std::max<size_t>(streams, 1);
+        return std::max<size_t>(chunks_per_range, 1) * m_chunk_size;
+    }
+
+    // The stub on the channel that 'lease' holds
+    FileExchange::Stub& StubFor(const ChannelPool::Lease& lease)
+    {
+        return *m_stubs[lease.Index()];
+    }
+
+    ChannelPool& m_channels;
+    const size_t m_chunk_size;
+    std::vector< std::unique_ptr<fileexchange::FileExchange::Stub> > m_stubs;
+    std::vector< std::unique_ptr<grpc::GenericStub> > m_generic_stubs;
+    const bool m_pread_files;
+    const PositionalFileWriter::SyncPolicy m_sync_policy;
+    CompressionPolicy& m_compression;
+    RetryPolicy& m_retry_policy;
+    PutCaller m_put_caller;
 };
 
 void usage [[ noreturn ]] (const char* prog_name)
@@ -189,6 +454,14 @@ int main(int argc, char** argv)
     }
 
     std::string serverAddress = config.get<std::string>("server_address");
+    // Number of concurrent calls a file is transferred over
+    const size_t file_streams = config.get<size_t>("fileStreams", 1);
+    // fileChunkBytes is the size of the chunks files are sent in
+    const size_t file_chunk_bytes = config.get<size_t>("fileChunkBytes", 1 << 20);
+    if (0 == file_chunk_bytes) {
+        std::cerr << "fileChunkBytes must be positive." << std::endl;
+        return 1;
+    }
     const std::string verb = argv[1];
     std::int32_t id = -1;
     try {
@@ -208,17 +481,72 @@ int main(int argc, char** argv)
 // std::shared_ptr<grpc::Channel> channel = grpc::CreateCustomChannel(server_address, grpc::InsecureChannelCredentials(), channel_args);
 
 
-    FileExchangeClient client(grpc::CreateChannel(serverAddress, grpc::InsecureChannelCredentials()));
+    // fileReader selects how files are read for uploading: "mmap" or "pread"
+    const bool pread_files = ("pread" == config.get<std::string>("fileReader", "mmap"));
+    // fileSyncPolicy selects when downloaded files are flushed to the disk: "none", "end" or "periodic"
+    PositionalFileWriter::SyncPolicy sync_policy;
+    try {
+        sync_policy = PositionalFileWriter::ParseSyncPolicy(config.get<std::string>("fileSyncPolicy", "none"));
+    }
+    catch (const std::invalid_argument& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    // compression is "off", "on" or "adaptive". In adaptive mode, compression is turned off while it saves
+    // less than compressionMinSaving of the bytes, or, if compressionLinkMbps is given, while it takes longer
+    // than sending the bytes it saves over such a link.
+    std::unique_ptr<CompressionPolicy> compression;
+    try {
+        compression.reset(new CompressionPolicy(CompressionPolicy::ParseMode(config.get<std::string>("compression", "off")),
+                                                CompressionPolicy::ParseAlgorithm(config.get<std::string>("compressionAlgorithm", "gzip")),
+                                                config.get<double>("compressionMinSaving", 0.1),
+                                                config.get<double>("compressionLinkMbps", 0) * 1e6 / 8));
+    }
+    catch (const std::invalid_argument& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+
+    // Puts and the ranges of files are retried up to max_retries times while the retry budget lasts. A Put
+    // is given putDeadlineMs altogether and putAttemptTimeoutMs per attempt, and with hedgeQuantile above 0
+    // an attempt that takes longer than that quantile of the latencies is hedged with a duplicate.
+    RetryPolicy::Options retry_options;
+    retry_options.max_retries = config.get<size_t>("max_retries", 3);
+    retry_options.call_timeout = std::chrono::milliseconds(config.get<long>("putDeadlineMs", 0));
+    retry_options.attempt_timeout = std::chrono::milliseconds(config.get<long>("putAttemptTimeoutMs", 0));
+    retry_options.initial_backoff = std::chrono::milliseconds(config.get<long>("retryInitialBackoffMs", 10));
+    retry_options.max_backoff = std::chrono::milliseconds(config.get<long>("retryMaxBackoffMs", 1000));
+    retry_options.budget_tokens = config.get<double>("retryBudgetTokens", 10);
+    retry_options.budget_ratio = config.get<double>("retryBudgetRatio", 0.1);
+    retry_options.hedge_quantile = config.get<double>("hedgeQuantile", 0);
+    RetryPolicy retry_policy(retry_options);
+
+    // The calls are spread over 'channels' connections, picked as channelPolicy says: "round_robin" or
+    // "least_outstanding". The channels compress with the configured algorithm unless a call or a message
+    // says otherwise.
+    grpc::ChannelArguments channel_arguments;
+    channel_arguments.SetCompressionAlgorithm(compression->Algorithm());
+    std::unique_ptr<ChannelPool> channels;
+    try {
+        channels.reset(new ChannelPool(serverAddress, grpc::InsecureChannelCredentials(), channel_arguments,
+                                       config.get<size_t>("channels", 1),
+                                       ChannelPool::ParsePolicy(config.get<std::string>("channelPolicy", "round_robin"))));
+    }
+    catch (const std::invalid_argument& ex) {
+        std::cerr << ex.what() << std::endl;
+        return 1;
+    }
+    FileExchangeClient client(*channels, file_chunk_bytes, pread_files, sync_policy, *compression, retry_policy);
 
     if ("put" == verb) {
         if (4 != argc) {
             usage(argv[0]);
         }
         const std::string filename = argv[3];
-        succeeded = client.PutFile(id, filename);
+        succeeded = client.PutFile(id, filename, file_streams);
     }
-
-if ("puts" == verb) {
+    else if ("puts" == verb) {
         if (4 != argc) {
             usage(argv[0]);
         }
@@ -238,12 +566,15 @@ if ("puts" == verb) {
         if (3 != argc) {
             usage(argv[0]);
         }
-        succeeded = client.GetFileContent(id);
+        succeeded = client.GetFileContent(id, file_streams);
     }
     else {
         std::cerr << "Unknown verb " << verb << std::endl;
         usage(argv[0]);
     }
 
+    if (CompressionPolicy::Mode::Off != compression->GetMode()) {
+        compression->Report(std::cout);
+    }
     return succeeded ? EX_OK : EX_IOERR;
 }
@@ -0,0 +1,761 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <cstdint>
+#include <utility>
+#include <cassert>
+#include <sysexits.h>
+#include <chrono>
+#include <random>
+#include <limits>
+#include <algorithm>
+
+#include <grpc/grpc.h>
+#include <grpc++/channel.h>
+#include <grpc++/client_context.h>
+#include <grpc++/create_channel.h>
+#include <grpc++/security/credentials.h>
+#include <grpc++/grpc++.h>
+#include <grpcpp/grpcpp.h>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+#include <csignal>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include "file_exchange.grpc.pb.h"
+#include "put_batcher.h"
+#include "replay_stats.h"
+#include "workload_file.h"
+#include "request_arena.h"
+#include "compression_policy.h"
+#include "retry_policy.h"
+#include "put_caller.h"
+#include "channel_pool.h"
+#include "workload_generator.h"
+#include "fast_random.h"
+
+using grpc::Channel;
+using grpc::ClientAsyncResponseReader;
+using grpc::ClientContext;
+using grpc::ClientReaderWriter;
+using grpc::CompletionQueue;
+using grpc::Status;
+
+using fileexchange::BulkPutAck;
+using fileexchange::OffsetData;
+using fileexchange::success_failure;
+
+// BulkPutStream: Streams batches of writes over a single BulkPut call, keeping up to 'window' batches
+// unacknowledged. Write() only blocks while the window is full, so the throughput is bounded by the
+// bandwidth rather than by the round-trip time. Each batch is compressed as 'compression' decides. The call
+// holds 'lease' on the channel it goes over for as long as it lasts.
+class BulkPutStream
+{
+public:
+    BulkPutStream(ChannelPool::Lease lease, fileexchange::FileExchange::Stub &stub, size_t window, CompressionPolicy &compression)
+        : m_lease(std::move(lease)),
+          m_compression(compression),
+          m_stream(StartCall(stub, m_context, compression)),
+          m_window(window > 0 ? window : 1),
+          m_acked(0),
+          m_broken(false)
+    {
+        m_ack_reader = std::thread(&BulkPutStream::ReadAcks, this);
+    }
+
+    ~BulkPutStream()
+    {
+        if (m_ack_reader.joinable())
+        {
+            Finish();
+        }
+    }
+
+    // Called with whether a batch was committed
+    using BatchCompletion = std::function<void(bool)>;
+
+    // Send a batch, waiting for room in the window first. Returns false if the call has failed. 'done',
+    // if given, is called once the batch is acknowledged or the call fails.
+    bool Write(const OffsetData &batch, BatchCompletion done = nullptr)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_acked_cv.wait(lock, [this] { return m_broken || m_unacked.size() < m_window; });
+            if (m_broken)
+            {
+                lock.unlock();
+                if (done)
+                {
+                    done(false);
+                }
+                return false;
+            }
+            m_unacked.push_back(std::move(done));
+        }
+
+        return m_stream->Write(batch, m_compression.WriteOptionsFor(batch));
+    }
+
+    // Wait until every batch was acknowledged and end the call. Returns true if they all succeeded.
+    bool Finish()
+    {
+        m_stream->WritesDone();
+        m_ack_reader.join();
+
+        const Status status = m_stream->Finish();
+        if (!status.ok())
+        {
+            std::cerr << "BulkPut failed after " << m_acked << " batches: " << status.error_message() << std::endl;
+            return false;
+        }
+        return m_unacked.empty();
+    }
+
+private:
+    static std::unique_ptr<ClientReaderWriter<OffsetData, BulkPutAck>> StartCall(fileexchange::FileExchange::Stub &stub,
+                                                                                 ClientContext &context,
+                                                                                 CompressionPolicy &compression)
+    {
+        context.set_compression_algorithm(compression.Algorithm());
+        return stub.BulkPut(&context);
+    }
+
+    void ReadAcks()
+    {
+        BulkPutAck ack;
+        while (m_stream->Read(&ack))
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            while (m_acked < ack.committed() && !m_unacked.empty())
+            {
+                if (m_unacked.front())
+                {
+                    m_unacked.front()(true);
+                }
+                m_unacked.pop_front();
+                ++m_acked;
+            }
+            m_acked_cv.notify_all();
+        }
+
+        // Whatever wasn't acknowledged by now never will be
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_broken = true;
+        for (BatchCompletion &done : m_unacked)
+        {
+            if (done)
+            {
+                done(false);
+            }
+        }
+        m_acked_cv.notify_all();
+    }
+
+    ChannelPool::Lease m_lease;
+    CompressionPolicy &m_compression;
+    ClientContext m_context;
+    std::unique_ptr<ClientReaderWriter<OffsetData, BulkPutAck>> m_stream;
+    const size_t m_window;
+
+    std::mutex m_mutex;
+    std::condition_variable m_acked_cv;
+    std::deque<BatchCompletion> m_unacked;
+    std::uint64_t m_acked;
+    bool m_broken;
+    std::thread m_ack_reader;
+};
+
+// AsyncPutClient: Issues unary Put calls without waiting for them, keeping up to 'window' of them in flight.
+// The completions are polled by 'num_threads' threads, each with a completion queue of its own, which the
+// calls are spread over in turn, as they are over the channels of 'channels'. The calls get the deadlines of
+// 'retry_policy', but aren't retried.
+//
+// The window adapts to the server: it is halved whenever the server refuses a call for lack of room, and
+// grows back by one call per window of calls that succeed while the server's queue is under three quarters
+// of its limit.
+class AsyncPutClient
+{
+public:
+    // Called with whether the call succeeded and the time it took, on one of the polling threads
+    using Completion = std::function<void(bool, std::chrono::nanoseconds)>;
+
+    AsyncPutClient(ChannelPool &channels, size_t window, size_t num_threads, CompressionPolicy &compression,
+                   RetryPolicy &retry_policy)
+        : m_channels(channels),
+          m_compression(compression),
+          m_retry_policy(retry_policy),
+          m_max_window(window > 0 ? window : 1),
+          m_window(m_max_window),
+          m_window_successes(0),
+          m_next_queue(0),
+          m_in_flight(0)
+    {
+        for (size_t i = 0; i < channels.Size(); ++i)
+        {
+            m_stubs.push_back(fileexchange::FileExchange::NewStub(channels.GetChannel(i)));
+        }
+        for (size_t i = 0; i < std::max<size_t>(num_threads, 1); ++i)
+        {
+            m_queues.emplace_back(new CompletionQueue);
+        }
+        for (auto &cq : m_queues)
+        {
+            m_threads.emplace_back(&AsyncPutClient::Poll, this, cq.get());
+        }
+    }
+
+    // Waits for the calls in flight
+    ~AsyncPutClient()
+    {
+        Drain();
+        for (auto &cq : m_queues)
+        {
+            cq->Shutdown();
+        }
+        for (auto &thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    // Start a call, waiting for room in the window first
+    void Put(OffsetData &&request, Completion done)
+    {
+        CompletionQueue *cq = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_window_cv.wait(lock, [this] { return m_in_flight < m_window; });
+            ++m_in_flight;
+            cq = m_queues[m_next_queue++ % m_queues.size()].get();
+        }
+
+        // The channel is only picked once the call can start, so that a caller blocked on the window
+        // doesn't count as outstanding on a channel that calls in flight are using
+        std::unique_ptr<Call> call(new Call(m_channels.Acquire()));
+        call->request = std::move(request);
+        call->done = std::move(done);
+
+        call->context.set_compression_algorithm(m_compression.AlgorithmFor(call->request));
+        const auto deadline = m_retry_policy.AttemptDeadline(m_retry_policy.CallDeadline());
+        if (std::chrono::system_clock::time_point::max() != deadline)
+        {
+            call->context.set_deadline(deadline);
+        }
+        call->sent_at = std::chrono::steady_clock::now();
+        call->reader = m_stubs[call->lease.Index()]->PrepareAsyncPut(&call->context, call->request, cq);
+        call->reader->StartCall();
+        Call *const tag = call.release();
+        tag->reader->Finish(&tag->response, &tag->status, tag);
+    }
+
+    // Wait until no call is in flight
+    void Drain()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_window_cv.wait(lock, [this] { return 0 == m_in_flight; });
+    }
+
+private:
+    struct Call
+    {
+        explicit Call(ChannelPool::Lease channel_lease)
+            : lease(std::move(channel_lease))
+        {
+        }
+
+        ChannelPool::Lease lease;
+        ClientContext context;
+        OffsetData request;
+        success_failure response;
+        Status status;
+        std::unique_ptr<ClientAsyncResponseReader<success_failure>> reader;
+        std::chrono::steady_clock::time_point sent_at;
+        Completion done;
+    };
+
+    void Poll(CompletionQueue *cq)
+    {
+        void *tag = nullptr;
+        bool ok = false;
+        while (cq->Next(&tag, &ok))
+        {
+            std::unique_ptr<Call> call(static_cast<Call *>(tag));
+            const bool succeeded = ok && call->status.ok();
+            if (!succeeded)
+            {
+                std::cerr << "RPC failed: " << call->status.error_message() << std::endl;
+            }
+            const auto latency = std::chrono::steady_clock::now() - call->sent_at;
+            m_retry_policy.OnResult(call->status, latency);
+            call->done(succeeded, latency);
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_in_flight;
+            if (grpc::StatusCode::RESOURCE_EXHAUSTED == call->status.error_code())
+            {
+                m_window = std::max<size_t>(m_window / 2, 1);
+                m_window_successes = 0;
+            }
+            else if (succeeded && (m_window < m_max_window) &&
+                     (4 * call->response.queued_bytes() < 3 * call->response.queue_limit_bytes() ||
+                      0 == call->response.queue_limit_bytes()) &&
+                     (++m_window_successes >= m_window))
+            {
+                ++m_window;
+                m_window_successes = 0;
+            }
+            m_window_cv.notify_all();
+        }
+    }
+
+    ChannelPool &m_channels;
+    std::vector<std::unique_ptr<fileexchange::FileExchange::Stub>> m_stubs;
+    CompressionPolicy &m_compression;
+    RetryPolicy &m_retry_policy;
+    const size_t m_max_window;
+    std::vector<std::unique_ptr<CompletionQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_window_cv;
+    size_t m_window;
+    size_t m_window_successes;
+    size_t m_next_queue;
+    size_t m_in_flight;
+};
+
+class FileExchangeClient
+{
+public:
+    // The calls are spread over 'channels'. The requests are compressed as 'compression' decides, and retried
+    // or hedged as 'retry_policy' says.
+    FileExchangeClient(ChannelPool &channels, CompressionPolicy &compression, RetryPolicy &retry_policy)
+        : m_channels(channels),
+          m_compression(compression),
+          m_retry_policy(retry_policy),
+          m_put_caller(channels, retry_policy, compression)
+    {
+        for (size_t i = 0; i < channels.Size(); ++i)
+        {
+            m_stubs.push_back(fileexchange::FileExchange::NewStub(channels.GetChannel(i)));
+        }
+    }
+
+    // Build the request in the calling thread's RequestArena, so that in steady state this allocates
+    // nothing beyond what gRPC itself needs for the call.
+    bool Put(const std::vector<std::uint64_t> &offsets, const std::vector<std::string_view> &values)
+    {
+        RequestArena &arena = RequestArena::ForThisThread();
+        OffsetData &request = arena.NewRequest();
+        for (size_t i = 0; i < offsets.size() && i < values.size(); ++i)
+        {
+            RequestArena::AddWrite(request, offsets[i], values[i]);
+        }
+
+        return Put(request, &arena.Response());
+    }
+
+    bool Put(std::uint64_t offset, std::string_view value)
+    {
+        RequestArena &arena = RequestArena::ForThisThread();
+        OffsetData &request = arena.NewRequest();
+        RequestArena::AddWrite(request, offset, value);
+
+        return Put(request, &arena.Response());
+    }
+
+    bool Put(const OffsetData &request)
+    {
+        success_failure response;
+        return Put(request, &response);
+    }
+
+    bool Put(const OffsetData &request, success_failure *response)
+    {
+        const grpc::Status status = m_put_caller.Put(request, response);
+        if (status.ok())
+        {
+            // std::cout << "Data inserted successfully at offset " << response.id() << std::endl;
+            // std::cout << response.id() << std::endl;
+            return true;
+        }
+        else
+        {
+            std::cerr << "RPC failed: " << status.error_message() << std::endl;
+            return false;
+        }
+    }
+
+    // Read the values at 'offsets', which are 'lengths' bytes long. 'lengths' may be empty, in which
+    // case the server reads the values that were last written at these offsets.
+    bool Get(const std::vector<std::uint64_t> &offsets, const std::vector<std::uint32_t> &lengths, OffsetData *values)
+    {
+        fileexchange::Offsets request;
+        request.mutable_offsets()->Add(offsets.begin(), offsets.end());
+        request.mutable_lengths()->Add(lengths.begin(), lengths.end());
+
+        grpc::ClientContext context;
+        const ChannelPool::Lease lease = m_channels.Acquire();
+        const grpc::Status status = m_stubs[lease.Index()]->Get(&context, request, values);
+        if (!status.ok())
+        {
+            std::cerr << "RPC failed: " << status.error_message() << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Open a BulkPut call that keeps up to 'window' batches in flight
+    std::unique_ptr<BulkPutStream> BulkPut(size_t window)
+    {
+        ChannelPool::Lease lease = m_channels.Acquire();
+        fileexchange::FileExchange::Stub &stub = *m_stubs[lease.Index()];
+        return std::unique_ptr<BulkPutStream>(new BulkPutStream(std::move(lease), stub, window, m_compression));
+    }
+
+    // Issue asynchronous Put calls, keeping up to 'window' of them in flight
+    std::unique_ptr<AsyncPutClient> AsyncPut(size_t window, size_t num_threads)
+    {
+        return std::unique_ptr<AsyncPutClient>(new AsyncPutClient(m_channels, window, num_threads, m_compression, m_retry_policy));
+    }
+
+    // Coalesce writes into batches, and send them with Put(), or over 'stream' or with 'async_put' if one
+    // of them is given. They must outlive the batcher.
+    std::unique_ptr<PutBatcher> Batcher(PutBatcher::Limits limits, PutBatcher::BatchCallback on_batch,
+                                        BulkPutStream *stream = nullptr, AsyncPutClient *async_put = nullptr)
+    {
+        PutBatcher::Sender send;
+        if (stream)
+        {
+            send = [stream](OffsetData &&batch, std::function<void(bool)> done) {
+                stream->Write(batch, std::move(done));
+            };
+        }
+        else if (async_put)
+        {
+            send = [async_put](OffsetData &&batch, std::function<void(bool)> done) {
+                async_put->Put(std::move(batch), [done](bool ok, std::chrono::nanoseconds) { done(ok); });
+            };
+        }
+        else
+        {
+            send = [this](OffsetData &&batch, std::function<void(bool)> done) {
+                done(Put(batch));
+            };
+        }
+        return std::unique_ptr<PutBatcher>(new PutBatcher(std::move(send), limits, std::move(on_batch)));
+    }
+
+    // A number in [0, max], from the calling thread's generator
+    unsigned long long generateRandomNumber(unsigned long long max)
+    {
+        FastRandom &random = FastRandom::ForThisThread();
+        return (std::numeric_limits<unsigned long long>::max() == max) ? random.Next() : random.Below(max + 1);
+    }
+
+private:
+    ChannelPool &m_channels;
+    std::vector<std::unique_ptr<fileexchange::FileExchange::Stub>> m_stubs;
+    CompressionPolicy &m_compression;
+    RetryPolicy &m_retry_policy;
+    PutCaller m_put_caller;
+};
+
+void usage [[noreturn]] (const char *prog_name)
+{
+    std::cerr << "USAGE: " << prog_name << " [put|get] num_id [filename]" << std::endl;
+    std::exit(EX_USAGE);
+}
+
+int main(int argc, char **argv)
+{
+    boost::property_tree::ptree config;
+    try
+    {
+        boost::property_tree::read_json("client_config.json", config);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "Error reading config file: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::string serverAddress = config.get<std::string>("server_address");
+
+    // compression is "off", "on" or "adaptive". In adaptive mode, compression is turned off while it saves
+    // less than compressionMinSaving of the bytes, or, if compressionLinkMbps is given, while it takes longer
+    // than sending the bytes it saves over such a link.
+    std::unique_ptr<CompressionPolicy> compression;
+    try {
+        compression.reset(new CompressionPolicy(CompressionPolicy::ParseMode(config.get<std::string>("compression", "off")),
+                                                CompressionPolicy::ParseAlgorithm(config.get<std::string>("compressionAlgorithm", "gzip")),
+                                                config.get<double>("compressionMinSaving", 0.1),
+                                                config.get<double>("compressionLinkMbps", 0) * 1e6 / 8));
+    }
+    catch (const std::invalid_argument &e) {
+        std::cerr << e.what() << std::endl;
+        return EX_CONFIG;
+    }
+
+    // A Put is retried up to max_retries times, within putDeadlineMs altogether and putAttemptTimeoutMs per
+    // attempt, while the retry budget lasts. With hedgeQuantile above 0, an attempt that takes longer than
+    // that quantile of the latencies is hedged with a duplicate.
+    RetryPolicy::Options retry_options;
+    retry_options.max_retries = config.get<size_t>("max_retries", 3);
+    retry_options.call_timeout = std::chrono::milliseconds(config.get<long>("putDeadlineMs", 0));
+    retry_options.attempt_timeout = std::chrono::milliseconds(config.get<long>("putAttemptTimeoutMs", 0));
+    retry_options.initial_backoff = std::chrono::milliseconds(config.get<long>("retryInitialBackoffMs", 10));
+    retry_options.max_backoff = std::chrono::milliseconds(config.get<long>("retryMaxBackoffMs", 1000));
+    retry_options.budget_tokens = config.get<double>("retryBudgetTokens", 10);
+    retry_options.budget_ratio = config.get<double>("retryBudgetRatio", 0.1);
+    retry_options.hedge_quantile = config.get<double>("hedgeQuantile", 0);
+    RetryPolicy retry_policy(retry_options);
+
+    // The calls are spread over 'channels' connections, picked as channelPolicy says: "round_robin" or
+    // "least_outstanding". The channels compress with the configured algorithm unless a call or a message
+    // says otherwise.
+    grpc::ChannelArguments channel_arguments;
+    channel_arguments.SetCompressionAlgorithm(compression->Algorithm());
+    std::unique_ptr<ChannelPool> channels;
+    try {
+        channels.reset(new ChannelPool(serverAddress, grpc::InsecureChannelCredentials(), channel_arguments,
+                                       config.get<size_t>("channels", 1),
+                                       ChannelPool::ParsePolicy(config.get<std::string>("channelPolicy", "round_robin"))));
+    }
+    catch (const std::invalid_argument &e) {
+        std::cerr << e.what() << std::endl;
+        return EX_CONFIG;
+    }
+    FileExchangeClient client(*channels, *compression, retry_policy);
+
+    // With workload set to "generator", the operations are synthesised as the generator* keys say instead of
+    // being read from a trace. generatorOperations of them are issued from generatorThreads threads, at
+    // generatorRate operations per second altogether, or as fast as possible if that is 0.
+    std::unique_ptr<WorkloadGenerator> generator;
+    if ("generator" == config.get<std::string>("workload", "trace")) {
+        try {
+            WorkloadGenerator::Options generator_options;
+            generator_options.offsets = WorkloadGenerator::ParseOffsetDistribution(config.get<std::string>("generatorOffsets", "uniform"));
+            generator_options.slots = config.get<std::uint64_t>("generatorSlots", 1 << 18);
+            generator_options.slot_size = config.get<size_t>("generatorSlotBytes", 4096);
+            generator_options.zipf_skew = config.get<double>("generatorZipfSkew", 0.99);
+            generator_options.hot_fraction = config.get<double>("generatorHotFraction", 0.2);
+            generator_options.hot_probability = config.get<double>("generatorHotProbability", 0.8);
+            generator_options.sizes = WorkloadGenerator::ParseSizeDistribution(config.get<std::string>("generatorValueSizes", "fixed"));
+            generator_options.value_size = config.get<size_t>("generatorValueBytes", 1024);
+            generator_options.min_value_size = config.get<size_t>("generatorMinValueBytes", 1);
+            generator_options.max_value_size = config.get<size_t>("generatorMaxValueBytes", 4096);
+            generator_options.read_fraction = config.get<double>("generatorReadFraction", 0);
+            generator.reset(new WorkloadGenerator(generator_options));
+        }
+        catch (const std::invalid_argument &e) {
+            std::cerr << e.what() << std::endl;
+            return EX_CONFIG;
+        }
+    }
+
+    // The workload is loaded, and with prebuildRequests its requests are built, before the timed phase. A
+    // workload given on the command line takes precedence over workloadFile.
+    const std::string workload_path = (argc > 1) ? argv[1]
+                                                 : config.get<std::string>("workloadFile", "/users/Ramya/workloads/client_1.txt");
+    std::unique_ptr<WorkloadFile> workload;
+    if (!generator) {
+        try {
+            workload.reset(new WorkloadFile(workload_path));
+        }
+        catch (const std::system_error &e) {
+            std::cerr << "Failed to load the workload " << workload_path << ": " << e.what() << std::endl;
+            return EX_NOINPUT;
+        }
+    }
+
+    // With batchMaxEntries or batchMaxBytes, the writes are coalesced into batches, and the time recorded is
+    // that of every batch rather than of every write. Prebuilt requests hold batchMaxEntries writes each.
+    PutBatcher::Limits batch_limits;
+    batch_limits.max_entries = config.get<size_t>("batchMaxEntries", 0);
+    batch_limits.max_bytes = config.get<size_t>("batchMaxBytes", 0);
+    batch_limits.linger = std::chrono::microseconds(config.get<long>("batchLingerUs", 1000));
+
+    const bool prebuild = !generator && config.get<bool>("prebuildRequests", false);
+    std::vector<OffsetData> prebuilt_requests;
+    if (prebuild) {
+        prebuilt_requests = workload->BuildRequests(batch_limits.max_entries);
+    }
+    const bool batching = !prebuild && ((batch_limits.max_entries > 1) || (batch_limits.max_bytes > 0));
+
+    // Every request is recorded once it completes, possibly on the thread that completed it
+    ReplayStats stats(std::chrono::milliseconds(config.get<long>("timelineIntervalMs", 1000)),
+                      config.get<size_t>("timelineMaxIntervals", 3600));
+
+    // With bulkPut, the writes are streamed over a single call instead of waiting for each one in turn,
+    // and the time recorded for each is the time until it was acknowledged.
+    std::unique_ptr<BulkPutStream> bulk_stream;
+    if (config.get<bool>("bulkPut", false)) {
+        bulk_stream = client.BulkPut(config.get<size_t>("bulkPutWindow", 64));
+    }
+
+    // With asyncPut, unary calls are issued without waiting for them, up to putWindow at a time, and polled
+    // by putThreads threads. bulkPut takes precedence over it.
+    std::unique_ptr<AsyncPutClient> async_put;
+    if (!bulk_stream && config.get<bool>("asyncPut", false)) {
+        async_put = client.AsyncPut(config.get<size_t>("putWindow", 32), config.get<size_t>("putThreads", 1));
+    }
+
+    std::unique_ptr<PutBatcher> batcher;
+    if (batching) {
+        batcher = client.Batcher(batch_limits, [&](const PutBatcher::BatchResult &result) {
+            stats.Record(result.latency, result.entries, result.bytes, result.ok);
+        }, bulk_stream.get(), async_put.get());
+    }
+
+    // Send one request by whichever means was configured. Returns false if no more can be sent.
+    auto send = [&](OffsetData &&request) {
+        const std::uint64_t entries = request.offsets_size();
+        std::uint64_t bytes = 0;
+        for (const std::string &value : request.values()) {
+            bytes += value.size();
+        }
+
+        if (async_put) {
+            async_put->Put(std::move(request), [&stats, entries, bytes](bool ok, std::chrono::nanoseconds latency) {
+                stats.Record(latency, entries, bytes, ok);
+            });
+            return true;
+        }
+        if (bulk_stream) {
+            const auto sent_at = std::chrono::steady_clock::now();
+            return bulk_stream->Write(request, [&stats, entries, bytes, sent_at](bool ok) {
+                stats.Record(std::chrono::steady_clock::now() - sent_at, entries, bytes, ok);
+            });
+        }
+
+        const auto start_time = std::chrono::steady_clock::now();
+        const bool ok = client.Put(request);
+        stats.Record(std::chrono::steady_clock::now() - start_time, entries, bytes, ok);
+        return true;
+    };
+
+    // Run the generator's operations, spread over the threads. With a target rate, every operation is due
+    // at a fixed time, and its latency counts from then rather than from when it was sent, so that a stall
+    // shows in the latency of the operations it delayed.
+    std::uint64_t generated_operations = 0;
+    auto run_generator = [&](size_t thread_index, size_t num_threads, std::uint64_t operations, double rate) {
+        FastRandom &random = FastRandom::ForThisThread();
+        const auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>((rate > 0) ? num_threads / rate : 0.0));
+        std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now() + thread_index * interval / num_threads;
+        for (std::uint64_t i = thread_index; i < operations; i += num_threads) {
+            if (rate > 0) {
+                std::this_thread::sleep_until(due);
+            }
+            const std::chrono::steady_clock::time_point start_time = (rate > 0) ? due : std::chrono::steady_clock::now();
+            due += interval;
+
+            const GeneratedOperation operation = generator->Next(random);
+            if (operation.is_read) {
+                OffsetData values;
+                const bool ok = client.Get({ operation.offset }, { static_cast<std::uint32_t>(operation.length) }, &values);
+                stats.Record(std::chrono::steady_clock::now() - start_time, 1, operation.length, ok);
+                continue;
+            }
+            if (batcher) {
+                batcher->Add(operation.offset, std::string(operation.value));
+                continue;
+            }
+            if (!async_put && !bulk_stream) {
+                const bool ok = client.Put(operation.offset, operation.value);
+                stats.Record(std::chrono::steady_clock::now() - start_time, 1, operation.value.size(), ok);
+                continue;
+            }
+
+            OffsetData request;
+            request.add_offsets(operation.offset);
+            request.add_values(operation.value.data(), operation.value.size());
+            if (!send(std::move(request))) {
+                break;
+            }
+        }
+    };
+
+    if (generator) {
+        // A BulkPut stream takes its writes from one thread
+        const size_t num_threads = bulk_stream ? 1 : std::max<size_t>(config.get<size_t>("generatorThreads", 1), 1);
+        generated_operations = config.get<std::uint64_t>("generatorOperations", 100000);
+        const double rate = config.get<double>("generatorRate", 0);
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < num_threads; ++i) {
+            threads.emplace_back(run_generator, i, num_threads, generated_operations, rate);
+        }
+        for (std::thread &thread : threads) {
+            thread.join();
+        }
+    }
+    else if (prebuild) {
+        for (OffsetData &request : prebuilt_requests) {
+            if (!send(std::move(request))) {
+                break;
+            }
+        }
+    }
+    else {
+        for (const WorkloadWrite &write : workload->Writes()) {
+            if (batcher) {
+                batcher->Add(write.offset, std::string(write.value));
+                continue;
+            }
+
+            if (!async_put && !bulk_stream) {
+                const auto start_time = std::chrono::steady_clock::now();
+                const bool ok = client.Put(write.offset, write.value);
+                stats.Record(std::chrono::steady_clock::now() - start_time, 1, write.value.size(), ok);
+                continue;
+            }
+
+            OffsetData request;
+            request.add_offsets(write.offset);
+            request.add_values(write.value.data(), write.value.size());
+            if (!send(std::move(request))) {
+                break;
+            }
+        }
+    }
+
+    batcher.reset();
+    async_put.reset();
+    if (bulk_stream) {
+        bulk_stream->Finish();
+    }
+    stats.Stop();
+
+    // After processing all commands from the file, print the summary and save the detailed results
+    if (generator) {
+        std::cout << "Operations generated: " << generated_operations << std::endl;
+    }
+    else {
+        std::cout << "Commands replayed: " << workload->Writes().size() << ", invalid: " << workload->InvalidCommands() << std::endl;
+    }
+    stats.PrintSummary(std::cout);
+    if (CompressionPolicy::Mode::Off != compression->GetMode()) {
+        compression->Report(std::cout);
+    }
+    retry_policy.Report(std::cout);
+    const std::string results_prefix = config.get<std::string>("resultsPrefix", "replay");
+    try {
+        stats.WriteJson(results_prefix + "_summary.json");
+        stats.WriteTimelineCsv(results_prefix + "_timeline.csv");
+    }
+    catch (const std::exception &e) {
+        std::cerr << "Failed to save the results: " << e.what() << std::endl;
+        return EX_CANTCREAT;
+    }
+
+    return EXIT_SUCCESS;
+}
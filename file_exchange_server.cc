@@ -1,244 +1,533 @@
 #include <iostream>
 #include <memory>
 #include <string>
-#include <vector>
-#include <string>
 #include <cstdlib>
 #include <cstdint>
-#include <utility>
-#include <cassert>
-#include <sysexits.h>
 #include <chrono>
-#include <random>
-#include <limits>
+#include <system_error>
+#include <stdexcept>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <sysexits.h>
 
 #include <grpc/grpc.h>
-#include <grpc++/channel.h>
-#include <grpc++/client_context.h>
-#include <grpc++/create_channel.h>
-#include <grpc++/security/credentials.h>
-#include <grpc++/grpc++.h>
-#include <grpcpp/grpcpp.h>
-#include <thread>
-#include <chrono>
+#include <grpc++/server.h>
+#include <grpc++/server_builder.h>
+#include <grpc++/server_context.h>
+#include <grpc++/resource_quota.h>
+#include <grpc++/security/server_credentials.h>
 
-#include <csignal>
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
-#include <boost/algorithm/string.hpp>
+
+#include "journal.h"
+#include "checkpoint.h"
+#include "data_store.h"
+#include "read_cache.h"
+#include "offset_index.h"
+#include "put_pipeline.h"
+#include "admission_control.h"
+#include "replicator.h"
+#include "offset_reader.h"
+#include "async_server.h"
+#include "file_transfer_service.h"
 #include "file_exchange.grpc.pb.h"
 
-using grpc::Channel;
-using grpc::ClientContext;
+using grpc::Server;
+using grpc::ServerBuilder;
+using grpc::ServerContext;
+using grpc::ServerReaderWriter;
 using grpc::Status;
+using grpc::StatusCode;
 
+using fileexchange::BulkPutAck;
+using fileexchange::FileExchange;
 using fileexchange::OffsetData;
+using fileexchange::Offsets;
+using fileexchange::Replication;
+using fileexchange::ReplicationAck;
+using fileexchange::ReplicationBatch;
 using fileexchange::success_failure;
 
-class FileExchangeClient
-{
+
+class FileExchangeImpl final : public FileTransferService {
 public:
-    FileExchangeClient(std::shared_ptr<Channel> channel)
-        : m_stub(fileexchange::FileExchange::NewStub(channel))
+    FileExchangeImpl(PutPipeline& pipeline, OffsetReader& reader)
+        : m_pipeline(pipeline)
+        , m_reader(reader)
     {
     }
 
-    bool Put(const std::vector<unsigned long long> &offsets, const std::vector<std::string> &values)
+    Status Put(ServerContext* context, const OffsetData* request, success_failure* response) override
     {
-        OffsetData request;
-
-        for (int offset : offsets)
-        {
-            request.add_offsets(offset);
+        const Status status = m_pipeline.Process(*request, response);
+        if (StatusCode::RESOURCE_EXHAUSTED == status.error_code()) {
+            m_pipeline.AddRetryPushback(context);
         }
+        return status;
+    }
 
-        for (std::string value : values)
-        {
-            request.add_values(value);
-        }
-
-        success_failure response;
-        grpc::ClientContext context;
-
-        grpc::Status status;
-        int max_retry_attempts = 3;
-        int retry_count = 0;
+    // The handler thread reads and submits batches, while a second thread writes the acknowledgements,
+    // so that a client waiting for acknowledgements before it sends more never deadlocks with us.
+    Status BulkPut(ServerContext* context, ServerReaderWriter<BulkPutAck, OffsetData>* stream) override
+    {
+        struct Batch {
+            OffsetData request;
+            success_failure response;
+        };
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::uint64_t submitted = 0;
+        std::uint64_t committed = 0;
+        bool reads_done = false;
+        Status status;
+
+        std::thread acker([&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            std::uint64_t acked = 0;
+            while (true) {
+                cv.wait(lock, [&] { return ! status.ok() || (committed > acked) || (reads_done && (acked == submitted)); });
+                if (! status.ok() || (committed == acked)) {
+                    break;
+                }
+
+                BulkPutAck ack;
+                acked = committed;
+                ack.set_committed(acked);
+                ack.set_queued_bytes(m_pipeline.QueuedBytes());
+                ack.set_queue_limit_bytes(m_pipeline.QueueLimitBytes());
+                lock.unlock();
+                const bool written = stream->Write(ack);
+                lock.lock();
+                if (! written && status.ok()) {
+                    status = Status(StatusCode::CANCELLED, "The client went away.");
+                }
+            }
 
-        while (retry_count < max_retry_attempts)
-        {
-            status = m_stub->Put(&context, request, &response);
-            int backoff_duration_ms = 10;
-            if (status.ok())
-            {
-                break;
+            // Unblock the reader if the client is still sending after a batch failed
+            if (! status.ok()) {
+                context->TryCancel();
             }
-            else
+        });
+
+        auto batch = std::make_shared<Batch>();
+        while (stream->Read(&batch->request)) {
             {
-                retry_count++;
-                std::this_thread::sleep_for(std::chrono::milliseconds(backoff_duration_ms));
+                std::lock_guard<std::mutex> lock(mutex);
+                if (! status.ok()) {
+                    break;
+                }
+                ++submitted;
             }
-        }
 
-        if (status.ok())
-        {
-            // std::cout << "Data inserted successfully at offset " << response.id() << std::endl;
-            // std::cout << response.id() << std::endl;
-            return true;
+            m_pipeline.Submit(batch->request, &batch->response, [&, batch](const Status& batch_status) {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++committed;
+                if (! batch_status.ok() && status.ok()) {
+                    status = batch_status;
+                }
+                cv.notify_all();
+            });
+            batch = std::make_shared<Batch>();
         }
-        else
-        {
-            std::cerr << "RPC failed: " << status.error_message() << std::endl;
-            return false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        reads_done = true;
+        cv.notify_all();
+        lock.unlock();
+        acker.join();
+
+        // The completions refer to our locals, so wait for all of them even if the call failed
+        lock.lock();
+        cv.wait(lock, [&] { return committed == submitted; });
+        if (StatusCode::RESOURCE_EXHAUSTED == status.error_code()) {
+            m_pipeline.AddRetryPushback(context);
         }
+        return status;
     }
 
-    unsigned long long generateRandomNumber(unsigned long long max)
+    Status Get(ServerContext* context, const Offsets* request, OffsetData* response) override
     {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<unsigned long long> distribution(0, max);
-        return distribution(gen);
+        const Status status = m_reader.Get(*request, response);
+        if (GetCompression()) {
+            context->set_compression_algorithm(GetCompression()->AlgorithmFor(*response));
+        }
+        return status;
     }
 
 private:
-    std::unique_ptr<fileexchange::FileExchange::Stub> m_stub;
+    PutPipeline& m_pipeline;
+    OffsetReader& m_reader;
 };
 
-void usage [[noreturn]] (const char *prog_name)
-{
-    std::cerr << "USAGE: " << prog_name << " [put|get] num_id [filename]" << std::endl;
-    std::exit(EX_USAGE);
-}
 
-int main(int argc, char **argv)
-{
-    boost::property_tree::ptree config;
-    try
+// The follower's end of replication: the records the primary ships are applied and journaled as its
+// own Puts would be, and acknowledged by sequence number as they become durable. As in BulkPut, a second
+// thread writes the acknowledgements, so that the primary can keep sending batches meanwhile. A server
+// without a journal refuses to follow, since it would acknowledge records it can lose.
+class ReplicationImpl final : public Replication::Service {
+public:
+    ReplicationImpl(PutPipeline& pipeline, bool has_journal)
+        : m_pipeline(pipeline)
+        , m_has_journal(has_journal)
     {
-        boost::property_tree::read_json("client_config.json", config);
     }
-    catch (const std::exception &e)
+
+    Status Replicate(ServerContext* context, ServerReaderWriter<ReplicationAck, ReplicationBatch>* stream) override
     {
+        if (! m_has_journal) {
+            return Status(StatusCode::FAILED_PRECONDITION, "This server has no journal to replicate to.");
+        }
+
+        struct Batch {
+            ReplicationBatch request;
+            std::vector<success_failure> responses;
+        };
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::uint64_t submitted = 0;
+        std::uint64_t completed = 0;
+        std::uint64_t durable = 0;
+        bool reads_done = false;
+        Status status;
+
+        std::thread acker([&] {
+            std::unique_lock<std::mutex> lock(mutex);
+            std::uint64_t acked = 0;
+            while (true) {
+                cv.wait(lock, [&] { return ! status.ok() || (durable > acked) || (reads_done && (completed == submitted)); });
+                if (! status.ok() || (durable == acked)) {
+                    break;
+                }
+
+                ReplicationAck ack;
+                acked = durable;
+                ack.set_durable(acked);
+                lock.unlock();
+                const bool written = stream->Write(ack);
+                lock.lock();
+                if (! written && status.ok()) {
+                    status = Status(StatusCode::CANCELLED, "The primary went away.");
+                }
+            }
+
+            if (! status.ok()) {
+                context->TryCancel();
+            }
+        });
+
+        // The records must arrive without a gap, or this replica would miss some
+        std::uint64_t next_sequence = 0;
+        auto batch = std::make_shared<Batch>();
+        while (stream->Read(&batch->request)) {
+            const ReplicationBatch& request = batch->request;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if ((0 != next_sequence) && (request.first_sequence() != next_sequence)) {
+                    status = Status(StatusCode::FAILED_PRECONDITION, "The replicated records skip some.");
+                    cv.notify_all();
+                }
+                if (! status.ok()) {
+                    break;
+                }
+                submitted += request.records_size();
+            }
+            next_sequence = request.first_sequence() + request.records_size();
+
+            // Records complete in the order they were submitted, so each one makes all before it durable
+            batch->responses.resize(request.records_size());
+            for (int i = 0; i < request.records_size(); ++i) {
+                const std::uint64_t sequence = request.first_sequence() + i;
+                m_pipeline.SubmitReplicated(request.records(i), &batch->responses[i], [&, batch, sequence](const Status& record_status) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++completed;
+                    if (! record_status.ok() && status.ok()) {
+                        status = record_status;
+                    }
+                    if (status.ok()) {
+                        durable = sequence;
+                    }
+                    cv.notify_all();
+                });
+            }
+            batch = std::make_shared<Batch>();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        reads_done = true;
+        cv.notify_all();
+        lock.unlock();
+        acker.join();
+
+        // The completions refer to our locals, so wait for all of them even if the call failed
+        lock.lock();
+        cv.wait(lock, [&] { return completed == submitted; });
+        return status;
+    }
+
+private:
+    PutPipeline& m_pipeline;
+    const bool m_has_journal;
+};
+
+
+int main(int argc, char** argv)
+{
+    boost::property_tree::ptree config;
+    try {
+        boost::property_tree::read_json("server_config.json", config);
+    } catch (const std::exception& e) {
         std::cerr << "Error reading config file: " << e.what() << std::endl;
         return EXIT_FAILURE;
     }
 
-    std::string serverAddress = config.get<std::string>("server_address");
-    long long total_execution_time = 0;
-    long long max_put_time = 0;
-    long long count = 0;
-    FileExchangeClient client(grpc::CreateChannel(serverAddress, grpc::InsecureChannelCredentials()));
+    const std::string server_address = config.get<std::string>("server_address");
 
-    std::ifstream inputFile("/users/Ramya/workloads/client_1.txt");
+    // storageEngine selects how writes are applied in place to the data file, if at all
+    std::unique_ptr<DataStore> store;
+    const std::string storage_engine = config.get<std::string>("storageEngine", "none");
+    if ("none" != storage_engine) {
+        const std::string data_path = config.get<std::string>("dataFile", "data.bin");
+        try {
+            store = DataStore::Create(storage_engine, data_path, config.get<std::uint64_t>("dataFileSize", 1ULL << 30));
+        }
+        catch (const std::invalid_argument& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EX_CONFIG;
+        }
+        catch (const std::system_error& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EX_CANTCREAT;
+        }
+    }
 
+    // readCacheBytes bounds the memory used to serve Get from the recently written or read values
+    std::unique_ptr<ReadCache> cache;
+    const size_t cache_bytes = config.get<size_t>("readCacheBytes", 0);
+    if (cache_bytes > 0) {
+        cache.reset(new ReadCache(cache_bytes, config.get<size_t>("readCacheShards", 64)));
+    }
 
-    if (!inputFile.is_open()) {
-        std::cerr << "Failed to open the input file." << std::endl;
-        return 1;
+    // The index keeps the length of every value in the data file, so that Get can read any of them
+    std::unique_ptr<OffsetIndex> index;
+    if (store) {
+        index.reset(new OffsetIndex(config.get<size_t>("indexExpectedOffsets", 0), config.get<size_t>("indexSegments", 1024)));
     }
 
-    std::string inputLine;
+    // With both a journal and a data file, the data file and the index are restored from the latest
+    // checkpoint and the journal written since, by recoveryThreads threads (0 means one per core), before
+    // the journal is opened for new records
+    const bool journal_enabled = config.get<bool>("enableJournal", false);
+    const std::string journal_path = config.get<std::string>("journalPath", "journal.log");
+    std::uint64_t journal_segment = 1;
+    if (journal_enabled && store) {
+        try {
+            const Checkpointer::Recovery recovery = Checkpointer::Recover(journal_path, *store, *index,
+                                                                          config.get<size_t>("recoveryThreads", 0));
+            journal_segment = recovery.segment;
+            std::cout << "Recovered " << recovery.checkpoint_offsets << " offsets from the checkpoint and "
+                      << recovery.records << " records (" << recovery.journal_bytes << " bytes) from "
+                      << recovery.segments << " journal segments in " << recovery.seconds << " s" << std::endl;
+            if (recovery.truncated_bytes > 0) {
+                std::cerr << "Dropped " << recovery.truncated_bytes << " bytes from the end of the journal, "
+                          << "from the first incomplete or corrupt record on" << std::endl;
+            }
+        }
+        catch (const std::system_error& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EX_IOERR;
+        }
+        catch (const std::runtime_error& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EX_DATAERR;
+        }
+    }
 
-    while (std::getline(inputFile, inputLine)) {
-        // std::cout << inputLine << std::endl;
+    std::unique_ptr<Journal> journal;
+    if (journal_enabled) {
+        const size_t group_commit = config.get<size_t>("groupCommit", 1);
+        const std::chrono::microseconds commit_window(config.get<long>("groupCommitWindowUs", 0));
+        try {
+            journal.reset(new Journal(journal_path, group_commit, commit_window, journal_segment));
+        }
+        catch (const std::system_error& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EX_CANTCREAT;
+        }
+    }
 
-        // Split the input line by semicolons to separate commands
-        std::istringstream iss(inputLine);
-        std::string command;
+    // fileSyncPolicy selects when uploaded files are flushed to the disk: "none", "end" or "periodic"
+    PositionalFileWriter::SyncPolicy sync_policy;
+    try {
+        sync_policy = PositionalFileWriter::ParseSyncPolicy(config.get<std::string>("fileSyncPolicy", "none"));
+    }
+    catch (const std::invalid_argument& ex) {
+        std::cerr << ex.what() << std::endl;
+        return EX_CONFIG;
+    }
 
-        while (std::getline(iss, command, ';')) {
-            // Trim leading and trailing whitespace
-            command = boost::algorithm::trim_copy(command);
+    // fileChunkBytes is the size of the chunks files are sent in
+    const size_t file_chunk_bytes = config.get<size_t>("fileChunkBytes", 1 << 20);
+    if (0 == file_chunk_bytes) {
+        std::cerr << "fileChunkBytes must be positive." << std::endl;
+        return EX_CONFIG;
+    }
 
-            // Extract operation, offset, and value
-            std::string operation;
-            std:: string offset, value;
+    // compression is "off", "on" or "adaptive", for the file chunks and the values the server sends. In
+    // adaptive mode, compression is turned off while it saves less than compressionMinSaving of the bytes,
+    // or, if compressionLinkMbps is given, while it takes longer than sending the bytes it saves.
+    std::unique_ptr<CompressionPolicy> compression;
+    try {
+        compression.reset(new CompressionPolicy(CompressionPolicy::ParseMode(config.get<std::string>("compression", "off")),
+                                                CompressionPolicy::ParseAlgorithm(config.get<std::string>("compressionAlgorithm", "gzip")),
+                                                config.get<double>("compressionMinSaving", 0.1),
+                                                config.get<double>("compressionLinkMbps", 0) * 1e6 / 8));
+    }
+    catch (const std::invalid_argument& ex) {
+        std::cerr << ex.what() << std::endl;
+        return EX_CONFIG;
+    }
 
-            if (std::istringstream(command) >> offset >> value) {
-                // if (operation == "W") {
-                    count++;
-                    std::vector<unsigned long long> offsets = {std::stoull(offset)};
-                    std::vector<std::string> values  = {value};
-                    auto start_time = std::chrono::high_resolution_clock::now();
+    // A checkpoint is taken whenever checkpointJournalBytes have been logged since the last one, so that
+    // a restart only has to replay that much of the journal. 0 disables checkpoints.
+    Journal* const journal_ptr = journal.get();
+    DataStore* const store_ptr = store.get();
+    OffsetReader reader(store.get(), cache.get(), index.get());
+
+    // With a journal, the durable Puts are written to the data file, the index and the cache by
+    // publishThreads threads, each taking its own stripes of the data file (0 means one per core)
+    PutPipeline pipeline(std::move(journal), std::move(store), cache.get(), index.get(),
+                         config.get<size_t>("publishThreads", 0));
+
+    // maxInflightBytes bounds the Put data held from admission to acknowledgement. Requests that don't fit
+    // are refused with RESOURCE_EXHAUSTED and a hint of when to retry. 0 means no limit.
+    std::unique_ptr<AdmissionControl> admission;
+    const std::uint64_t max_inflight_bytes = config.get<std::uint64_t>("maxInflightBytes", 0);
+    if (max_inflight_bytes > 0) {
+        admission.reset(new AdmissionControl(max_inflight_bytes));
+        pipeline.SetAdmissionControl(admission.get());
+    }
+    std::unique_ptr<Checkpointer> checkpointer;
+    const std::uint64_t checkpoint_bytes = config.get<std::uint64_t>("checkpointJournalBytes", 256ULL << 20);
+    if (journal_ptr && store_ptr && (checkpoint_bytes > 0)) {
+        checkpointer.reset(new Checkpointer(pipeline, *journal_ptr, *store_ptr, *index, checkpoint_bytes));
+    }
 
-                    client.Put(offsets, values);
-                    //  std::cout << "Done" << count << std::endl;
-                    auto end_time = std::chrono::high_resolution_clock::now();
-                    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
+    // With followers listed, every journal record is shipped to them too, and a Put is acknowledged once
+    // a quorum of the replicas, this server included, has it durable: all of them with journalOnAll, or
+    // else replicationQuorum of them (0 means a majority). Batches of up to replicationBatchBytes are
+    // sent without waiting for the ones before to be acknowledged. A follower that can't be connected to
+    // within replicationConnectTimeoutMs is dropped. Any server with a journal accepts records as a
+    // follower.
+    std::vector<std::string> followers;
+    const boost::property_tree::ptree no_followers;
+    for (const auto& follower : config.get_child("followers", no_followers)) {
+        followers.push_back(follower.second.get_value<std::string>());
+    }
+    std::unique_ptr<Replicator> replicator;
+    if (! followers.empty()) {
+        if (! journal_ptr) {
+            std::cerr << "Replicating to followers requires enableJournal." << std::endl;
+            return EX_CONFIG;
+        }
+        const size_t replicas = followers.size() + 1;
+        size_t quorum = config.get<size_t>("replicationQuorum", 0);
+        if (config.get<bool>("journalOnAll", false)) {
+            quorum = replicas;
+        }
+        else if (0 == quorum) {
+            quorum = replicas / 2 + 1;
+        }
+        try {
+            replicator.reset(new Replicator(*journal_ptr, followers, quorum,
+                                            config.get<size_t>("replicationBatchBytes", 1 << 20),
+                                            std::chrono::milliseconds(config.get<unsigned>("replicationConnectTimeoutMs", 10000))));
+        }
+        catch (const std::invalid_argument& ex) {
+            std::cerr << ex.what() << std::endl;
+            return EX_CONFIG;
+        }
+        pipeline.SetReplicator(replicator.get());
+        std::cout << "Replicating to " << followers.size() << " followers, with a quorum of " << quorum << std::endl;
+    }
+    ReplicationImpl replication(pipeline, nullptr != journal_ptr);
+
+    // In asynchronous mode the polling threads are the only ones serving requests, instead of one
+    // thread per blocked call.
+    const bool async_mode = config.get<bool>("asyncServer", false);
+    FileExchangeImpl service(pipeline, reader);
+    AsyncFileExchangeServer async_server(pipeline, reader, config.get<size_t>("serverThreads", 0),
+                                         config.get<bool>("pinThreads", false));
+    service.SetSyncPolicy(sync_policy);
+    async_server.FileTransfer().SetSyncPolicy(sync_policy);
+    service.SetChunkSize(file_chunk_bytes);
+    async_server.FileTransfer().SetChunkSize(file_chunk_bytes);
+    if (CompressionPolicy::Mode::Off != compression->GetMode()) {
+        service.SetCompression(compression.get());
+        async_server.FileTransfer().SetCompression(compression.get());
+    }
 
-                    total_execution_time += duration.count();
-                    // std::cout << "Execution time for Put: " << duration.count() << " microseconds" << std::endl;
+    // resourceQuotaBytes bounds the memory gRPC itself uses for the calls, e.g. for messages still being
+    // received, before the pipeline ever sees them. 0 leaves it unbounded.
+    ServerBuilder builder;
+    const size_t resource_quota_bytes = config.get<size_t>("resourceQuotaBytes", 0);
+    grpc::ResourceQuota resource_quota("file_exchange_server");
+    if (resource_quota_bytes > 0) {
+        resource_quota.Resize(resource_quota_bytes);
+        builder.SetResourceQuota(resource_quota);
+    }
+    builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
 
-                    if (duration.count() > max_put_time) {
-                        max_put_time = duration.count();
-                    }
-                // } 
-                // else {
-                //     std::cerr << "Invalid operation: " << operation << std::endl;
-                // }
-            } else {
-                std::cerr << "Invalid command format: " << command << std::endl;
+    // Clients on the same host may connect over the Unix domain socket unixSocketPath as well, and skip
+    // the TCP stack. server_address may itself be a unix: address instead.
+    const std::string unix_socket_path = config.get<std::string>("unixSocketPath", "");
+    if (! unix_socket_path.empty()) {
+        builder.AddListeningPort("unix:" + unix_socket_path, grpc::InsecureServerCredentials());
+    }
+    if (async_mode) {
+        async_server.Register(builder);
+    }
+    else {
+        builder.RegisterService(&service);
+    }
+    builder.RegisterService(&replication);
+    std::unique_ptr<Server> server(builder.BuildAndStart());
+    if (! server) {
+        std::cerr << "Failed to listen on " << server_address
+                  << (unix_socket_path.empty() ? "" : " and unix:" + unix_socket_path) << std::endl;
+        return EX_UNAVAILABLE;
+    }
+    if (async_mode) {
+        async_server.Start();
+    }
+    std::cout << "Server listening on " << server_address
+              << (unix_socket_path.empty() ? "" : " and unix:" + unix_socket_path) << std::endl;
+
+    // Report what compression saved every compressionReportIntervalS seconds
+    const std::chrono::seconds report_interval(config.get<long>("compressionReportIntervalS", 60));
+    if ((CompressionPolicy::Mode::Off != compression->GetMode()) && (report_interval.count() > 0)) {
+        std::thread([&compression, report_interval] {
+            for (;;) {
+                std::this_thread::sleep_for(report_interval);
+                compression->Report(std::cout);
             }
-        }
+        }).detach();
+    }
+    // Report what admission control admitted and refused every admissionReportIntervalS seconds
+    const std::chrono::seconds admission_report_interval(config.get<long>("admissionReportIntervalS", 60));
+    if (admission && (admission_report_interval.count() > 0)) {
+        std::thread([&admission, admission_report_interval] {
+            for (;;) {
+                std::this_thread::sleep_for(admission_report_interval);
+                admission->Report(std::cout);
+            }
+        }).detach();
     }
+    server->Wait();
 
-    inputFile.close();
-
-    // After processing all commands from the file, print the total execution time and max_put_time.
-    std::cout << "Total execution time for all operations: " << total_execution_time << " microseconds" << std::endl;
-    std::cout << "Maximum execution time for Put: " << max_put_time << " microseconds" << std::endl;
-    std::cout << "Total Operations: " << count << std::endl;
-
-    // while (true)
-    // {
-    //     std::string inputLine;
-    //     std::getline(std::cin, inputLine);
-    //     std::cout << inputLine << std::endl;
-    //     // bool succeeded;
-    //     // Split the input line by semicolons to separate commands
-    //     std::istringstream iss(inputLine);
-    //     std::string command;
-
-    //     while (std::getline(iss, command, ';'))
-    //     {
-    //         // Trim leading and trailing whitespace
-    //         command = boost::algorithm::trim_copy(command);
-
-    //         // Extract operation, offset, and value
-    //         std::string operation;
-    //         int offset, value;
-
-    //         if (std::istringstream(command) >> operation >> offset >> value)
-    //         {
-    //             if (operation == "W")
-    //             {
-    //                 // Prepare and send the offset and value to the server
-    //                 std::vector<int> offsets = {offset};
-    //                 std::vector<int> values = {value};
-    //                 auto start_time = std::chrono::high_resolution_clock::now();
-    //                 client.Put(offsets, values);
-    //                 auto end_time = std::chrono::high_resolution_clock::now();
-    //                 auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end_time - start_time);
-
-    //                 total_execution_time += duration.count();
-    //                 std::cout << "Execution time for Put: " << duration.count() << " microseconds" << std::endl;
-
-    //                 if (duration.count() > max_put_time)
-    //                 {
-    //                     max_put_time = duration.count();
-    //                 }
-    //             }
-    //             else
-    //             {
-    //                 std::cerr << "Invalid operation: " << operation << std::endl;
-    //             }
-    //         }
-    //         else
-    //         {
-    //             std::cerr << "Invalid command format: " << command << std::endl;
-    //         }
-    //     }
-    // }
-
-    return EXIT_SUCCESS;
+    return EX_OK;
 }
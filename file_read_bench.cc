@@ -0,0 +1,145 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "sequential_file_reader.h"
+#include "pread_file_reader.h"
+#include "utils.h"
+
+// Compares reading a file through SequentialFileReader, with and without read-ahead and releasing behind,
+// against PreadFileReader. Each reader checksums every chunk, standing in for the work of sending it.
+// Every reader runs once on a cold file, evicted from the page cache beforehand, and once on a warm one.
+//
+// Usage: file_read_bench [size_in_MB [path]]
+
+namespace {
+
+    const size_t chunk_size = 1UL << 20;
+
+    // Defeat the optimiser
+    volatile std::uint64_t sink;
+
+    std::uint64_t checksum(const void* data, size_t size)
+    {
+        const std::uint8_t* p = static_cast<const std::uint8_t*>(data);
+        std::uint64_t sum = 0;
+        for (size_t i = 0; i + sizeof(std::uint64_t) <= size; i += sizeof(std::uint64_t)) {
+            std::uint64_t word;
+            memcpy(&word, p + i, sizeof(word));
+            sum += word;
+        }
+        return sum;
+    }
+
+    class MappedChecksum : public SequentialFileReader {
+    public:
+        MappedChecksum(const std::string& path, size_t read_ahead, bool release_behind)
+            : SequentialFileReader(path)
+        {
+            SetReadAhead(read_ahead, release_behind);
+        }
+
+    protected:
+        void OnChunkAvailable(const void* data, size_t size) override
+        {
+            sink += checksum(data, size);
+        }
+    };
+
+    class PreadChecksum : public PreadFileReader {
+    public:
+        explicit PreadChecksum(const std::string& path)
+            : PreadFileReader(path)
+        {
+        }
+
+    protected:
+        void OnChunkAvailable(const void* data, size_t size) override
+        {
+            sink += checksum(data, size);
+        }
+    };
+
+    void create_file(const std::string& path, size_t size)
+    {
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (-1 == fd) {
+            raise_from_errno("Failed to create " + path + '.');
+        }
+        std::vector<char> block(chunk_size);
+        for (size_t i = 0; i < block.size(); ++i) {
+            block[i] = static_cast<char>(i * 31 + 7);
+        }
+        for (size_t written = 0; written < size; written += block.size()) {
+            if (-1 == write(fd, block.data(), block.size())) {
+                const int err = errno;
+                close(fd);
+                raise_from_system_error_code("Failed to write " + path + '.', err);
+            }
+        }
+        fdatasync(fd);
+        close(fd);
+    }
+
+    // Drop the file's clean pages from the page cache
+    void evict(const std::string& path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (-1 != fd) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+
+    template <class Reader>
+    void measure(const char* name, const std::string& path, size_t size, bool cold, Reader make_reader)
+    {
+        if (cold) {
+            evict(path);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        auto reader = make_reader();
+        reader.Read(chunk_size);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << std::setw(10) << name
+                  << std::setw(7) << (cold ? "cold" : "warm")
+                  << std::setw(12) << static_cast<double>(size) / (1 << 20) / seconds << std::endl;
+    }
+};  // Anonymous namespace
+
+int main(int argc, char** argv)
+{
+    const size_t size = ((argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 256) << 20;
+    const std::string path = (argc > 2) ? argv[2] : "file_read_bench.dat";
+
+    try {
+        create_file(path, size);
+
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << "    reader  cache        MB/s" << std::endl;
+        for (bool cold : { true, false }) {
+            measure("mmap", path, size, cold, [&] { return MappedChecksum(path, 0, false); });
+            measure("mmap+ra", path, size, cold, [&] { return MappedChecksum(path, SequentialFileReader::default_read_ahead, false); });
+            measure("mmap+rel", path, size, cold, [&] { return MappedChecksum(path, SequentialFileReader::default_read_ahead, true); });
+            measure("pread", path, size, cold, [&] { return PreadChecksum(path); });
+        }
+    }
+    catch (const std::system_error& ex) {
+        std::cerr << ex.what() << std::endl;
+        unlink(path.c_str());
+        return 1;
+    }
+
+    unlink(path.c_str());
+    return 0;
+}
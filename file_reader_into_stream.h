@@ -2,36 +2,122 @@
 
 #include <cstdint>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include "sys/errno.h"
 
+#include <grpc++/support/byte_buffer.h>
+
 #include "sequential_file_reader.h"
+#include "pread_file_reader.h"
 #include "messages.h"
+#include "compression_policy.h"
+#include "crc32c.h"
 #include "utils.h"
 
-template <class StreamWriter>
-class FileReaderIntoStream : public SequentialFileReader {
+// FileReaderIntoStream: Sends a file, or a range of it, as a stream of FileContent messages, one per
+// chunk. The first one carries the name of the file, its size, the offset of the range and the upload id.
+// Every chunk carries the CRC-32C of its content.
+//
+// The file is read by Reader, either SequentialFileReader or PreadFileReader. If StreamWriter writes
+// grpc::ByteBuffers and the file is mapped, the chunks are sent as slices that refer to the mapping, so that
+// the content is never copied in user space. Otherwise each chunk is copied once, into the ByteBuffer or
+// into a FileContent message that is reused for the whole file.
+//
+// With a CompressionPolicy, each chunk is compressed or not as the policy decides. The call must have been
+// set to compress with the policy's algorithm.
+
+template <class StreamWriter, class Reader = SequentialFileReader>
+class FileReaderIntoStream : public Reader {
 public:
     FileReaderIntoStream(const std::string& filename, std::int32_t id, StreamWriter& writer)
-        : SequentialFileReader(filename)
+        : Reader(filename)
         , m_writer(writer)
         , m_id(id)
+        , m_remote_filename(extract_basename(filename))
+        , m_first_chunk(true)
+        , m_offset(0)
+        , m_upload_id(0)
+        , m_compression(nullptr)
+    {
+    }
+
+    using Reader::Reader;
+    using Reader::operator=;
+
+    // Send the 'length' bytes at 'offset', for a ranged transfer
+    void SendRange(size_t offset, size_t length, size_t max_chunk_size)
     {
+        m_offset = offset;
+        Reader::ReadRange(offset, length, max_chunk_size);
     }
 
-    using SequentialFileReader::SequentialFileReader;
-    using SequentialFileReader::operator=;
+    void SetCompression(CompressionPolicy* compression)
+    {
+        m_compression = compression;
+    }
+
+    void SetUploadId(std::uint64_t upload_id)
+    {
+        m_upload_id = upload_id;
+    }
 
 protected:
     virtual void OnChunkAvailable(const void* data, size_t size) override
     {
-        const std::string remote_filename = extract_basename(GetFilePath());
-        auto fc = MakeFileContent(m_id, remote_filename, data, size);
-        if (! m_writer.Write(fc)) {
+        // Only the first chunk describes the transfer
+        m_content.set_id(m_id);
+        m_content.set_name(m_remote_filename);
+        m_content.set_offset(m_first_chunk ? m_offset : 0);
+        m_content.set_file_size(m_first_chunk ? Reader::GetSize() : 0);
+        m_content.set_upload_id(m_first_chunk ? m_upload_id : 0);
+        m_content.set_crc32c(crc32c(data, size));
+        m_first_chunk = false;
+
+        grpc::WriteOptions options;
+        if (m_compression) {
+            options = m_compression->WriteOptionsFor(data, size);
+        }
+
+        bool written = false;
+        if constexpr (writes_byte_buffers<StreamWriter>::value) {
+            written = m_writer.Write(MakeFileContentBuffer(m_content, Mapping(), data, size), options);
+        }
+        else {
+            m_content.set_content(data, size);
+            written = m_writer.Write(m_content, options);
+        }
+        if (! written) {
             raise_from_system_error_code("The server aborted the connection.", ECONNRESET);
         }
+
+        m_remote_filename.clear();
     }
 
 private:
+    std::shared_ptr<const std::uint8_t> Mapping() const
+    {
+        if constexpr (std::is_base_of<SequentialFileReader, Reader>::value) {
+            return Reader::GetMapping();
+        }
+        else {
+            return nullptr;
+        }
+    }
+
+    template <class W, class = void>
+    struct writes_byte_buffers : std::false_type {};
+
+    template <class W>
+    struct writes_byte_buffers<W, std::void_t<decltype(std::declval<W&>().Write(std::declval<const grpc::ByteBuffer&>()))> >
+        : std::true_type {};
+
     StreamWriter& m_writer;
     std::uint32_t m_id;
+    std::string m_remote_filename;
+    bool m_first_chunk;
+    std::uint64_t m_offset;
+    std::uint64_t m_upload_id;
+    fileexchange::FileContent m_content;
+    CompressionPolicy* m_compression;
 };
@@ -0,0 +1,229 @@
+#include <iostream>
+#include <sstream>
+#include <system_error>
+#include <iterator>
+#include <algorithm>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "file_transfer_service.h"
+#include "positional_file_writer.h"
+#include "file_reader_into_stream.h"
+#include "crc32c.h"
+
+using grpc::ServerContext;
+using grpc::ServerReader;
+using grpc::ServerWriter;
+using grpc::Status;
+using grpc::StatusCode;
+
+using fileexchange::FileContent;
+using fileexchange::FileId;
+using fileexchange::FileInfo;
+using fileexchange::FileRange;
+using fileexchange::UploadStatus;
+
+namespace {
+
+    // Add [start, end) to ranges that map their start to their end, merging it with those it overlaps or
+    // touches
+    void add_range(std::map<std::uint64_t, std::uint64_t>& ranges, std::uint64_t start, std::uint64_t end)
+    {
+        auto it = ranges.upper_bound(start);
+        if ((ranges.begin() != it) && (std::prev(it)->second >= start)) {
+            --it;
+            start = it->first;
+        }
+        while ((ranges.end() != it) && (it->first <= end)) {
+            end = std::max(end, it->second);
+            it = ranges.erase(it);
+        }
+        ranges[start] = end;
+    }
+};  // Anonymous namespace
+
+Status FileTransferService::PutFile(ServerContext* context, ServerReader<FileContent>* reader, FileId* summary)
+{
+    FileContent content_part;
+    PositionalFileWriter writer(m_sync_policy);
+    std::uint64_t upload_id = 0;
+    std::uint64_t file_size = 0;
+    std::uint64_t start = 0;
+    std::uint64_t position = 0;
+    while (reader->Read(&content_part)) {
+        try {
+            // The first chunk says where the range goes, and the following ones come right after it
+            if (! writer.IsOpen()) {
+                if (content_part.name().empty()) {
+                    return Status(StatusCode::INVALID_ARGUMENT, "The first chunk has no file name.");
+                }
+                upload_id = content_part.upload_id();
+                file_size = content_part.file_size();
+                BeginUpload(content_part.id(), upload_id, file_size);
+                writer.Open(content_part.name(), content_part.file_size());
+                start = position = content_part.offset();
+            }
+            const std::string& content = content_part.content();
+            if (crc32c(content.data(), content.size()) != content_part.crc32c()) {
+                // What came before is kept, so that the upload can resume with this chunk
+                std::ostringstream sts;
+                sts << "The chunk at offset " << position << " of " << writer.GetFilePath() << " failed its checksum.";
+                try {
+                    writer.Close();
+                    AddVerified(content_part.id(), upload_id, file_size, start, position);
+                }
+                catch (const std::system_error&) {
+                    // The checksum failure is the error reported
+                }
+                return Status(StatusCode::DATA_LOSS, sts.str());
+            }
+            const size_t size = content.size();
+            writer.Write(position, *content_part.mutable_content());
+            position += size;
+            summary->set_id(content_part.id());
+        }
+        catch (const std::system_error& ex) {
+            const auto status_code = writer.NoSpaceLeft() ? StatusCode::RESOURCE_EXHAUSTED : StatusCode::ABORTED;
+            return Status(status_code, ex.what());
+        }
+    }
+
+    if (writer.IsOpen()) {
+        try {
+            writer.Close();
+        }
+        catch (const std::system_error& ex) {
+            const auto status_code = writer.NoSpaceLeft() ? StatusCode::RESOURCE_EXHAUSTED : StatusCode::ABORTED;
+            return Status(status_code, ex.what());
+        }
+
+        // The file can only be downloaded once all of it has arrived, over however many calls
+        if (AddVerified(summary->id(), upload_id, file_size, start, position)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_file_id_to_name[summary->id()] = writer.GetFilePath();
+        }
+    }
+    return Status::OK;
+}
+
+Status FileTransferService::GetUploadStatus(ServerContext* context, const FileId* request, UploadStatus* response)
+{
+    const auto id = request->id();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_uploads.find(id);
+    if (m_uploads.end() == it) {
+        return Status(StatusCode::NOT_FOUND, "No upload with the id " + std::to_string(id));
+    }
+    const Upload& upload = it->second;
+    response->set_id(id);
+    response->set_upload_id(upload.upload_id);
+    response->set_file_size(upload.file_size);
+    for (const auto& range : upload.verified) {
+        response->add_verified_offsets(range.first);
+        response->add_verified_lengths(range.second - range.first);
+    }
+    return Status::OK;
+}
+
+Status FileTransferService::GetFileContent(ServerContext* context, const FileId* request, ServerWriter<FileContent>* writer)
+{
+    FileRange whole_file;
+    whole_file.set_id(request->id());
+    return GetFileRange(context, &whole_file, writer);
+}
+
+Status FileTransferService::GetFileInfo(ServerContext* context, const FileId* request, FileInfo* response)
+{
+    const auto id = request->id();
+    std::string filename;
+    if (! LookUp(id, &filename)) {
+        return Status(StatusCode::NOT_FOUND, "No file with the id " + std::to_string(id));
+    }
+
+    struct stat st {};
+    if (-1 == stat(filename.c_str(), &st)) {
+        const std::error_code ec(errno, std::system_category());
+        return Status(StatusCode::NOT_FOUND, "Failed to read the size of " + filename + ": " + ec.message());
+    }
+    response->set_id(id);
+    response->set_name(filename);
+    response->set_size(st.st_size);
+    return Status::OK;
+}
+
+Status FileTransferService::GetFileRange(ServerContext* context, const FileRange* request, ServerWriter<FileContent>* writer)
+{
+    const auto id = request->id();
+    std::string filename;
+    if (! LookUp(id, &filename)) {
+        return Status(StatusCode::NOT_FOUND, "No file with the id " + std::to_string(id));
+    }
+
+    try {
+        if (m_compression) {
+            context->set_compression_algorithm(m_compression->Algorithm());
+        }
+        FileReaderIntoStream< ServerWriter<FileContent> > reader(filename, id, *writer);
+        reader.SetCompression(m_compression);
+        if (request->offset() > reader.GetSize()) {
+            return Status(StatusCode::OUT_OF_RANGE, "The range starts past the end of the file.");
+        }
+        const std::uint64_t rest = reader.GetSize() - request->offset();
+        const std::uint64_t length = (0 == request->length()) ? rest : std::min<std::uint64_t>(request->length(), rest);
+        reader.SendRange(request->offset(), length, m_chunk_size);
+    }
+    catch (const std::exception& ex) {
+        std::ostringstream sts;
+        sts << "Error sending the file " << filename << ": " << ex.what();
+        std::cerr << sts.str() << std::endl;
+        return Status(StatusCode::ABORTED, sts.str());
+    }
+
+    return Status::OK;
+}
+
+void FileTransferService::BeginUpload(std::int32_t id, std::uint64_t upload_id, std::uint64_t file_size)
+{
+    // Uploads without an id can't be resumed, and aren't tracked
+    if (0 == upload_id) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Upload& upload = m_uploads[id];
+    if ((upload.upload_id != upload_id) || (upload.file_size != file_size)) {
+        upload.upload_id = upload_id;
+        upload.file_size = file_size;
+        upload.verified.clear();
+    }
+}
+
+bool FileTransferService::AddVerified(std::int32_t id, std::uint64_t upload_id, std::uint64_t file_size, std::uint64_t start,
+                                      std::uint64_t end)
+{
+    if (0 == upload_id) {
+        return (0 == start) && (end >= file_size);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_uploads.find(id);
+    // Another upload of the file may have started since
+    if ((m_uploads.end() == it) || (it->second.upload_id != upload_id)) {
+        return false;
+    }
+    std::map<std::uint64_t, std::uint64_t>& verified = it->second.verified;
+    if (start < end) {
+        add_range(verified, start, end);
+    }
+    return (0 == file_size) || (! verified.empty() && (0 == verified.begin()->first) && (verified.begin()->second >= file_size));
+}
+
+bool FileTransferService::LookUp(std::int32_t id, std::string* filename)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const auto it = m_file_id_to_name.find(id);
+    if (m_file_id_to_name.end() == it) {
+        return false;
+    }
+    *filename = it->second;
+    return true;
+}
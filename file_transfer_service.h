@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <map>
+#include <mutex>
+
+#include <grpc++/server_context.h>
+
+#include "file_exchange.grpc.pb.h"
+#include "positional_file_writer.h"
+#include "compression_policy.h"
+
+// FileTransferService: The synchronous implementation of the file transfer RPCs. Files are saved under
+// their base name in the working directory, and looked up by the id they were uploaded with, once all of
+// the file has arrived. Every chunk is written at its position in the file, so that the ranges of a file
+// may be uploaded over several concurrent calls. The other RPCs are left to derived classes.
+//
+// Every chunk is checked against its CRC-32C before it is written. The parts of an upload that were
+// checked and written are remembered per file id, as long as the upload id stays the same, so that an
+// interrupted upload can resume after them.
+//
+// The service is default-constructible, as gRPC's asynchronous method wrappers require, and is configured
+// before the server starts.
+
+class FileTransferService : public fileexchange::FileExchange::Service {
+public:
+    // Received files are synced as 'sync_policy' says. They aren't synced by default.
+    void SetSyncPolicy(PositionalFileWriter::SyncPolicy sync_policy)
+    {
+        m_sync_policy = sync_policy;
+    }
+
+    // What is sent is compressed as 'compression' decides. Nothing is compressed by default.
+    void SetCompression(CompressionPolicy* compression)
+    {
+        m_compression = compression;
+    }
+
+    CompressionPolicy* GetCompression() const
+    {
+        return m_compression;
+    }
+
+    // Files are sent in chunks of up to 'chunk_size' bytes, 1 MiB by default
+    void SetChunkSize(size_t chunk_size)
+    {
+        m_chunk_size = chunk_size;
+    }
+
+    grpc::Status PutFile(grpc::ServerContext* context, grpc::ServerReader<fileexchange::FileContent>* reader,
+                         fileexchange::FileId* summary) override;
+
+    grpc::Status GetUploadStatus(grpc::ServerContext* context, const fileexchange::FileId* request,
+                                 fileexchange::UploadStatus* response) override;
+
+    grpc::Status GetFileContent(grpc::ServerContext* context, const fileexchange::FileId* request,
+                                grpc::ServerWriter<fileexchange::FileContent>* writer) override;
+
+    grpc::Status GetFileInfo(grpc::ServerContext* context, const fileexchange::FileId* request,
+                             fileexchange::FileInfo* response) override;
+
+    grpc::Status GetFileRange(grpc::ServerContext* context, const fileexchange::FileRange* request,
+                              grpc::ServerWriter<fileexchange::FileContent>* writer) override;
+
+private:
+    // The parts of an upload that were verified and written, as their start mapped to their end
+    struct Upload {
+        std::uint64_t upload_id;
+        std::uint64_t file_size;
+        std::map<std::uint64_t, std::uint64_t> verified;
+    };
+
+    // Find the name of the file with the given id. Returns false if there is none.
+    bool LookUp(std::int32_t id, std::string* filename);
+
+    // Start tracking an upload, unless it is the one already tracked for the file id
+    void BeginUpload(std::int32_t id, std::uint64_t upload_id, std::uint64_t file_size);
+
+    // Record that [start, end) of an upload of a file of 'file_size' bytes was verified and written.
+    // Returns true once the parts verified cover the whole file, as a single call of an upload that isn't
+    // tracked must.
+    bool AddVerified(std::int32_t id, std::uint64_t upload_id, std::uint64_t file_size, std::uint64_t start, std::uint64_t end);
+
+    PositionalFileWriter::SyncPolicy m_sync_policy = PositionalFileWriter::SyncPolicy::None;
+    CompressionPolicy* m_compression = nullptr;
+    size_t m_chunk_size = 1UL << 20;
+
+    std::mutex m_mutex;
+    std::map<std::int32_t, std::string> m_file_id_to_name;
+    std::map<std::int32_t, Upload> m_uploads;
+};
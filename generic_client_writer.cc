@@ -0,0 +1,71 @@
+#include "generic_client_writer.h"
+
+using grpc::ByteBuffer;
+using grpc::ClientContext;
+using grpc::Status;
+using grpc::StatusCode;
+
+GenericClientWriter::GenericClientWriter(grpc::GenericStub& stub, ClientContext* context, const std::string& method)
+    : m_call(stub.PrepareCall(context, method, &m_cq))
+    , m_started(false)
+{
+    m_call->StartCall(this);
+    m_started = Wait();
+}
+
+GenericClientWriter::~GenericClientWriter()
+{
+    // Every operation has completed by now, so there is nothing left to drain but the shutdown
+    m_cq.Shutdown();
+    void* tag = nullptr;
+    bool ok = false;
+    while (m_cq.Next(&tag, &ok)) {
+    }
+}
+
+bool GenericClientWriter::Write(const ByteBuffer& request, grpc::WriteOptions options)
+{
+    if (! m_started) {
+        return false;
+    }
+    m_call->Write(request, options, this);
+    return Wait();
+}
+
+bool GenericClientWriter::WritesDone()
+{
+    if (! m_started) {
+        return false;
+    }
+    m_call->WritesDone(this);
+    return Wait();
+}
+
+Status GenericClientWriter::Finish(ByteBuffer* response)
+{
+    // A client-streaming method answers with one message, before the status. If the call failed, the read
+    // fails too and the status says why.
+    bool received = false;
+    if (m_started) {
+        m_call->Read(response, this);
+        received = Wait();
+    }
+
+    Status status;
+    m_call->Finish(&status, this);
+    Wait();
+    if (status.ok() && ! received) {
+        return Status(StatusCode::INTERNAL, "The server didn't send a response.");
+    }
+    return status;
+}
+
+bool GenericClientWriter::Wait()
+{
+    void* tag = nullptr;
+    bool ok = false;
+    if (! m_cq.Next(&tag, &ok)) {
+        return false;
+    }
+    return ok;
+}
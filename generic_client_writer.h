@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <grpc++/client_context.h>
+#include <grpc++/completion_queue.h>
+#include <grpc++/generic/generic_stub.h>
+#include <grpc++/support/byte_buffer.h>
+#include <grpc++/support/status.h>
+
+// GenericClientWriter: A client-streaming call whose requests are written as ByteBuffers that are already
+// serialised, with the blocking interface of grpc::ClientWriter. The call is made through
+// grpc::GenericStub, on a completion queue of its own that is waited on after every operation, so that a
+// request may refer to memory that isn't copied into a message, such as a mapped file.
+//
+// A writer is used by one thread at a time, like grpc::ClientWriter.
+
+class GenericClientWriter {
+public:
+    // Start a call of 'method', e.g. "/package.Service/Method", through 'stub'. 'context' must outlive the
+    // writer.
+    GenericClientWriter(grpc::GenericStub& stub, grpc::ClientContext* context, const std::string& method);
+    ~GenericClientWriter();
+
+    GenericClientWriter(const GenericClientWriter&) = delete;
+    GenericClientWriter& operator=(const GenericClientWriter&) = delete;
+
+    // Returns false once the call is over, as grpc::ClientWriter::Write() does
+    bool Write(const grpc::ByteBuffer& request, grpc::WriteOptions options = grpc::WriteOptions());
+    bool WritesDone();
+
+    // Wait for the server's response, which is left in 'response' still serialised, and for the status
+    grpc::Status Finish(grpc::ByteBuffer* response);
+
+private:
+    // Wait for the operation in flight, and return whether it succeeded
+    bool Wait();
+
+    grpc::CompletionQueue m_cq;
+    std::unique_ptr<grpc::GenericClientAsyncReaderWriter> m_call;
+    bool m_started;
+};
@@ -0,0 +1,257 @@
+#include <future>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include "journal.h"
+#include "crc32c.h"
+#include "utils.h"
+
+namespace {
+
+    // The directory that holds 'path'
+    std::string directory_of(const std::string& path)
+    {
+        const size_t slash = path.rfind('/');
+        if (std::string::npos == slash) {
+            return ".";
+        }
+        return (0 == slash) ? "/" : path.substr(0, slash);
+    }
+};  // Anonymous namespace
+
+Journal::Journal(const std::string& path, size_t group_commit, std::chrono::microseconds commit_window,
+                 std::uint64_t first_segment)
+    : m_file_path(path)
+    , m_fd(-1)
+    , m_segment(0)
+    , m_segment_bytes(0)
+    , m_group_commit(group_commit > 0 ? group_commit : 1)
+    , m_commit_window(commit_window)
+    , m_error(0)
+    , m_rotate_requested(false)
+    , m_rotate_error(0)
+    , m_stopping(false)
+{
+    const std::vector<std::uint64_t> segments = ListSegments(path);
+    const std::uint64_t segment = std::max(first_segment, segments.empty() ? 1 : segments.back());
+    const int err = OpenSegment(segment);
+    if (0 != err) {
+        raise_from_system_error_code("Failed to open the journal " + SegmentPath(path, segment) + '.', err);
+    }
+
+    m_flusher = std::thread(&Journal::FlushLoop, this);
+}
+
+std::string Journal::SegmentPath(const std::string& path, std::uint64_t segment)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%08llu", static_cast<unsigned long long>(segment));
+    return path + suffix;
+}
+
+std::vector<std::uint64_t> Journal::ListSegments(const std::string& path)
+{
+    const std::string directory = directory_of(path);
+    const std::string prefix = extract_basename(path) + '.';
+    DIR* const dir = opendir(directory.c_str());
+    if (nullptr == dir) {
+        raise_from_errno("Failed to list the journal segments in " + directory + '.');
+    }
+
+    std::vector<std::uint64_t> segments;
+    while (const struct dirent* entry = readdir(dir)) {
+        const char* const name = entry->d_name;
+        if ((0 != strncmp(name, prefix.c_str(), prefix.size())) || ('\0' == name[prefix.size()])) {
+            continue;
+        }
+        const char* const digits = name + prefix.size();
+        if (strspn(digits, "0123456789") == strlen(digits)) {
+            segments.push_back(std::strtoull(digits, nullptr, 10));
+        }
+    }
+    closedir(dir);
+
+    std::sort(segments.begin(), segments.end());
+    return segments;
+}
+
+std::uint32_t Journal::RecordChecksum(const void* payload, std::uint32_t size)
+{
+    return crc32c(payload, size, crc32c(&size, sizeof(size)));
+}
+
+int Journal::OpenSegment(std::uint64_t segment)
+{
+    const std::string segment_path = SegmentPath(m_file_path, segment);
+    const int fd = open(segment_path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (-1 == fd) {
+        return errno;
+    }
+    struct stat st {};
+    if (-1 == fstat(fd, &st)) {
+        const int err = errno;
+        close(fd);
+        return err;
+    }
+
+    // Sync the directory, so that a crash can't lose the segment while records in it are acknowledged
+    const int dir_fd = open(directory_of(m_file_path).c_str(), O_RDONLY | O_DIRECTORY);
+    if (-1 != dir_fd) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    if (-1 != m_fd) {
+        close(m_fd);
+    }
+    m_fd = fd;
+    m_segment = segment;
+    m_segment_bytes.store(st.st_size, std::memory_order_relaxed);
+    return 0;
+}
+
+Journal::~Journal()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+    }
+    m_pending_cv.notify_one();
+    m_flusher.join();
+
+    close(m_fd);
+}
+
+void Journal::AppendAsync(const fileexchange::OffsetData& record, CommitCallback done)
+{
+    std::string payload;
+    if (! record.SerializeToString(&payload)) {
+        done(EINVAL);
+        return;
+    }
+    const std::uint32_t payload_size = payload.size();
+    const std::uint32_t checksum = RecordChecksum(payload.data(), payload_size);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (0 != m_error) {
+        const int err = m_error;
+        lock.unlock();
+        done(err);
+        return;
+    }
+
+    m_pending.append(reinterpret_cast<const char*>(&payload_size), sizeof(payload_size));
+    m_pending.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+    m_pending.append(payload);
+    m_pending_callbacks.push_back(std::move(done));
+
+    // Wake the flusher when the first record of a group arrives, so that it starts the commit window,
+    // and again when the group is full so that it doesn't wait for the window to expire.
+    const size_t pending_count = m_pending_callbacks.size();
+    if ((1 == pending_count) || (pending_count >= m_group_commit)) {
+        m_pending_cv.notify_one();
+    }
+}
+
+void Journal::Append(const fileexchange::OffsetData& record)
+{
+    std::promise<int> committed;
+    auto result = committed.get_future();
+    AppendAsync(record, [&committed](int err) { committed.set_value(err); });
+
+    const int err = result.get();
+    if (0 != err) {
+        raise_from_system_error_code("Failed to write to the journal " + m_file_path + '.', err);
+    }
+}
+
+std::uint64_t Journal::Rotate()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_rotated_cv.wait(lock, [this] { return ! m_rotate_requested; });
+    m_rotate_requested = true;
+    m_pending_cv.notify_one();
+    m_rotated_cv.wait(lock, [this] { return ! m_rotate_requested; });
+    if (0 != m_rotate_error) {
+        raise_from_system_error_code("Failed to start a new segment of the journal " + m_file_path + '.', m_rotate_error);
+    }
+    return m_segment;
+}
+
+void Journal::FlushLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_pending_cv.wait(lock, [this] { return m_stopping || m_rotate_requested || ! m_pending_callbacks.empty(); });
+
+        // Switch segments between groups, so that no group is split between two of them
+        if (m_rotate_requested) {
+            lock.unlock();
+            const int err = OpenSegment(m_segment + 1);
+            lock.lock();
+            m_rotate_error = err;
+            m_rotate_requested = false;
+            m_rotated_cv.notify_all();
+            continue;
+        }
+        if (m_pending_callbacks.empty()) {
+            break;  // Stopping, and there's nothing left to commit
+        }
+
+        // Give concurrent appenders until the end of the window to join this group
+        m_pending_cv.wait_for(lock, m_commit_window,
+            [this] { return m_stopping || (m_pending_callbacks.size() >= m_group_commit); });
+
+        std::string group;
+        std::vector<CommitCallback> callbacks;
+        group.swap(m_pending);
+        callbacks.swap(m_pending_callbacks);
+
+        int err = m_error;
+        lock.unlock();
+        if (0 == err) {
+            err = WriteAndSync(group);
+        }
+        lock.lock();
+        if (0 == m_error) {
+            m_error = err;
+        }
+
+        lock.unlock();
+        for (auto& done : callbacks) {
+            done(err);
+        }
+        lock.lock();
+    }
+}
+
+int Journal::WriteAndSync(const std::string& buffer)
+{
+    const char* data = buffer.data();
+    size_t remaining = buffer.size();
+    while (remaining > 0) {
+        const ssize_t written = write(m_fd, data, remaining);
+        if (-1 == written) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return errno;
+        }
+        data += written;
+        remaining -= written;
+    }
+
+    if (-1 == fdatasync(m_fd)) {
+        return errno;
+    }
+    m_segment_bytes.fetch_add(buffer.size(), std::memory_order_relaxed);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <atomic>
+
+#include "file_exchange.pb.h"
+
+// Journal: An append-only write-ahead log of OffsetData records, made durable using group commit.
+// Callers hand over a record and get notified once a background flusher has written it to the file
+// and called fdatasync(). The flusher waits until 'group_commit' records are pending or 'commit_window'
+// has passed since it was woken up, so that a single fdatasync() covers all the records that arrived
+// concurrently in the meantime.
+//
+// The journal is a sequence of numbered segment files, 'path' followed by a dot and the segment number.
+// Records are appended to the last segment, and Rotate() starts a new one, so that the segments before
+// it can be deleted once a checkpoint covers them.
+//
+// On disk every record is stored as a 32-bit length and a 32-bit CRC-32C of the length and the payload,
+// both in host byte order, followed by the serialised OffsetData. The CRC lets recovery tell a record
+// that was torn by a crash from a complete one.
+
+class Journal {
+public:
+    // Open the last segment of the journal at 'path' for appending, or segment 'first_segment' if there
+    // is none or it is newer. Throws std::system_error on failure.
+    Journal(const std::string& path, size_t group_commit, std::chrono::microseconds commit_window,
+            std::uint64_t first_segment = 1);
+    ~Journal();
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Called with 0 once the record is durable, or with an errno value if it could not be written.
+    using CommitCallback = std::function<void(int)>;
+
+    // Append a record, and call 'done' once it is durable. 'done' is called on the flusher thread, so it
+    // should return quickly. If the journal failed earlier 'done' is called right away. Once a group fails
+    // to be written or synced the journal is unusable, and every subsequent record fails as well.
+    void AppendAsync(const fileexchange::OffsetData& record, CommitCallback done);
+
+    // Append a record and block until it is durable. Throws std::system_error if it could not be written.
+    void Append(const fileexchange::OffsetData& record);
+
+    // Start a new segment, and return its number. Every record appended before the call is in an earlier
+    // segment or the new one, and every record appended after it returns is in the new one or a later one.
+    // Throws std::system_error if the new segment can't be created, in which case the journal carries on
+    // with the current one.
+    std::uint64_t Rotate();
+
+    // Bytes written to the current segment since it was started or opened
+    std::uint64_t SegmentBytes() const
+    {
+        return m_segment_bytes.load(std::memory_order_relaxed);
+    }
+
+    std::string GetFilePath() const
+    {
+        return m_file_path;
+    }
+
+    // The file name of segment 'segment' of the journal at 'path'
+    static std::string SegmentPath(const std::string& path, std::uint64_t segment);
+
+    // The numbers of the segments of the journal at 'path' that exist, in ascending order. Throws
+    // std::system_error if the directory can't be read.
+    static std::vector<std::uint64_t> ListSegments(const std::string& path);
+
+    // The size of a record's length and CRC
+    static const size_t header_size = 2 * sizeof(std::uint32_t);
+
+    // The CRC stored with a record of 'size' bytes
+    static std::uint32_t RecordChecksum(const void* payload, std::uint32_t size);
+
+private:
+    void FlushLoop();
+
+    // Open segment 'segment' for appending, as the flusher's current segment. Returns 0 or an errno value.
+    int OpenSegment(std::uint64_t segment);
+
+    // Write the whole buffer to the file and sync it. Returns 0 on success or an errno value.
+    int WriteAndSync(const std::string& buffer);
+
+    std::string m_file_path;
+    int m_fd;                               // The current segment, only used by the flusher once it runs
+    std::uint64_t m_segment;
+    std::atomic<std::uint64_t> m_segment_bytes;
+    const size_t m_group_commit;
+    const std::chrono::microseconds m_commit_window;
+
+    std::mutex m_mutex;
+    std::condition_variable m_pending_cv;   // Signals the flusher that records are pending
+    std::string m_pending;                  // Encoded records not yet taken by the flusher
+    std::vector<CommitCallback> m_pending_callbacks;
+    int m_error;
+    bool m_rotate_requested;
+    int m_rotate_error;
+    std::condition_variable m_rotated_cv;   // Signals Rotate() that the flusher has switched segments
+    bool m_stopping;
+    std::thread m_flusher;
+};
@@ -0,0 +1,100 @@
+#include <cmath>
+#include <algorithm>
+
+#include "latency_histogram.h"
+
+namespace {
+
+    const unsigned sub_bucket_bits = 7;
+    const std::uint64_t sub_bucket_count = 1ULL << sub_bucket_bits;
+
+    // Values below 2 * sub_bucket_count have a bucket each. Above that, every power of two from
+    // 2^(sub_bucket_bits + 1) up to 2^63 has sub_bucket_count buckets.
+    const size_t bucket_count = 2 * sub_bucket_count + (63 - sub_bucket_bits) * sub_bucket_count;
+
+    unsigned most_significant_bit(std::uint64_t value)
+    {
+        return 63 - __builtin_clzll(value);
+    }
+};  // Anonymous namespace
+
+LatencyHistogram::LatencyHistogram()
+    : m_buckets(new std::atomic<std::uint64_t>[bucket_count]())
+    , m_count(0)
+    , m_sum(0)
+    , m_max(0)
+{
+}
+
+size_t LatencyHistogram::BucketIndex(std::uint64_t value)
+{
+    if (value < 2 * sub_bucket_count) {
+        return value;
+    }
+
+    // The top sub_bucket_bits + 1 bits of the value select the bucket within its power of two
+    const unsigned shift = most_significant_bit(value) - sub_bucket_bits;
+    return 2 * sub_bucket_count + (shift - 1) * sub_bucket_count + ((value >> shift) - sub_bucket_count);
+}
+
+std::uint64_t LatencyHistogram::BucketMidpoint(size_t index)
+{
+    if (index < 2 * sub_bucket_count) {
+        return index;
+    }
+
+    const size_t offset = index - 2 * sub_bucket_count;
+    const unsigned shift = offset / sub_bucket_count + 1;
+    const std::uint64_t lowest = (sub_bucket_count + offset % sub_bucket_count) << shift;
+    return lowest + ((1ULL << shift) >> 1);
+}
+
+void LatencyHistogram::Record(std::uint64_t value_ns)
+{
+    m_buckets[BucketIndex(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value_ns, std::memory_order_relaxed);
+
+    std::uint64_t max = m_max.load(std::memory_order_relaxed);
+    while ((value_ns > max) && ! m_max.compare_exchange_weak(max, value_ns, std::memory_order_relaxed)) {
+    }
+}
+
+std::uint64_t LatencyHistogram::Count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+std::uint64_t LatencyHistogram::Max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Mean() const
+{
+    const std::uint64_t count = Count();
+    return (count > 0) ? static_cast<double>(m_sum.load(std::memory_order_relaxed)) / count : 0.0;
+}
+
+std::uint64_t LatencyHistogram::Percentile(double quantile) const
+{
+    // Sum the buckets rather than use m_count, so that concurrent updates can't make us run off the end
+    std::uint64_t total = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        total += m_buckets[i].load(std::memory_order_relaxed);
+    }
+    if (0 == total) {
+        return 0;
+    }
+
+    const std::uint64_t rank = std::max<std::uint64_t>(1, std::ceil(quantile * total));
+    std::uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // The bucket's midpoint may exceed the exact maximum, which is known
+            return std::min(BucketMidpoint(i), Max());
+        }
+    }
+    return Max();
+}
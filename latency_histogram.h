@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+
+// LatencyHistogram: A log-linear histogram of latencies in nanoseconds, in the spirit of HdrHistogram.
+// Every power of two is split into 128 linear sub-buckets, so any recorded value is reported within
+// 0.4% of its actual value, across the whole 64-bit range.
+//
+// Record() is lock-free and wait-free apart from the update of the maximum: it increments a couple of
+// relaxed atomic counters, so it may be called from any number of threads concurrently. Reading the
+// histogram while it is being recorded into gives approximate results.
+
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void Record(std::uint64_t value_ns);
+
+    std::uint64_t Count() const;
+    std::uint64_t Max() const;
+    double Mean() const;
+
+    // The value below which the fraction 'quantile' (between 0 and 1) of the recorded values fall.
+    // Returns 0 if nothing was recorded.
+    std::uint64_t Percentile(double quantile) const;
+
+private:
+    static size_t BucketIndex(std::uint64_t value);
+    static std::uint64_t BucketMidpoint(size_t index);
+
+    std::unique_ptr< std::atomic<std::uint64_t>[] > m_buckets;
+    std::atomic<std::uint64_t> m_count;
+    std::atomic<std::uint64_t> m_sum;
+    std::atomic<std::uint64_t> m_max;
+};
@@ -0,0 +1,579 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sysexits.h>
+
+#include <grpc++/grpc++.h>
+
+#include "file_exchange.grpc.pb.h"
+#include "file_reader_into_stream.h"
+#include "channel_pool.h"
+#include "journal.h"
+#include "data_store.h"
+#include "offset_index.h"
+#include "offset_reader.h"
+#include "put_pipeline.h"
+#include "async_server.h"
+#include "latency_histogram.h"
+#include "crc32c.h"
+#include "fast_random.h"
+#include "utils.h"
+
+// Measures the client and the server end to end over loopback, so that performance regressions show up
+// on a single machine without a network. For every durability mode and transport, a file_exchange_server is
+// started in a scratch directory of its own, with a server_config.json written for the mode. Then, for every
+// value size, batch size and concurrency, as many client threads issue Put calls for the given time, each
+// with a batch of values at random offsets. Finally a file is uploaded and downloaded once. Every
+// measurement is a line of CSV, with the throughput and the percentiles of the latency.
+//
+// The durability modes are:
+//   memory   No journal, and the values are only indexed
+//   pwrite   No journal, and the values are written in place with pwrite()
+//   journal  Every Put is synced to the journal on its own before it is acknowledged
+//   group    Concurrent Puts are synced to the journal together
+//   replicated  As group, and the journal is also shipped to two follower servers on loopback ports,
+//               each with a journal of its own, and Puts are acknowledged once all three have them durable
+//
+// The transports are:
+//   tcp        A loopback port
+//   unix       A Unix domain socket, which skips the TCP stack
+//   inprocess  The server is built into the benchmark, from the same parts as file_exchange_server, and the
+//              calls go over in-process channels, which skip the sockets and the kernel altogether. The
+//              file transfer isn't measured, as the server would store the file over the one uploaded, and
+//              the replicated mode is skipped.
+//
+// Usage: loopback_bench [-s server_binary] [-o results.csv] [-t seconds_per_run] [-m modes] [-x transports]
+//                       [-v value_sizes] [-b batch_sizes] [-c concurrencies] [-f file_size_in_MB]
+// The lists are comma-separated, e.g. -v 64,4096 -c 1,8,64.
+
+namespace {
+
+    const std::uint64_t data_file_size = 256ULL << 20;
+    const size_t chunk_size = 1UL << 20;
+
+    struct Options {
+        std::string server = "./file_exchange_server";
+        std::string output = "bench.csv";
+        double seconds = 2.0;
+        std::vector<std::string> modes { "memory", "pwrite", "journal", "group", "replicated" };
+        std::vector<std::string> transports { "tcp", "unix", "inprocess" };
+        std::vector<size_t> value_sizes { 64, 1024, 16384 };
+        std::vector<size_t> batch_sizes { 1, 16 };
+        std::vector<size_t> concurrencies { 1, 8, 32 };
+        size_t file_mb = 64;
+    };
+
+    struct Result {
+        std::string mode;
+        std::string transport;
+        std::string operation;
+        size_t value_size;
+        size_t batch;
+        size_t concurrency;
+        double seconds;
+        std::uint64_t requests;
+        std::uint64_t errors;
+        std::uint64_t bytes;
+        const LatencyHistogram* latencies;
+    };
+
+    std::vector<std::string> split(const std::string& list)
+    {
+        std::vector<std::string> items;
+        std::istringstream stream(list);
+        std::string item;
+        while (std::getline(stream, item, ',')) {
+            if (! item.empty()) {
+                items.push_back(item);
+            }
+        }
+        return items;
+    }
+
+    std::vector<size_t> split_numbers(const std::string& list)
+    {
+        std::vector<size_t> numbers;
+        for (const std::string& item : split(list)) {
+            numbers.push_back(std::strtoul(item.c_str(), nullptr, 10));
+        }
+        return numbers;
+    }
+
+    const size_t replicated_followers = 2;
+
+    // The server settings that make up a durability mode. The followers of a replicated primary run in
+    // mode "group".
+    std::string server_config(const std::string& mode, const std::string& address,
+                              const std::vector<std::string>& followers = std::vector<std::string>())
+    {
+        const bool group = ("group" == mode) || ("replicated" == mode);
+        const bool journal = ("journal" == mode) || group;
+        const char* const engine = ("memory" == mode) ? "none" : "pwrite";
+        std::ostringstream config;
+        config << "{\n"
+               << "    \"server_address\": \"" << address << "\",\n"
+               << "    \"enableJournal\": " << (journal ? "true" : "false") << ",\n"
+               << "    \"groupCommit\": " << (group ? 100 : 1) << ",\n"
+               << "    \"groupCommitWindowUs\": " << (group ? 200 : 0) << ",\n";
+        if (! followers.empty()) {
+            config << "    \"followers\": [";
+            for (size_t i = 0; i < followers.size(); ++i) {
+                config << ((i > 0) ? ", \"" : "\"") << followers[i] << "\"";
+            }
+            config << "],\n"
+                   << "    \"journalOnAll\": true,\n";
+        }
+        config << "    \"journalPath\": \"journal.log\",\n"
+               << "    \"storageEngine\": \"" << engine << "\",\n"
+               << "    \"dataFile\": \"data.bin\",\n"
+               << "    \"dataFileSize\": " << data_file_size << ",\n"
+               << "    \"readCacheBytes\": 0,\n"
+               << "    \"fileSyncPolicy\": \"" << (journal ? "end" : "none") << "\",\n"
+               << "    \"asyncServer\": true\n"
+               << "}\n";
+        return config.str();
+    }
+
+    // A loopback port that was free a moment ago
+    int free_port();
+
+    // An address for the server 'name' to listen on over 'transport': a free loopback port, or a socket in
+    // /tmp, whose path stays short enough for a sockaddr_un wherever the benchmark runs
+    std::string listen_address(const std::string& transport, const std::string& name)
+    {
+        if ("unix" == transport) {
+            return "unix:/tmp/loopback_bench." + std::to_string(getpid()) + "." + name + ".sock";
+        }
+        return "127.0.0.1:" + std::to_string(free_port());
+    }
+
+    int free_port()
+    {
+        const int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (-1 == fd) {
+            raise_from_errno("Failed to create a socket.");
+        }
+        sockaddr_in address {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if ((-1 == bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))) ||
+            (-1 == getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length))) {
+            const int err = errno;
+            close(fd);
+            raise_from_system_error_code("Failed to find a free port.", err);
+        }
+        close(fd);
+        return ntohs(address.sin_port);
+    }
+
+    // A server listening on 'address' with 'config' in a scratch directory, which is stopped and removed
+    // with it, along with its socket if it has one. Its output goes to loopback_bench.<name>.log, which is
+    // kept.
+    class ServerProcess {
+    public:
+        ServerProcess(const std::string& binary, const std::string& name, const std::string& address, const std::string& config)
+            : m_directory("loopback_bench." + name + ".XXXXXX")
+            , m_socket_path((0 == address.compare(0, 5, "unix:")) ? address.substr(5) : std::string())
+            , m_pid(-1)
+        {
+            const std::string log_path = "loopback_bench." + name + ".log";
+            if (nullptr == mkdtemp(&m_directory[0])) {
+                raise_from_errno("Failed to create a directory for the server.");
+            }
+            std::ofstream(m_directory + "/server_config.json") << config;
+
+            m_pid = fork();
+            if (-1 == m_pid) {
+                raise_from_errno("Failed to start the server.");
+            }
+            if (0 == m_pid) {
+                const int log = open(log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                if ((-1 == chdir(m_directory.c_str())) || (-1 == log)) {
+                    _exit(EX_OSERR);
+                }
+                dup2(log, STDOUT_FILENO);
+                dup2(log, STDERR_FILENO);
+                execl(binary.c_str(), binary.c_str(), static_cast<char*>(nullptr));
+                _exit(EX_UNAVAILABLE);
+            }
+        }
+
+        ~ServerProcess()
+        {
+            if (m_pid > 0) {
+                kill(m_pid, SIGINT);
+                waitpid(m_pid, nullptr, 0);
+            }
+            if (! m_socket_path.empty()) {
+                unlink(m_socket_path.c_str());
+            }
+            const std::string remove = "rm -rf '" + m_directory + "'";
+            if (0 != std::system(remove.c_str())) {
+                std::cerr << "Failed to remove " << m_directory << std::endl;
+            }
+        }
+
+        // Whether the server is still running
+        bool Running()
+        {
+            return 0 == waitpid(m_pid, nullptr, WNOHANG);
+        }
+
+    private:
+        std::string m_directory;
+        const std::string m_socket_path;
+        pid_t m_pid;
+    };
+
+    // A server for a durability mode built into this process, with its files in a scratch directory that
+    // is removed with it. It serves in-process channels only, as file_exchange_server would with the
+    // settings of server_config(). It can't replicate.
+    class InProcessServer {
+    public:
+        explicit InProcessServer(const std::string& mode)
+            : m_directory("loopback_bench." + mode + ".inprocess.XXXXXX")
+        {
+            if (nullptr == mkdtemp(&m_directory[0])) {
+                raise_from_errno("Failed to create a directory for the server.");
+            }
+
+            const bool group = ("group" == mode);
+            std::unique_ptr<DataStore> store;
+            if ("memory" != mode) {
+                store = DataStore::Create("pwrite", m_directory + "/data.bin", data_file_size);
+                m_index.reset(new OffsetIndex(0, 1024));
+            }
+            std::unique_ptr<Journal> journal;
+            if (("journal" == mode) || group) {
+                journal.reset(new Journal(m_directory + "/journal.log", group ? 100 : 1, std::chrono::microseconds(group ? 200 : 0)));
+            }
+            m_reader.reset(new OffsetReader(store.get(), nullptr, m_index.get()));
+            m_pipeline.reset(new PutPipeline(std::move(journal), std::move(store), nullptr, m_index.get(), 0));
+            m_async_server.reset(new AsyncFileExchangeServer(*m_pipeline, *m_reader, 0, false));
+
+            grpc::ServerBuilder builder;
+            m_async_server->Register(builder);
+            m_server = builder.BuildAndStart();
+            if (! m_server) {
+                raise_from_system_error_code("Failed to start the in-process server.", EINVAL);
+            }
+            m_async_server->Start();
+        }
+
+        ~InProcessServer()
+        {
+            if (m_server) {
+                m_server->Shutdown();
+            }
+            m_async_server->Stop();
+            m_server.reset();
+            m_async_server.reset();
+            m_pipeline.reset();
+            const std::string remove = "rm -rf '" + m_directory + "'";
+            if (0 != std::system(remove.c_str())) {
+                std::cerr << "Failed to remove " << m_directory << std::endl;
+            }
+        }
+
+        // A channel of its own, like a connection of its own over the other transports
+        std::shared_ptr<grpc::Channel> NewChannel(size_t index)
+        {
+            grpc::ChannelArguments arguments;
+            arguments.SetInt("fileexchange.channel_index", static_cast<int>(index));
+            return m_server->InProcessChannel(arguments);
+        }
+
+    private:
+        std::string m_directory;
+        std::unique_ptr<OffsetIndex> m_index;
+        std::unique_ptr<OffsetReader> m_reader;
+        std::unique_ptr<PutPipeline> m_pipeline;
+        std::unique_ptr<AsyncFileExchangeServer> m_async_server;
+        std::unique_ptr<grpc::Server> m_server;
+    };
+
+    // Issue Puts of 'batch' values of 'value_size' bytes from 'concurrency' threads for 'seconds'
+    Result run_puts(ChannelPool& channels, const std::string& mode, const std::string& transport, size_t value_size,
+                    size_t batch, size_t concurrency, double seconds, LatencyHistogram& latencies)
+    {
+        std::vector< std::unique_ptr<fileexchange::FileExchange::Stub> > stubs;
+        for (size_t i = 0; i < channels.Size(); ++i) {
+            stubs.push_back(fileexchange::FileExchange::NewStub(channels.GetChannel(i)));
+        }
+
+        std::atomic<bool> stop(false);
+        std::atomic<std::uint64_t> requests(0);
+        std::atomic<std::uint64_t> errors(0);
+        std::vector<std::thread> threads;
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t t = 0; t < concurrency; ++t) {
+            threads.emplace_back([&, t] {
+                fileexchange::FileExchange::Stub& stub = *stubs[t % stubs.size()];
+                FastRandom random(t + 1);
+                const std::uint64_t slots = data_file_size / value_size;
+                fileexchange::OffsetData request;
+                for (size_t i = 0; i < batch; ++i) {
+                    request.add_offsets(0);
+                    request.add_values(std::string(value_size, static_cast<char>('a' + (t + i) % 26)));
+                }
+                fileexchange::success_failure response;
+                while (! stop.load(std::memory_order_relaxed)) {
+                    for (size_t i = 0; i < batch; ++i) {
+                        request.set_offsets(i, random.Below(slots) * value_size);
+                    }
+                    grpc::ClientContext context;
+                    const auto sent_at = std::chrono::steady_clock::now();
+                    const grpc::Status status = stub.Put(&context, request, &response);
+                    latencies.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - sent_at).count());
+                    requests.fetch_add(1, std::memory_order_relaxed);
+                    if (! status.ok()) {
+                        errors.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            });
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+        stop = true;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return Result { mode, transport, "put", value_size, batch, concurrency, elapsed, requests, errors,
+                        (requests - errors) * batch * value_size, &latencies };
+    }
+
+    void create_file(const std::string& path, size_t size)
+    {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        std::vector<char> block(chunk_size);
+        FastRandom random(1);
+        for (char& c : block) {
+            c = static_cast<char>(random.Next());
+        }
+        for (size_t written = 0; written < size; written += block.size()) {
+            file.write(block.data(), block.size());
+        }
+        if (! file) {
+            raise_from_errno("Failed to create " + path + '.');
+        }
+    }
+
+    // Upload a file, then download it, and time each transfer
+    void run_file_transfer(fileexchange::FileExchange::Stub& stub, const std::string& mode, const std::string& transport,
+                           size_t file_mb, LatencyHistogram& put_latency, LatencyHistogram& get_latency,
+                           std::vector<Result>* results)
+    {
+        const std::string path = "loopback_bench." + mode + "." + transport + ".dat";
+        const size_t size = file_mb << 20;
+        create_file(path, size);
+        const std::int32_t id = 1;
+
+        auto start = std::chrono::steady_clock::now();
+        bool ok = true;
+        {
+            grpc::ClientContext context;
+            fileexchange::FileId summary;
+            std::unique_ptr< grpc::ClientWriter<fileexchange::FileContent> > writer(stub.PutFile(&context, &summary));
+            FileReaderIntoStream< grpc::ClientWriter<fileexchange::FileContent> > reader(path, id, *writer);
+            reader.Read(chunk_size);
+            writer->WritesDone();
+            ok = writer->Finish().ok();
+        }
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        put_latency.Record(static_cast<std::uint64_t>(elapsed * 1e9));
+        results->push_back(Result { mode, transport, "put_file", size, 1, 1, elapsed, 1, ok ? 0U : 1U, ok ? size : 0, &put_latency });
+        unlink(path.c_str());
+
+        // The chunks are checked as the client would, and dropped
+        start = std::chrono::steady_clock::now();
+        std::uint64_t received = 0;
+        {
+            grpc::ClientContext context;
+            fileexchange::FileContent chunk;
+            std::unique_ptr< grpc::ClientReader<fileexchange::FileContent> > reader(stub.GetFileContent(&context, MakeFileId(id)));
+            while (reader->Read(&chunk)) {
+                ok = ok && (crc32c(chunk.content().data(), chunk.content().size()) == chunk.crc32c());
+                received += chunk.content().size();
+            }
+            ok = reader->Finish().ok() && ok && (received == size);
+        }
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        get_latency.Record(static_cast<std::uint64_t>(elapsed * 1e9));
+        results->push_back(Result { mode, transport, "get_file", size, 1, 1, elapsed, 1, ok ? 0U : 1U, ok ? received : 0, &get_latency });
+    }
+
+    void write_csv_header(std::ostream& out)
+    {
+        out << "mode,transport,operation,value_bytes,batch,concurrency,seconds,requests,errors,requests_per_s,values_per_s,MB_per_s,"
+               "p50_us,p99_us,p999_us,max_us" << std::endl;
+    }
+
+    void write_csv(std::ostream& out, const Result& result)
+    {
+        const LatencyHistogram& latencies = *result.latencies;
+        out << result.mode << ',' << result.transport << ',' << result.operation << ',' << result.value_size << ',' << result.batch << ','
+            << result.concurrency << ',' << result.seconds << ',' << result.requests << ',' << result.errors << ','
+            << result.requests / result.seconds << ',' << result.requests * result.batch / result.seconds << ','
+            << result.bytes / result.seconds / (1 << 20) << ','
+            << latencies.Percentile(0.5) / 1e3 << ',' << latencies.Percentile(0.99) / 1e3 << ','
+            << latencies.Percentile(0.999) / 1e3 << ',' << latencies.Max() / 1e3 << std::endl;
+    }
+
+    void usage [[noreturn]] (const char* prog_name)
+    {
+        std::cerr << "USAGE: " << prog_name << " [-s server_binary] [-o results.csv] [-t seconds_per_run] [-m modes]"
+                  << " [-x transports] [-v value_sizes] [-b batch_sizes] [-c concurrencies] [-f file_size_in_MB]" << std::endl;
+        std::exit(EX_USAGE);
+    }
+};  // Anonymous namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "s:o:t:m:x:v:b:c:f:"))) {
+        switch (opt) {
+        case 's': options.server = optarg; break;
+        case 'o': options.output = optarg; break;
+        case 't': options.seconds = std::strtod(optarg, nullptr); break;
+        case 'm': options.modes = split(optarg); break;
+        case 'x': options.transports = split(optarg); break;
+        case 'v': options.value_sizes = split_numbers(optarg); break;
+        case 'b': options.batch_sizes = split_numbers(optarg); break;
+        case 'c': options.concurrencies = split_numbers(optarg); break;
+        case 'f': options.file_mb = std::strtoul(optarg, nullptr, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    for (const std::string& transport : options.transports) {
+        if (("tcp" != transport) && ("unix" != transport) && ("inprocess" != transport)) {
+            std::cerr << "Unknown transport \"" << transport << "\". Expected tcp, unix or inprocess." << std::endl;
+            usage(argv[0]);
+        }
+    }
+
+    // The server runs in a directory of its own, so it is given an absolute path
+    char server_path[PATH_MAX];
+    if (nullptr == realpath(options.server.c_str(), server_path)) {
+        std::cerr << "Can't find the server " << options.server << ": " << strerror(errno) << std::endl;
+        return EX_USAGE;
+    }
+
+    std::ofstream csv(options.output);
+    if (! csv) {
+        std::cerr << "Failed to create " << options.output << std::endl;
+        return EX_CANTCREAT;
+    }
+    write_csv_header(csv);
+    write_csv_header(std::cout);
+
+    try {
+        // As many connections as the client threads could keep busy, up to a few
+        size_t max_concurrency = 1;
+        for (size_t concurrency : options.concurrencies) {
+            max_concurrency = std::max(max_concurrency, concurrency);
+        }
+        const size_t num_channels = std::min<size_t>(max_concurrency, 4);
+
+        for (const std::string& mode : options.modes) {
+            for (const std::string& transport : options.transports) {
+                const bool in_process = ("inprocess" == transport);
+                if (in_process && ("replicated" == mode)) {
+                    continue;
+                }
+                const std::string name = mode + "." + transport;
+
+                std::vector<std::string> follower_addresses;
+                std::vector< std::unique_ptr<ServerProcess> > followers;
+                std::unique_ptr<ServerProcess> server;
+                std::unique_ptr<InProcessServer> in_process_server;
+                std::unique_ptr<ChannelPool> channels;
+                if (in_process) {
+                    in_process_server.reset(new InProcessServer(mode));
+                    std::vector< std::shared_ptr<grpc::Channel> > in_process_channels;
+                    for (size_t i = 0; i < num_channels; ++i) {
+                        in_process_channels.push_back(in_process_server->NewChannel(i));
+                    }
+                    channels.reset(new ChannelPool(std::move(in_process_channels), ChannelPool::Policy::RoundRobin));
+                }
+                else {
+                    // The followers are started first, though the primary would wait for them anyway
+                    for (size_t i = 0; ("replicated" == mode) && (i < replicated_followers); ++i) {
+                        const std::string follower_name = name + ".follower" + std::to_string(i + 1);
+                        follower_addresses.push_back(listen_address(transport, follower_name));
+                        followers.emplace_back(new ServerProcess(server_path, follower_name, follower_addresses.back(),
+                                                                 server_config("group", follower_addresses.back())));
+                    }
+                    const std::string address = listen_address(transport, name);
+                    server.reset(new ServerProcess(server_path, name, address, server_config(mode, address, follower_addresses)));
+                    channels.reset(new ChannelPool(address, grpc::InsecureChannelCredentials(), grpc::ChannelArguments(),
+                                                   num_channels, ChannelPool::Policy::RoundRobin));
+                }
+                // In-process channels are connected from the start, and can't be watched
+                for (size_t i = 0; ! in_process && (i < channels->Size()); ++i) {
+                    if (! channels->GetChannel(i)->WaitForConnected(std::chrono::system_clock::now() + std::chrono::seconds(10))) {
+                        std::cerr << "The server in mode " << mode << " over " << transport << " didn't start. See loopback_bench."
+                                  << name << ".log." << std::endl;
+                        return EX_UNAVAILABLE;
+                    }
+                }
+
+                for (size_t value_size : options.value_sizes) {
+                    for (size_t batch : options.batch_sizes) {
+                        for (size_t concurrency : options.concurrencies) {
+                            if ((0 == value_size) || (0 == batch) || (0 == concurrency) || (server && ! server->Running())) {
+                                continue;
+                            }
+                            LatencyHistogram latencies;
+                            const Result result = run_puts(*channels, mode, transport, value_size, batch, concurrency,
+                                                           options.seconds, latencies);
+                            write_csv(csv, result);
+                            write_csv(std::cout, result);
+                        }
+                    }
+                }
+
+                if ((options.file_mb > 0) && ! in_process) {
+                    LatencyHistogram put_latency;
+                    LatencyHistogram get_latency;
+                    std::vector<Result> results;
+                    auto stub = fileexchange::FileExchange::NewStub(channels->GetChannel(0));
+                    run_file_transfer(*stub, mode, transport, options.file_mb, put_latency, get_latency, &results);
+                    for (const Result& result : results) {
+                        write_csv(csv, result);
+                        write_csv(std::cout, result);
+                    }
+                }
+
+                // The channels go before the server they lead to
+                channels.reset();
+            }
+        }
+    }
+    catch (const std::system_error& ex) {
+        std::cerr << ex.what() << std::endl;
+        return EX_OSERR;
+    }
+
+    return 0;
+}
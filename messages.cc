@@ -1,5 +1,25 @@
 #include "messages.h"
 
+namespace {
+
+    // Field tag of FileContent's content, as in file_exchange.proto
+    const std::uint8_t content_tag = (3 << 3) | 2;      // Length-delimited
+
+    void append_varint(std::string& out, std::uint64_t value)
+    {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    void release_mapping(void* mapping)
+    {
+        delete static_cast<std::shared_ptr<const std::uint8_t>*>(mapping);
+    }
+};  // Anonymous namespace
+
 fileexchange::FileId MakeFileId(std::int32_t id)
 {
     fileexchange::FileId fid;
@@ -14,4 +34,27 @@ fileexchange::FileContent MakeFileContent(std::int32_t id, std::string name, con
     fc.set_name(std::move(name));
     fc.set_content(data, data_len);
     return fc;
-}
\ No newline at end of file
+}
+
+grpc::ByteBuffer MakeFileContentBuffer(const fileexchange::FileContent& header_fields, std::shared_ptr<const std::uint8_t> mapping,
+                                       const void* data, size_t data_len)
+{
+    // Everything but the content goes into a small header slice. The content comes last, out of the order
+    // of the field numbers, which parsers accept.
+    thread_local std::string header;
+    header.clear();
+    header_fields.AppendToString(&header);
+    if (0 == data_len) {
+        grpc::Slice only(header.data(), header.size());
+        return grpc::ByteBuffer(&only, 1);
+    }
+    header.push_back(content_tag);
+    append_varint(header, data_len);
+
+    grpc::Slice slices[2] = {
+        grpc::Slice(header.data(), header.size()),
+        mapping ? grpc::Slice(const_cast<void*>(data), data_len, release_mapping, new std::shared_ptr<const std::uint8_t>(std::move(mapping)))
+                : grpc::Slice(data, data_len)
+    };
+    return grpc::ByteBuffer(slices, 2);
+}
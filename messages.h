@@ -2,8 +2,18 @@
 
 #include <cstdint>
 #include <string>
+#include <memory>
+
+#include <grpc++/support/byte_buffer.h>
 
 #include "file_exchange.grpc.pb.h"
 
 fileexchange::FileId MakeFileId(std::int32_t id);
 fileexchange::FileContent MakeFileContent(std::int32_t id, std::string name, const void* data, size_t data_len);
+
+// Serialise 'header_fields', a FileContent message without content, followed by 'data' as its content, into a
+// ByteBuffer without copying the content: the buffer refers to 'data' directly, and holds a reference to
+// 'mapping', which contains it, until gRPC is done with it. If 'mapping' is null, the content is copied
+// instead.
+grpc::ByteBuffer MakeFileContentBuffer(const fileexchange::FileContent& header_fields, std::shared_ptr<const std::uint8_t> mapping,
+                                       const void* data, size_t data_len);
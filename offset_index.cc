@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <vector>
+#include <utility>
+
+#include "offset_index.h"
+
+using fileexchange::OffsetData;
+
+namespace {
+
+    // The finaliser of SplitMix64. The low bits pick the bucket, and the high bits the segment.
+    std::uint64_t mix(std::uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    size_t round_up_to_power_of_two(size_t n)
+    {
+        size_t power = 1;
+        while (power < n) {
+            power <<= 1;
+        }
+        return power;
+    }
+};  // Anonymous namespace
+
+OffsetIndex::OffsetIndex(size_t expected_offsets, size_t num_segments)
+    : m_num_segments(std::max<size_t>(1, num_segments))
+    , m_segments(new Segment[m_num_segments])
+{
+    // Leave room for the expected offsets below the load limit
+    const size_t per_segment = expected_offsets / m_num_segments + 1;
+    const size_t num_buckets = round_up_to_power_of_two(per_segment * 100 / 85 / bucket_slots + 1);
+    for (size_t i = 0; i < m_num_segments; ++i) {
+        Allocate(m_segments[i], num_buckets);
+    }
+}
+
+OffsetIndex::Segment& OffsetIndex::SegmentOf(std::uint64_t hash) const
+{
+    return m_segments[(hash >> 32) % m_num_segments];
+}
+
+void OffsetIndex::Insert(std::uint64_t offset, std::uint32_t length)
+{
+    const std::uint64_t hash = mix(offset);
+    Segment& segment = SegmentOf(hash);
+    std::lock_guard<std::mutex> lock(segment.mutex);
+    InsertLocked(segment, hash, offset, length);
+}
+
+void OffsetIndex::Insert(const OffsetData& request)
+{
+    const int count = std::min(request.offsets_size(), request.values_size());
+    if (count <= 1) {
+        if (1 == count) {
+            Insert(request.offsets(0), request.values(0).size());
+        }
+        return;
+    }
+
+    // Sort the writes by segment, so that each lock is taken once. Writes to the same offset keep their
+    // order, so the last one wins as it would one at a time.
+    thread_local std::vector< std::pair<std::uint64_t, int> > writes;
+    writes.clear();
+    for (int i = 0; i < count; ++i) {
+        writes.emplace_back(mix(request.offsets(i)), i);
+    }
+    std::stable_sort(writes.begin(), writes.end(), [this](const std::pair<std::uint64_t, int>& a, const std::pair<std::uint64_t, int>& b) {
+        return (a.first >> 32) % m_num_segments < (b.first >> 32) % m_num_segments;
+    });
+
+    size_t first = 0;
+    while (first < writes.size()) {
+        Segment& segment = SegmentOf(writes[first].first);
+        std::lock_guard<std::mutex> lock(segment.mutex);
+        size_t i = first;
+        for (; (i < writes.size()) && (&SegmentOf(writes[i].first) == &segment); ++i) {
+            const int index = writes[i].second;
+            InsertLocked(segment, writes[i].first, request.offsets(index), request.values(index).size());
+        }
+        first = i;
+    }
+}
+
+bool OffsetIndex::Lookup(std::uint64_t offset, std::uint32_t* length) const
+{
+    const std::uint64_t hash = mix(offset);
+    const Segment& segment = SegmentOf(hash);
+    std::lock_guard<std::mutex> lock(segment.mutex);
+    for (size_t b = hash & segment.mask; ; b = (b + 1) & segment.mask) {
+        const Bucket& bucket = segment.buckets[b];
+        for (std::uint32_t slot = 0; slot < bucket.used; ++slot) {
+            if (bucket.offsets[slot] == offset) {
+                *length = bucket.lengths[slot];
+                return true;
+            }
+        }
+        // Entries are never removed, so the probe sequence of an offset ends at the first bucket with room
+        if (bucket.used < bucket_slots) {
+            return false;
+        }
+    }
+}
+
+void OffsetIndex::InsertLocked(Segment& segment, std::uint64_t hash, std::uint64_t offset, std::uint32_t length)
+{
+    for (size_t b = hash & segment.mask; ; b = (b + 1) & segment.mask) {
+        Bucket& bucket = segment.buckets[b];
+        for (std::uint32_t slot = 0; slot < bucket.used; ++slot) {
+            if (bucket.offsets[slot] == offset) {
+                bucket.lengths[slot] = length;
+                return;
+            }
+        }
+        if (bucket.used < bucket_slots) {
+            bucket.offsets[bucket.used] = offset;
+            bucket.lengths[bucket.used] = length;
+            ++bucket.used;
+            break;
+        }
+    }
+
+    ++segment.size;
+    if (segment.size * 100 > (segment.mask + 1) * bucket_slots * 85) {
+        Grow(segment);
+    }
+}
+
+void OffsetIndex::Allocate(Segment& segment, size_t num_buckets)
+{
+    segment.buckets.reset(new Bucket[num_buckets]());
+    segment.mask = num_buckets - 1;
+    segment.size = 0;
+}
+
+void OffsetIndex::Grow(Segment& segment)
+{
+    std::unique_ptr<Bucket[]> old_buckets(std::move(segment.buckets));
+    const size_t old_count = segment.mask + 1;
+    Allocate(segment, old_count * 2);
+    for (size_t b = 0; b < old_count; ++b) {
+        const Bucket& bucket = old_buckets[b];
+        for (std::uint32_t slot = 0; slot < bucket.used; ++slot) {
+            InsertLocked(segment, mix(bucket.offsets[slot]), bucket.offsets[slot], bucket.lengths[slot]);
+        }
+    }
+}
+
+void OffsetIndex::ForEach(size_t segment, const std::function<void(std::uint64_t, std::uint32_t)>& visit) const
+{
+    const Segment& s = m_segments[segment];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    for (size_t b = 0; b <= s.mask; ++b) {
+        const Bucket& bucket = s.buckets[b];
+        for (std::uint32_t slot = 0; slot < bucket.used; ++slot) {
+            visit(bucket.offsets[slot], bucket.lengths[slot]);
+        }
+    }
+}
+
+std::uint64_t OffsetIndex::Size() const
+{
+    std::uint64_t size = 0;
+    for (size_t i = 0; i < m_num_segments; ++i) {
+        std::lock_guard<std::mutex> lock(m_segments[i].mutex);
+        size += m_segments[i].size;
+    }
+    return size;
+}
+
+std::uint64_t OffsetIndex::MemoryUsage() const
+{
+    std::uint64_t bytes = m_num_segments * sizeof(Segment);
+    for (size_t i = 0; i < m_num_segments; ++i) {
+        std::lock_guard<std::mutex> lock(m_segments[i].mutex);
+        bytes += (m_segments[i].mask + 1) * sizeof(Bucket);
+    }
+    return bytes;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+#include "file_exchange.pb.h"
+
+// OffsetIndex: The length of the value last written at every offset, for all the offsets written so far.
+//
+// The index is split into 'num_segments' segments, each an open-addressing hash table with its own lock,
+// so that threads writing different offsets rarely contend. A table is an array of 64-byte buckets, each
+// holding up to five offsets and their lengths side by side, so that a lookup usually reads a single
+// cache line. Probing moves on to the next bucket when one is full, and a segment doubles its table on
+// its own once it is 85% full. At 12 bytes per entry plus the free slots this amounts to about 16 bytes
+// per offset, so a few hundred million offsets take a few gigabytes.
+//
+// Entries are never removed: writing an offset again only replaces its length.
+
+class OffsetIndex {
+public:
+    // 'expected_offsets' sizes the tables up front, to avoid growing them while serving
+    OffsetIndex(size_t expected_offsets, size_t num_segments);
+
+    OffsetIndex(const OffsetIndex&) = delete;
+    OffsetIndex& operator=(const OffsetIndex&) = delete;
+
+    void Insert(std::uint64_t offset, std::uint32_t length);
+
+    // Record every write of 'request', taking the lock of each segment involved once.
+    void Insert(const fileexchange::OffsetData& request);
+
+    // Get the length of the value at 'offset'. Returns false if the offset was never written.
+    bool Lookup(std::uint64_t offset, std::uint32_t* length) const;
+
+    std::uint64_t Size() const;
+
+    // Call 'visit' with every offset of segment 'segment' and its length, holding the lock of that segment
+    // only, so that the index can be saved a segment at a time while writes carry on.
+    size_t NumSegments() const
+    {
+        return m_num_segments;
+    }
+    void ForEach(size_t segment, const std::function<void(std::uint64_t, std::uint32_t)>& visit) const;
+
+    // Bytes taken by the tables
+    std::uint64_t MemoryUsage() const;
+
+private:
+    static const size_t bucket_slots = 5;
+
+    struct alignas(64) Bucket {
+        std::uint64_t offsets[bucket_slots];
+        std::uint32_t lengths[bucket_slots];
+        std::uint32_t used;
+    };
+
+    struct alignas(64) Segment {
+        mutable std::mutex mutex;
+        std::unique_ptr<Bucket[]> buckets;
+        size_t mask = 0;        // Number of buckets minus one
+        size_t size = 0;
+    };
+
+    Segment& SegmentOf(std::uint64_t hash) const;
+
+    // Called with the segment locked
+    static void InsertLocked(Segment& segment, std::uint64_t hash, std::uint64_t offset, std::uint32_t length);
+    static void Allocate(Segment& segment, size_t num_buckets);
+    static void Grow(Segment& segment);
+
+    const size_t m_num_segments;
+    std::unique_ptr<Segment[]> m_segments;
+};
@@ -0,0 +1,90 @@
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <cstdint>
+
+#include "offset_index.h"
+
+// Measures how OffsetIndex insertions and lookups scale from one thread up to one per core. Every thread
+// inserts its own offsets into a shared index, then looks all of them up. Reports the aggregate rate of
+// each phase, and the memory taken per offset.
+
+namespace {
+
+    const size_t offsets_per_thread = 2000000;
+    const size_t num_segments = 1024;
+
+    // Distinct, scattered offsets for each thread
+    std::uint64_t offset_of(size_t thread, size_t i)
+    {
+        return ((static_cast<std::uint64_t>(thread) << 40) | i) * 0x9e3779b97f4a7c15ULL;
+    }
+
+    // Run 'work' on 'num_threads' threads at once, and return the elapsed time in seconds
+    template <class Work>
+    double run(size_t num_threads, Work work)
+    {
+        std::atomic<bool> go(false);
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < num_threads; ++t) {
+            threads.emplace_back([&go, &work, t] {
+                while (! go.load(std::memory_order_acquire)) {
+                    std::this_thread::yield();
+                }
+                work(t);
+            });
+        }
+        const auto start = std::chrono::steady_clock::now();
+        go.store(true, std::memory_order_release);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};  // Anonymous namespace
+
+int main()
+{
+    const size_t max_threads = std::max(1U, std::thread::hardware_concurrency());
+    std::vector<size_t> thread_counts;
+    for (size_t n = 1; n < max_threads; n *= 2) {
+        thread_counts.push_back(n);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << " threads  insert_Mops  lookup_Mops  bytes/offset" << std::endl;
+    for (size_t num_threads : thread_counts) {
+        OffsetIndex index(num_threads * offsets_per_thread, num_segments);
+
+        const double insert_seconds = run(num_threads, [&index](size_t t) {
+            for (size_t i = 0; i < offsets_per_thread; ++i) {
+                index.Insert(offset_of(t, i), i & 0xffff);
+            }
+        });
+
+        std::atomic<std::uint64_t> found(0);
+        const double lookup_seconds = run(num_threads, [&index, &found](size_t t) {
+            std::uint64_t hits = 0;
+            std::uint32_t length = 0;
+            for (size_t i = 0; i < offsets_per_thread; ++i) {
+                hits += index.Lookup(offset_of(t, i), &length);
+            }
+            found += hits;
+        });
+        if (found != num_threads * offsets_per_thread) {
+            std::cerr << "Lost offsets: found " << found << " of " << num_threads * offsets_per_thread << std::endl;
+            return 1;
+        }
+
+        const double total = static_cast<double>(num_threads * offsets_per_thread);
+        std::cout << std::setw(8) << num_threads
+                  << std::setw(13) << total / insert_seconds / 1e6
+                  << std::setw(13) << total / lookup_seconds / 1e6
+                  << std::setw(14) << static_cast<double>(index.MemoryUsage()) / index.Size() << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#include <iostream>
+#include <string>
+#include <cstring>
+
+#include "offset_reader.h"
+
+using grpc::Status;
+using grpc::StatusCode;
+
+using fileexchange::OffsetData;
+using fileexchange::Offsets;
+
+OffsetReader::OffsetReader(DataStore* store, ReadCache* cache, OffsetIndex* index)
+    : m_store(store)
+    , m_cache(cache)
+    , m_index(index)
+{
+}
+
+Status OffsetReader::Get(const Offsets& request, OffsetData* response)
+{
+    const bool have_lengths = (request.lengths_size() > 0);
+    if (have_lengths && (request.lengths_size() != request.offsets_size())) {
+        return Status(StatusCode::INVALID_ARGUMENT, "The number of offsets and lengths differ.");
+    }
+
+    for (int i = 0; i < request.offsets_size(); ++i) {
+        const std::uint64_t offset = request.offsets(i);
+        response->add_offsets(offset);
+        std::string* value = response->add_values();
+        if (m_cache && m_cache->Lookup(offset, value)) {
+            // The cache holds the value as it was written, which a read of another length doesn't want
+            if (! have_lengths || (value->size() == request.lengths(i))) {
+                continue;
+            }
+            value->clear();
+        }
+        std::uint32_t length = 0;
+        if (have_lengths) {
+            length = request.lengths(i);
+        }
+        else if (! m_index || ! m_index->Lookup(offset, &length)) {
+            return Status(StatusCode::NOT_FOUND, "Nothing was written at offset " + std::to_string(offset) + '.');
+        }
+        if (! m_store) {
+            return Status(StatusCode::NOT_FOUND, "No value cached at offset " + std::to_string(offset) + '.');
+        }
+
+        const int err = m_store->Read(offset, length, value);
+        if (ERANGE == err) {
+            return Status(StatusCode::OUT_OF_RANGE, "The read goes past the end of the data file.");
+        }
+        if (0 != err) {
+            std::cerr << "Failed to read from " << m_store->GetFilePath() << ": " << strerror(err) << std::endl;
+            return Status(StatusCode::INTERNAL, "Failed to read the value.");
+        }
+        if (m_cache) {
+            m_cache->Fill(offset, *value);
+        }
+    }
+    return Status::OK;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <grpc++/support/status.h>
+
+#include "data_store.h"
+#include "read_cache.h"
+#include "offset_index.h"
+#include "file_exchange.pb.h"
+
+// OffsetReader: Serves the Get RPC. Every offset is looked up in the read cache first, and otherwise
+// read from the data file. The length to read is taken from the request if it has them, and from the
+// offset index otherwise. A cached value is only used if it has the length the request asks for. Values
+// read from the file are added to the cache.
+
+class OffsetReader {
+public:
+    // Any of 'store', 'cache' and 'index' may be null. They must outlive the reader.
+    OffsetReader(DataStore* store, ReadCache* cache, OffsetIndex* index);
+
+    OffsetReader(const OffsetReader&) = delete;
+    OffsetReader& operator=(const OffsetReader&) = delete;
+
+    // Fill 'response' with the value at every offset of 'request'. Fails with NOT_FOUND if a value is
+    // neither cached nor can be read from the data file.
+    grpc::Status Get(const fileexchange::Offsets& request, fileexchange::OffsetData* response);
+
+private:
+    DataStore* m_store;
+    ReadCache* m_cache;
+    OffsetIndex* m_index;
+};
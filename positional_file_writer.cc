@@ -0,0 +1,207 @@
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <utility>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "positional_file_writer.h"
+#include "utils.h"
+
+PositionalFileWriter::SyncPolicy PositionalFileWriter::ParseSyncPolicy(const std::string& name)
+{
+    if ("none" == name) {
+        return SyncPolicy::None;
+    }
+    if ("end" == name) {
+        return SyncPolicy::AtEnd;
+    }
+    if ("periodic" == name) {
+        return SyncPolicy::Periodic;
+    }
+    throw std::invalid_argument("Unknown sync policy \"" + name + "\". Expected none, end or periodic.");
+}
+
+PositionalFileWriter::PositionalFileWriter(SyncPolicy sync_policy, std::uint64_t sync_interval, size_t queue_depth)
+    : m_sync_policy(sync_policy)
+    , m_sync_interval(sync_interval)
+    , m_queue_depth(std::max<size_t>(1, queue_depth))
+    , m_fd(-1)
+    , m_no_space(false)
+    , m_closing(false)
+    , m_error(0)
+    , m_unsynced_bytes(0)
+{
+}
+
+PositionalFileWriter::~PositionalFileWriter()
+{
+    StopWriting();
+    if (-1 != m_fd) {
+        close(m_fd);
+    }
+}
+
+void PositionalFileWriter::Open(const std::string& name, std::uint64_t size)
+{
+    // FIXME: Sanitise file names, as in SequentialFileWriter.
+    m_name = name;
+    const int flags = O_WRONLY | O_CREAT | ((0 == size) ? O_TRUNC : 0);
+    const int fd = open(name.c_str(), flags, 0644);
+    if (-1 == fd) {
+        RaiseError("opening", errno);
+    }
+
+    if (size > 0) {
+#ifdef __linux__
+        // Unlike posix_fallocate(), this doesn't fall back to writing zeros where allocating isn't supported
+        if ((-1 == fallocate(fd, 0, 0, size)) && (EOPNOTSUPP != errno) && (ENOSYS != errno)) {
+            const int err = errno;
+            close(fd);
+            RaiseError("preallocating", err);
+        }
+#endif
+        // Every writer of a ranged transfer sets the same size, so it doesn't matter which one comes first
+        if (-1 == ftruncate(fd, size)) {
+            const int err = errno;
+            close(fd);
+            RaiseError("resizing", err);
+        }
+    }
+    m_fd = fd;
+    m_io_thread = std::thread(&PositionalFileWriter::WriteQueued, this);
+}
+
+void PositionalFileWriter::Write(std::uint64_t offset, std::string& data)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_written.wait(lock, [this] { return (m_chunks.size() < m_queue_depth) || (0 != m_error); });
+    if (0 != m_error) {
+        const int err = m_error;
+        lock.unlock();
+        RaiseError("writing to", err);
+    }
+
+    // Hand the caller a buffer that was already written in exchange for its data
+    Chunk chunk{offset, std::string()};
+    if (! m_free_buffers.empty()) {
+        chunk.data = std::move(m_free_buffers.back());
+        m_free_buffers.pop_back();
+    }
+    chunk.data.swap(data);
+    m_chunks.push_back(std::move(chunk));
+    m_queued.notify_one();
+}
+
+void PositionalFileWriter::Close()
+{
+    if (-1 == m_fd) {
+        return;
+    }
+    StopWriting();
+
+    int err = m_error;
+    if ((0 == err) && (SyncPolicy::None != m_sync_policy)) {
+        err = Sync();
+    }
+    if ((-1 == close(m_fd)) && (0 == err)) {
+        err = errno;
+    }
+    m_fd = -1;
+    if (0 != err) {
+        RaiseError("writing to", err);
+    }
+}
+
+void PositionalFileWriter::WriteQueued()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_queued.wait(lock, [this] { return ! m_chunks.empty() || m_closing; });
+        if (m_chunks.empty()) {
+            break;
+        }
+        Chunk chunk = std::move(m_chunks.front());
+        m_chunks.pop_front();
+        int err = m_error;
+        lock.unlock();
+
+        // Once a write failed, the file is broken anyway, so the rest is dropped
+        if (0 == err) {
+            err = WriteChunk(chunk);
+        }
+        if ((0 == err) && (SyncPolicy::Periodic == m_sync_policy)) {
+            m_unsynced_bytes += chunk.data.size();
+            if (m_unsynced_bytes >= m_sync_interval) {
+                err = Sync();
+                m_unsynced_bytes = 0;
+            }
+        }
+        chunk.data.clear();
+
+        lock.lock();
+        if ((0 != err) && (0 == m_error)) {
+            m_error = err;
+            if ((ENOSPC == err) || (EFBIG == err)) {
+                m_no_space = true;
+            }
+        }
+        if (m_free_buffers.size() < m_queue_depth) {
+            m_free_buffers.push_back(std::move(chunk.data));
+        }
+        m_written.notify_all();
+    }
+}
+
+void PositionalFileWriter::StopWriting()
+{
+    if (! m_io_thread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+    }
+    m_queued.notify_one();
+    m_io_thread.join();
+}
+
+int PositionalFileWriter::WriteChunk(const Chunk& chunk)
+{
+    const char* p = chunk.data.data();
+    size_t left = chunk.data.size();
+    std::uint64_t offset = chunk.offset;
+    while (left > 0) {
+        const ssize_t written = pwrite(m_fd, p, left, offset);
+        if (-1 == written) {
+            if (EINTR == errno) {
+                continue;
+            }
+            return errno;
+        }
+        p += written;
+        left -= written;
+        offset += written;
+    }
+    return 0;
+}
+
+int PositionalFileWriter::Sync()
+{
+    return (-1 == fdatasync(m_fd)) ? errno : 0;
+}
+
+void PositionalFileWriter::RaiseError(const std::string& action_attempted, int err)
+{
+    if ((ENOSPC == err) || (EFBIG == err)) {
+        m_no_space = true;
+    }
+
+    std::ostringstream sts;
+    sts << "Error " << action_attempted << " the file " << m_name << ": ";
+    raise_from_system_error_code(sts.str(), err);
+}
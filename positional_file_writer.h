@@ -0,0 +1,111 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+// PositionalFileWriter: Writes data at given offsets of a file, so that the ranges of a file can arrive in
+// any order, and from several threads at once. Unlike SequentialFileWriter it never truncates the file
+// behind the back of another writer of the same file, unless asked to.
+//
+// Writes are asynchronous. Write() only queues the chunk for a dedicated I/O thread and returns, so that
+// the thread receiving the data goes on reading from the network while the previous chunks are written.
+// At most 'queue_depth' chunks wait at a time; beyond that Write() blocks until the disk catches up. The
+// chunks' buffers are handed back to the callers once written, so receiving a file doesn't allocate after
+// the first few chunks. An error met by the I/O thread is raised by the next call to Write() or Close(),
+// and the chunks queued after it are dropped.
+//
+// When the size of the file is known, its blocks are allocated up front with fallocate(), so that the
+// writes don't have to extend the file, and a full disk is reported before anything is received.
+
+class PositionalFileWriter {
+public:
+    // When the data is flushed to the disk:
+    //   None      Never; the kernel writes it back in its own time.
+    //   AtEnd     Once, by Close().
+    //   Periodic  Every 'sync_interval' bytes written, by the I/O thread, and by Close(). This bounds the
+    //             amount of dirty data, which spreads out the writeback of large files.
+    enum class SyncPolicy { None, AtEnd, Periodic };
+
+    // Parse "none", "end" or "periodic". Throws std::invalid_argument on anything else.
+    static SyncPolicy ParseSyncPolicy(const std::string& name);
+
+    static constexpr size_t default_queue_depth = 4;
+    static constexpr std::uint64_t default_sync_interval = 64UL << 20;
+
+    explicit PositionalFileWriter(SyncPolicy sync_policy = SyncPolicy::None,
+                                  std::uint64_t sync_interval = default_sync_interval,
+                                  size_t queue_depth = default_queue_depth);
+
+    // Stops the I/O thread after the queued writes, but neither syncs nor reports errors. Call Close()
+    // for that.
+    ~PositionalFileWriter();
+
+    PositionalFileWriter(const PositionalFileWriter&) = delete;
+    PositionalFileWriter& operator=(const PositionalFileWriter&) = delete;
+
+    // Open the file at the relative path 'name' for writing, creating it if necessary. If 'size' is not 0
+    // the file is set to that size. Otherwise the size of the file is unknown, and its content is
+    // discarded. On errors throws std::system_error.
+    void Open(const std::string& name, std::uint64_t size);
+
+    bool IsOpen() const
+    {
+        return -1 != m_fd;
+    }
+
+    // Queue 'data' to be written at 'offset'. Takes ownership of the content of 'data', and leaves it
+    // empty. May be called from several threads concurrently; the chunks are written in the order they
+    // were queued. On errors throws std::system_error.
+    void Write(std::uint64_t offset, std::string& data);
+
+    // Wait for the queued writes, sync as the policy requires, and close the file. On errors throws
+    // std::system_error.
+    void Close();
+
+    bool NoSpaceLeft() const
+    {
+        return m_no_space;
+    }
+
+    std::string GetFilePath() const
+    {
+        return m_name;
+    }
+
+private:
+    struct Chunk {
+        std::uint64_t offset;
+        std::string data;
+    };
+
+    void WriteQueued();
+    void StopWriting();
+    int WriteChunk(const Chunk& chunk);
+    int Sync();
+
+    const SyncPolicy m_sync_policy;
+    const std::uint64_t m_sync_interval;
+    const size_t m_queue_depth;
+
+    std::string m_name;
+    int m_fd;
+    std::atomic<bool> m_no_space;
+
+    std::mutex m_mutex;
+    std::condition_variable m_queued;       // Signalled when a chunk is queued, or the writer is closed
+    std::condition_variable m_written;      // Signalled when a chunk is written, or the I/O thread stops
+    std::deque<Chunk> m_chunks;
+    std::vector<std::string> m_free_buffers;
+    bool m_closing;
+    int m_error;                            // The first error met by the I/O thread
+    std::uint64_t m_unsynced_bytes;         // Only touched by the I/O thread
+    std::thread m_io_thread;
+
+    void RaiseError [[noreturn]] (const std::string& action_attempted, int err);
+};
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <utility>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "pread_file_reader.h"
+#include "utils.h"
+
+PreadFileReader::PreadFileReader(const std::string& file_name)
+    : m_file_path(file_name)
+    , m_fd(-1)
+    , m_size(0)
+    , m_buffer_size(0)
+{
+    const int fd = open(file_name.c_str(), O_RDONLY);
+    if (-1 == fd) {
+        raise_from_errno("Failed to open file.");
+    }
+
+    struct stat st {};
+    if (-1 == fstat(fd, &st)) {
+        const int err = errno;
+        close(fd);
+        raise_from_system_error_code("Failed to read file size.", err);
+    }
+    m_size = st.st_size;
+    m_fd = fd;
+
+    // Let the kernel use a larger read-ahead window. Only a hint, so failures are ignored.
+    posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+PreadFileReader::PreadFileReader(PreadFileReader&& other)
+    : m_file_path(std::move(other.m_file_path))
+    , m_fd(std::exchange(other.m_fd, -1))
+    , m_size(other.m_size)
+    , m_buffer(std::move(other.m_buffer))
+    , m_buffer_size(std::exchange(other.m_buffer_size, 0))
+{
+}
+
+PreadFileReader& PreadFileReader::operator=(PreadFileReader&& other)
+{
+    if (this != &other) {
+        if (-1 != m_fd) {
+            close(m_fd);
+        }
+        m_file_path = std::move(other.m_file_path);
+        m_fd = std::exchange(other.m_fd, -1);
+        m_size = other.m_size;
+        m_buffer = std::move(other.m_buffer);
+        m_buffer_size = std::exchange(other.m_buffer_size, 0);
+    }
+    return *this;
+}
+
+PreadFileReader::~PreadFileReader()
+{
+    if (-1 != m_fd) {
+        close(m_fd);
+    }
+}
+
+void PreadFileReader::Read(size_t max_chunk_size)
+{
+    ReadRange(0, m_size, max_chunk_size);
+}
+
+void PreadFileReader::ReadRange(size_t offset, size_t length, size_t max_chunk_size)
+{
+    if ((offset > m_size) || (length > m_size - offset)) {
+        raise_from_system_error_code("The range goes past the end of the file.", ERANGE);
+    }
+
+    if (0 == length) {
+        OnChunkAvailable("", 0);
+        return;
+    }
+
+    // The buffer is kept from one call to the next
+    const size_t chunk_size = std::min(max_chunk_size, length);
+    if (m_buffer_size < chunk_size) {
+        m_buffer.reset(new char[chunk_size]);
+        m_buffer_size = chunk_size;
+    }
+
+    const size_t end = offset + length;
+    size_t bytes_read = offset;
+    while (bytes_read < end) {
+        const size_t bytes_to_read = std::min(chunk_size, end - bytes_read);
+        size_t filled = 0;
+        while (filled < bytes_to_read) {
+            const ssize_t rc = pread(m_fd, m_buffer.get() + filled, bytes_to_read - filled, bytes_read + filled);
+            if (-1 == rc) {
+                if (EINTR == errno) {
+                    continue;
+                }
+                raise_from_errno("Failed to read the file.");
+            }
+            if (0 == rc) {
+                raise_from_system_error_code("The file was truncated while being read.", EIO);
+            }
+            filled += rc;
+        }
+
+        // Have the next chunk read while this one is processed
+        const size_t next = bytes_read + bytes_to_read;
+        if (next < end) {
+            posix_fadvise(m_fd, next, std::min(chunk_size, end - next), POSIX_FADV_WILLNEED);
+        }
+
+        OnChunkAvailable(m_buffer.get(), bytes_to_read);
+        bytes_read = next;
+    }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <memory>
+
+// PreadFileReader: Read a file with pread() into a buffer that is reused for every chunk, as an
+// alternative to SequentialFileReader for files where the page faults of a mapping cost more than the
+// copy saves, e.g. on cold files on fast devices. While a chunk is being processed, the kernel is asked to
+// read the next one with POSIX_FADV_WILLNEED.
+//
+// The data passed to OnChunkAvailable() are only valid until it returns.
+
+class PreadFileReader {
+public:
+    PreadFileReader(PreadFileReader&&);
+    PreadFileReader& operator=(PreadFileReader&&);
+    ~PreadFileReader();
+
+    // Read the file, calling OnChunkAvailable() whenever data are available. It blocks until the reading
+    // is complete.
+    void Read(size_t max_chunk_size);
+
+    // Read the 'length' bytes at 'offset' in the same way. Throws std::system_error with ERANGE if the
+    // range goes past the end of the file, or with the error of pread() if it fails.
+    void ReadRange(size_t offset, size_t length, size_t max_chunk_size);
+
+    std::string GetFilePath() const
+    {
+        return m_file_path;
+    }
+
+    size_t GetSize() const
+    {
+        return m_size;
+    }
+
+protected:
+    // Constructor. Attempts to open the file, and throws std::system_error if it fails to do so.
+    PreadFileReader(const std::string& file_name);
+
+    // OnChunkAvailable: The user needs to override this function to get called when data become available.
+    virtual void OnChunkAvailable(const void* data, size_t size) = 0;
+
+private:
+    std::string m_file_path;
+    int m_fd;
+    size_t m_size;
+    std::unique_ptr<char[]> m_buffer;
+    size_t m_buffer_size;
+};
@@ -0,0 +1,109 @@
+#include <utility>
+
+#include "put_batcher.h"
+
+using fileexchange::OffsetData;
+
+namespace {
+
+    // Number of full batches Add() lets queue up for the sender before it blocks
+    const size_t max_ready_batches = 4;
+};  // Anonymous namespace
+
+PutBatcher::PutBatcher(Sender send, Limits limits, BatchCallback on_batch)
+    : m_send(std::move(send))
+    , m_limits(limits)
+    , m_on_batch(std::move(on_batch))
+    , m_pending_bytes(0)
+    , m_pending_id(0)
+    , m_stopping(false)
+{
+    m_sender = std::thread(&PutBatcher::SendLoop, this);
+}
+
+PutBatcher::~PutBatcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending.offsets_size() > 0) {
+            CutBatch();
+        }
+        m_stopping = true;
+    }
+    m_ready_cv.notify_one();
+    m_sender.join();
+}
+
+std::uint64_t PutBatcher::Add(std::uint64_t offset, std::string value)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_space_cv.wait(lock, [this] { return m_ready.size() < max_ready_batches; });
+
+    if (0 == m_pending.offsets_size()) {
+        m_pending_since = std::chrono::steady_clock::now();
+        m_ready_cv.notify_one();    // Start the linger timer
+    }
+    m_pending_bytes += value.size();
+    m_pending.add_offsets(offset);
+    m_pending.add_values(std::move(value));
+
+    const std::uint64_t id = m_pending_id;
+    const size_t entries = m_pending.offsets_size();
+    if (((m_limits.max_entries > 0) && (entries >= m_limits.max_entries)) ||
+        ((m_limits.max_bytes > 0) && (m_pending_bytes >= m_limits.max_bytes))) {
+        CutBatch();
+    }
+    return id;
+}
+
+void PutBatcher::Flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pending.offsets_size() > 0) {
+        CutBatch();
+    }
+}
+
+void PutBatcher::CutBatch()
+{
+    m_ready.push_back(ReadyBatch { m_pending_id++, m_pending_bytes, std::move(m_pending) });
+    m_pending.Clear();
+    m_pending_bytes = 0;
+    m_ready_cv.notify_one();
+}
+
+void PutBatcher::SendLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_ready_cv.wait(lock, [this] { return m_stopping || ! m_ready.empty() || (m_pending.offsets_size() > 0); });
+        if (m_ready.empty() && (m_pending.offsets_size() > 0)) {
+            // Let the pending batch fill up until it lingered long enough
+            const auto deadline = m_pending_since + m_limits.linger;
+            m_ready_cv.wait_until(lock, deadline, [this] { return m_stopping || ! m_ready.empty(); });
+            if (m_ready.empty() && (m_pending.offsets_size() > 0)) {
+                CutBatch();
+            }
+        }
+        if (m_ready.empty()) {
+            break;  // Stopping, and everything was sent
+        }
+
+        ReadyBatch ready = std::move(m_ready.front());
+        m_ready.pop_front();
+        m_space_cv.notify_all();
+        lock.unlock();
+
+        const std::uint64_t id = ready.id;
+        const size_t bytes = ready.bytes;
+        const size_t entries = ready.batch.offsets_size();
+        const auto sent_at = std::chrono::steady_clock::now();
+        // The completion may run after the batcher is gone, so it holds its own copy of the callback
+        const BatchCallback on_batch = m_on_batch;
+        m_send(std::move(ready.batch), [on_batch, id, entries, bytes, sent_at](bool ok) {
+            on_batch(BatchResult { id, ok, entries, bytes, std::chrono::steady_clock::now() - sent_at });
+        });
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <functional>
+
+#include "file_exchange.pb.h"
+
+// PutBatcher: Coalesces individual writes into multi-entry OffsetData batches. A batch is sent once it
+// holds 'max_entries' writes or 'max_bytes' bytes of values, or when 'linger' has passed since its first
+// write was added, whichever comes first. The linger time therefore bounds the latency added to any write.
+//
+// Batches are handed to the sender on a background thread, in the order they were cut. Add() blocks
+// while a few full batches are already waiting for the sender, so that a slow server slows the caller
+// down rather than letting the batches pile up in memory.
+
+class PutBatcher {
+public:
+    struct Limits {
+        size_t max_entries;                 // 0 means no limit
+        size_t max_bytes;                   // 0 means no limit
+        std::chrono::microseconds linger;
+    };
+
+    struct BatchResult {
+        std::uint64_t id;                   // As returned by Add() for the writes in the batch
+        bool ok;
+        size_t entries;
+        size_t bytes;                       // Of the values
+        std::chrono::nanoseconds latency;   // From sending the batch until it completed
+    };
+
+    // Called once per batch when it completes, possibly on a thread of the sender
+    using BatchCallback = std::function<void(const BatchResult&)>;
+
+    // Sends a batch, and calls the completion with whether it succeeded. It may return before the batch
+    // completes.
+    using Sender = std::function<void(fileexchange::OffsetData&&, std::function<void(bool)>)>;
+
+    PutBatcher(Sender send, Limits limits, BatchCallback on_batch);
+
+    // Sends whatever is pending. It waits for the batches to be handed to the sender, but not for them
+    // to complete.
+    ~PutBatcher();
+
+    PutBatcher(const PutBatcher&) = delete;
+    PutBatcher& operator=(const PutBatcher&) = delete;
+
+    // Add a write, and return the id of the batch it will be sent in
+    std::uint64_t Add(std::uint64_t offset, std::string value);
+
+    // Cut the current batch now instead of waiting for its limits
+    void Flush();
+
+private:
+    struct ReadyBatch {
+        std::uint64_t id;
+        size_t bytes;
+        fileexchange::OffsetData batch;
+    };
+
+    // Move the pending writes to the ready queue. Called with the lock held.
+    void CutBatch();
+
+    void SendLoop();
+
+    const Sender m_send;
+    const Limits m_limits;
+    const BatchCallback m_on_batch;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready_cv;     // Signals the sending thread
+    std::condition_variable m_space_cv;     // Signals Add() that the ready queue has room
+    fileexchange::OffsetData m_pending;
+    size_t m_pending_bytes;
+    std::chrono::steady_clock::time_point m_pending_since;
+    std::uint64_t m_pending_id;
+    std::deque<ReadyBatch> m_ready;
+    bool m_stopping;
+    std::thread m_sender;
+};
@@ -0,0 +1,158 @@
+#include <thread>
+#include <memory>
+#include <algorithm>
+#include <optional>
+#include <string>
+#include <cstdlib>
+
+#include <grpc++/client_context.h>
+#include <grpc++/completion_queue.h>
+
+#include "put_caller.h"
+
+using grpc::ClientAsyncResponseReader;
+using grpc::ClientContext;
+using grpc::CompletionQueue;
+using grpc::Status;
+
+using fileexchange::OffsetData;
+using fileexchange::success_failure;
+
+namespace {
+
+    void set_deadline(ClientContext& context, std::chrono::system_clock::time_point deadline)
+    {
+        if (std::chrono::system_clock::time_point::max() != deadline) {
+            context.set_deadline(deadline);
+        }
+    }
+
+    // How long the server asked the client to wait before retrying the call, or 0
+    std::chrono::milliseconds pushback_of(const ClientContext& context)
+    {
+        const auto& trailers = context.GetServerTrailingMetadata();
+        const auto found = trailers.find(RetryPolicy::pushback_key);
+        if (trailers.end() == found) {
+            return std::chrono::milliseconds(0);
+        }
+        const std::string value(found->second.data(), found->second.size());
+        return std::chrono::milliseconds(std::max(0LL, std::strtoll(value.c_str(), nullptr, 10)));
+    }
+};  // Anonymous namespace
+
+PutCaller::PutCaller(ChannelPool& channels, RetryPolicy& retry_policy, CompressionPolicy& compression)
+    : m_channels(channels)
+    , m_retry_policy(retry_policy)
+    , m_compression(compression)
+{
+    for (size_t i = 0; i < channels.Size(); ++i) {
+        m_stubs.push_back(fileexchange::FileExchange::NewStub(channels.GetChannel(i)));
+    }
+}
+
+Status PutCaller::Put(const OffsetData& request, success_failure* response)
+{
+    const grpc_compression_algorithm algorithm = m_compression.AlgorithmFor(request);
+    const TimePoint call_deadline = m_retry_policy.CallDeadline();
+    const size_t max_retries = m_retry_policy.GetOptions().max_retries;
+    for (size_t retry = 0; ; ++retry) {
+        const TimePoint deadline = m_retry_policy.AttemptDeadline(call_deadline);
+        std::chrono::nanoseconds hedge_delay;
+        std::chrono::milliseconds pushback(0);
+        const Status status = m_retry_policy.HedgeDelay(&hedge_delay)
+                                  ? HedgedAttempt(request, response, algorithm, deadline, hedge_delay, &pushback)
+                                  : Attempt(request, response, algorithm, deadline, &pushback);
+        if (status.ok() || ! RetryPolicy::IsRetryable(status) || (retry == max_retries)) {
+            return status;
+        }
+
+        // Don't sleep past the deadline only to find it has passed. The jitter on top of the server's
+        // pushback keeps the clients it refused together from retrying together.
+        const auto backoff = pushback + m_retry_policy.Backoff(retry);
+        if ((std::chrono::system_clock::now() + backoff >= call_deadline) || ! m_retry_policy.AllowRetry()) {
+            return status;
+        }
+        std::this_thread::sleep_for(backoff);
+    }
+}
+
+Status PutCaller::Attempt(const OffsetData& request, success_failure* response, grpc_compression_algorithm algorithm,
+                          TimePoint deadline, std::chrono::milliseconds* pushback)
+{
+    ClientContext context;
+    context.set_compression_algorithm(algorithm);
+    set_deadline(context, deadline);
+
+    const ChannelPool::Lease lease = m_channels.Acquire();
+    const auto start = std::chrono::steady_clock::now();
+    const Status status = m_stubs[lease.Index()]->Put(&context, request, response);
+    m_retry_policy.OnResult(status, std::chrono::steady_clock::now() - start);
+    *pushback = pushback_of(context);
+    return status;
+}
+
+Status PutCaller::HedgedAttempt(const OffsetData& request, success_failure* response, grpc_compression_algorithm algorithm,
+                                TimePoint deadline, std::chrono::nanoseconds hedge_delay, std::chrono::milliseconds* pushback)
+{
+    // The original call and its duplicate, each on the channel picked for it. Each one's address is its tag
+    // in the completion queue.
+    struct Leg {
+        std::optional<ChannelPool::Lease> lease;
+        ClientContext context;
+        success_failure response;
+        Status status;
+        std::unique_ptr< ClientAsyncResponseReader<success_failure> > reader;
+    };
+    Leg legs[2];
+    CompletionQueue cq;
+    size_t started = 0;
+    auto start_leg = [&]() {
+        Leg& leg = legs[started++];
+        leg.lease.emplace(m_channels.Acquire());
+        leg.context.set_compression_algorithm(algorithm);
+        set_deadline(leg.context, deadline);
+        leg.reader = m_stubs[leg.lease->Index()]->PrepareAsyncPut(&leg.context, request, &cq);
+        leg.reader->StartCall();
+        leg.reader->Finish(&leg.response, &leg.status, &leg);
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    start_leg();
+    void* tag = nullptr;
+    bool ok = false;
+    if (CompletionQueue::GOT_EVENT != cq.AsyncNext(&tag, &ok, std::chrono::system_clock::now() + hedge_delay)) {
+        if (m_retry_policy.AllowHedge()) {
+            start_leg();
+        }
+        cq.Next(&tag, &ok);
+    }
+    size_t completed = 1;
+    Leg* result = static_cast<Leg*>(tag);
+    m_retry_policy.OnResult(result->status, std::chrono::steady_clock::now() - start);
+
+    // If the first to complete failed, the other may still succeed
+    if (! result->status.ok() && (completed < started)) {
+        cq.Next(&tag, &ok);
+        ++completed;
+        result = static_cast<Leg*>(tag);
+        m_retry_policy.OnResult(result->status, std::chrono::steady_clock::now() - start);
+    }
+
+    // Cancel the call still in flight, and wait for it, since it refers to the queue and the legs
+    if (completed < started) {
+        for (size_t i = 0; i < started; ++i) {
+            legs[i].context.TryCancel();
+        }
+        cq.Next(&tag, &ok);
+    }
+    cq.Shutdown();
+    while (cq.Next(&tag, &ok)) {
+    }
+
+    if (result->status.ok() && (&legs[1] == result)) {
+        m_retry_policy.OnHedgeWon();
+    }
+    *pushback = pushback_of(result->context);
+    response->Swap(&result->response);
+    return result->status;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+#include <memory>
+
+#include <grpc++/support/status.h>
+
+#include "file_exchange.grpc.pb.h"
+#include "retry_policy.h"
+#include "compression_policy.h"
+#include "channel_pool.h"
+
+// PutCaller: Makes unary Put calls as a RetryPolicy says. Every attempt has a context of its own and a
+// deadline, and an attempt that fails in a way that may go away is retried after a backoff while the budget
+// allows. Once the policy knows how long calls usually take, an attempt that takes longer is hedged with a
+// duplicate, and whichever completes first is taken. Put writes its values at fixed offsets, so the
+// duplicate that loses does no harm if the server applies it too. Every attempt, and every duplicate,
+// goes over the channel that 'channels' picks for it. A server that refuses an attempt for lack of room may
+// ask for the retry to wait a while, in which case the backoff comes on top of that wait.
+//
+// The request is compressed as 'compression' decides, once for all its attempts. Put() may be called from
+// several threads concurrently.
+
+class PutCaller {
+public:
+    PutCaller(ChannelPool& channels, RetryPolicy& retry_policy, CompressionPolicy& compression);
+
+    PutCaller(const PutCaller&) = delete;
+    PutCaller& operator=(const PutCaller&) = delete;
+
+    grpc::Status Put(const fileexchange::OffsetData& request, fileexchange::success_failure* response);
+
+private:
+    using TimePoint = std::chrono::system_clock::time_point;
+
+    // The attempts set 'pushback' to the wait the server asked for before a retry, or to 0
+    grpc::Status Attempt(const fileexchange::OffsetData& request, fileexchange::success_failure* response,
+                         grpc_compression_algorithm algorithm, TimePoint deadline, std::chrono::milliseconds* pushback);
+
+    // Make an attempt asynchronously, and send a duplicate of it if it takes longer than 'hedge_delay'
+    grpc::Status HedgedAttempt(const fileexchange::OffsetData& request, fileexchange::success_failure* response,
+                               grpc_compression_algorithm algorithm, TimePoint deadline, std::chrono::nanoseconds hedge_delay,
+                               std::chrono::milliseconds* pushback);
+
+    ChannelPool& m_channels;
+    std::vector< std::unique_ptr<fileexchange::FileExchange::Stub> > m_stubs;
+    RetryPolicy& m_retry_policy;
+    CompressionPolicy& m_compression;
+};
@@ -0,0 +1,364 @@
+#include <future>
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+#include "put_pipeline.h"
+#include "retry_policy.h"
+
+using grpc::Status;
+using grpc::StatusCode;
+
+using fileexchange::OffsetData;
+using fileexchange::success_failure;
+
+namespace {
+
+    // The publishers, and the locks held while publishing requests that aren't logged, take the data file
+    // in stripes of this size
+    const unsigned stripe_shift = 16;
+
+    const size_t num_stripe_mutexes = 64;
+
+    // Call 'visit' with the number of every stripe that a value of 'size' bytes at 'offset' writes to, up to
+    // 'limit' of them
+    template <typename Visit>
+    void for_each_stripe(std::uint64_t offset, size_t size, size_t limit, const Visit& visit)
+    {
+        const std::uint64_t first_stripe = offset >> stripe_shift;
+        const std::uint64_t last_stripe = (0 == size) ? first_stripe : (offset + size - 1) >> stripe_shift;
+        for (std::uint64_t stripe = first_stripe; (stripe <= last_stripe) && (stripe - first_stripe < limit); ++stripe) {
+            visit(stripe);
+        }
+    }
+};  // Anonymous namespace
+
+PutPipeline::PutPipeline(std::unique_ptr<Journal> journal, std::unique_ptr<DataStore> store, ReadCache* cache, OffsetIndex* index,
+                         size_t publish_threads)
+    : m_journal(std::move(journal))
+    , m_store(std::move(store))
+    , m_cache(cache)
+    , m_index(index)
+    , m_admission(nullptr)
+    , m_replicator(nullptr)
+    , m_stripe_mutexes(new std::mutex[num_stripe_mutexes])
+    , m_logged(0)
+    , m_published(0)
+    , m_completing(false)
+{
+    if (! m_journal) {
+        return;
+    }
+    if (0 == publish_threads) {
+        publish_threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < publish_threads; ++i) {
+        m_publishers.emplace_back(new Publisher);
+    }
+    for (size_t i = 0; i < publish_threads; ++i) {
+        m_publishers[i]->thread = std::thread(&PutPipeline::Publish, this, i);
+    }
+}
+
+PutPipeline::~PutPipeline()
+{
+    // The journal calls back for the records it still holds before it's gone, and the publishers finish
+    // what they were handed before they stop
+    m_journal.reset();
+    for (auto& publisher : m_publishers) {
+        {
+            std::lock_guard<std::mutex> lock(publisher->mutex);
+            publisher->stopping = true;
+        }
+        publisher->queue_cv.notify_one();
+        publisher->thread.join();
+    }
+}
+
+void PutPipeline::Submit(const OffsetData& request, success_failure* response, Completion done)
+{
+    if (request.offsets_size() != request.values_size()) {
+        done(Status(StatusCode::INVALID_ARGUMENT, "The number of offsets and values differ."));
+        return;
+    }
+
+    // Hold the request's bytes against the budget until it completes, however it does
+    if (m_admission) {
+        const std::uint64_t bytes = request.ByteSizeLong();
+        if (! m_admission->TryAdmit(bytes)) {
+            done(Status(StatusCode::RESOURCE_EXHAUSTED, "The server has too much data in flight."));
+            return;
+        }
+        const auto admitted_at = std::chrono::steady_clock::now();
+        done = [this, bytes, admitted_at, done = std::move(done)](const Status& status) {
+            m_admission->Release(bytes, std::chrono::steady_clock::now() - admitted_at);
+            done(status);
+        };
+    }
+
+    Apply(request, response, std::move(done), true);
+}
+
+void PutPipeline::SubmitReplicated(const OffsetData& request, success_failure* response, Completion done)
+{
+    if (request.offsets_size() != request.values_size()) {
+        done(Status(StatusCode::INVALID_ARGUMENT, "The number of offsets and values differ."));
+        return;
+    }
+
+    Apply(request, response, std::move(done), false);
+}
+
+void PutPipeline::Apply(const OffsetData& request, success_failure* response, Completion done, bool replicate)
+{
+    // Refused before it's logged, since a logged record is applied again on replay
+    if (m_store && ! m_store->Fits(request)) {
+        done(Status(StatusCode::OUT_OF_RANGE, "The write goes past the end of the data file."));
+        return;
+    }
+
+    const auto entries = request.offsets_size();
+    response->set_queue_limit_bytes(QueueLimitBytes());
+    auto respond = [this, response, entries](const Status& status) {
+        if (status.ok()) {
+            response->set_id(entries);
+            response->set_queued_bytes(QueuedBytes());
+        }
+        return status;
+    };
+
+    if (! m_journal) {
+        done(respond(PublishUnlogged(request)));
+        return;
+    }
+
+    // The journal and the replicator call back in the order the records were logged, one at a time, so
+    // the publishers are handed them in that order too, the same order in which replaying the journal
+    // applies them. With a replicator, that's once a quorum has the record durable, so that a write the
+    // client is told failed isn't read back.
+    auto publication = std::make_shared<Publication>();
+    publication->request = &request;
+    publication->done = [respond, done](const Status& status) { done(respond(status)); };
+    publication->publishers = 0;
+    publication->err = 0;
+    publication->published = false;
+    {
+        std::lock_guard<std::mutex> lock(m_published_mutex);
+        ++m_logged;
+    }
+    Journal::CommitCallback committed = [this, publication](int err) {
+        std::unique_lock<std::mutex> lock(m_published_mutex);
+        m_publishing.push_back(publication);
+        if (0 == err) {
+            lock.unlock();
+            Dispatch(publication);
+            return;
+        }
+        std::cerr << "Failed to log a write: " << strerror(err) << std::endl;
+        publication->status = Status(StatusCode::INTERNAL, "Failed to log the write.");
+        publication->published = true;
+        Complete(lock);
+    };
+    if (m_replicator && replicate) {
+        m_replicator->AppendAsync(request, std::move(committed));
+    } else {
+        m_journal->AppendAsync(request, std::move(committed));
+    }
+}
+
+void PutPipeline::Dispatch(const std::shared_ptr<Publication>& publication)
+{
+    const OffsetData& request = *publication->request;
+    const size_t num_publishers = m_publishers.size();
+    std::vector<bool> involved(num_publishers, false);
+    size_t count = 0;
+    for (int i = 0; i < request.offsets_size(); ++i) {
+        for_each_stripe(request.offsets(i), request.values(i).size(), num_publishers, [&](std::uint64_t stripe) {
+            if (! involved[stripe % num_publishers]) {
+                involved[stripe % num_publishers] = true;
+                ++count;
+            }
+        });
+    }
+    if (0 == count) {
+        std::unique_lock<std::mutex> lock(m_published_mutex);
+        publication->published = true;
+        Complete(lock);
+        return;
+    }
+
+    publication->publishers = count;
+    for (size_t p = 0; p < num_publishers; ++p) {
+        if (involved[p]) {
+            Publisher& publisher = *m_publishers[p];
+            std::lock_guard<std::mutex> lock(publisher.mutex);
+            publisher.queue.push_back(publication);
+            publisher.queue_cv.notify_one();
+        }
+    }
+}
+
+void PutPipeline::Publish(size_t p)
+{
+    Publisher& publisher = *m_publishers[p];
+    OffsetData pieces;
+    std::unique_lock<std::mutex> lock(publisher.mutex);
+    while (true) {
+        publisher.queue_cv.wait(lock, [&] { return publisher.stopping || ! publisher.queue.empty(); });
+        if (publisher.queue.empty()) {
+            break;  // Stopping, and there's nothing left to publish
+        }
+        const std::shared_ptr<Publication> publication = std::move(publisher.queue.front());
+        publisher.queue.pop_front();
+        lock.unlock();
+
+        const int err = PublishStripes(*publication->request, p, &pieces);
+        if (0 != err) {
+            std::cerr << "Failed to write to " << m_store->GetFilePath() << ": " << strerror(err) << std::endl;
+            int expected = 0;
+            publication->err.compare_exchange_strong(expected, err);
+        }
+
+        // The last publisher of a request completes it
+        if (1 == publication->publishers.fetch_sub(1)) {
+            std::unique_lock<std::mutex> published_lock(m_published_mutex);
+            if (0 != publication->err) {
+                publication->status = Status(StatusCode::INTERNAL, "Failed to store the write.");
+            }
+            publication->published = true;
+            Complete(published_lock);
+        }
+        lock.lock();
+    }
+}
+
+int PutPipeline::PublishStripes(const OffsetData& request, size_t publisher, OffsetData* pieces)
+{
+    const size_t num_publishers = m_publishers.size();
+    if (m_store) {
+        // Most requests fall within a single stripe, and are written as they are
+        bool whole = true;
+        pieces->Clear();
+        for (int i = 0; whole && (i < request.offsets_size()); ++i) {
+            whole = DataStore::AddStripePieces(request.offsets(i), request.values(i), stripe_shift, publisher, num_publishers, pieces);
+        }
+        if (! whole) {
+            pieces->Clear();
+            for (int i = 0; i < request.offsets_size(); ++i) {
+                DataStore::AddStripePieces(request.offsets(i), request.values(i), stripe_shift, publisher, num_publishers, pieces);
+            }
+        }
+        if (whole || (pieces->offsets_size() > 0)) {
+            const int err = m_store->Apply(whole ? request : *pieces);
+            if (0 != err) {
+                return err;
+            }
+        }
+    }
+
+    // Cached after the data file is written, so that a Get that misses and reads the file can't put
+    // back an older value
+    for (int i = 0; i < request.offsets_size(); ++i) {
+        if (((request.offsets(i) >> stripe_shift) % num_publishers) != publisher) {
+            continue;
+        }
+        if (m_index) {
+            m_index->Insert(request.offsets(i), request.values(i).size());
+        }
+        if (m_cache) {
+            m_cache->Insert(request.offsets(i), request.values(i));
+        }
+    }
+    return 0;
+}
+
+Status PutPipeline::PublishUnlogged(const OffsetData& request)
+{
+    // Requests that write to the same stripes are published one at a time, so that the store, the index
+    // and the cache are left with the same value, and the others concurrently. The locks are taken in
+    // ascending order.
+    std::vector<size_t> stripes;
+    for (int i = 0; i < request.offsets_size(); ++i) {
+        for_each_stripe(request.offsets(i), request.values(i).size(), num_stripe_mutexes, [&](std::uint64_t stripe) {
+            stripes.push_back(stripe % num_stripe_mutexes);
+        });
+    }
+    std::sort(stripes.begin(), stripes.end());
+    stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+    std::vector< std::unique_lock<std::mutex> > locks;
+    for (const size_t stripe : stripes) {
+        locks.emplace_back(m_stripe_mutexes[stripe]);
+    }
+
+    if (m_store) {
+        const int err = m_store->Apply(request);
+        if (0 != err) {
+            std::cerr << "Failed to write to " << m_store->GetFilePath() << ": " << strerror(err) << std::endl;
+            return Status(StatusCode::INTERNAL, "Failed to store the write.");
+        }
+    }
+
+    if (m_index) {
+        m_index->Insert(request);
+    }
+
+    // Cached after the data file is written, so that a Get that misses and reads the file can't put
+    // back an older value
+    if (m_cache) {
+        for (int i = 0; i < request.offsets_size(); ++i) {
+            m_cache->Insert(request.offsets(i), request.values(i));
+        }
+    }
+    return Status::OK;
+}
+
+void PutPipeline::Complete(std::unique_lock<std::mutex>& lock)
+{
+    if (m_completing) {
+        return;     // The thread completing requests will see what changed before it stops
+    }
+    m_completing = true;
+
+    std::vector< std::shared_ptr<Publication> > ready;
+    while (true) {
+        ready.clear();
+        while (! m_publishing.empty() && m_publishing.front()->published) {
+            ready.push_back(std::move(m_publishing.front()));
+            m_publishing.pop_front();
+        }
+        if (ready.empty()) {
+            break;
+        }
+        m_published += ready.size();
+        m_published_cv.notify_all();
+
+        lock.unlock();
+        for (const auto& publication : ready) {
+            publication->done(publication->status);
+        }
+        lock.lock();
+    }
+    m_completing = false;
+}
+
+void PutPipeline::WaitForPublished()
+{
+    std::unique_lock<std::mutex> lock(m_published_mutex);
+    const std::uint64_t logged = m_logged;
+    m_published_cv.wait(lock, [this, logged] { return m_published >= logged; });
+}
+
+void PutPipeline::AddRetryPushback(grpc::ServerContext* context) const
+{
+    if (m_admission) {
+        context->AddTrailingMetadata(RetryPolicy::pushback_key, std::to_string(m_admission->RetryAfter().count()));
+    }
+}
+
+Status PutPipeline::Process(const OffsetData& request, success_failure* response)
+{
+    std::promise<Status> completed;
+    auto result = completed.get_future();
+    Submit(request, response, [&completed](const Status& status) { completed.set_value(status); });
+    return result.get();
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <atomic>
+
+#include <grpc++/support/status.h>
+#include <grpc++/server_context.h>
+
+#include "journal.h"
+#include "data_store.h"
+#include "read_cache.h"
+#include "offset_index.h"
+#include "admission_control.h"
+#include "replicator.h"
+#include "file_exchange.pb.h"
+
+// PutPipeline: The processing shared by every flavour of the Put RPC, independent of how the RPC is
+// served. A request is validated and logged to the journal if there is one. Once its record is durable,
+// it's written in place to the data store, recorded in the offset index and added to the read cache if
+// there are any, and then completed by calling back the caller, so that the serving thread never blocks
+// waiting for the journal's fsync.
+//
+// The data file is divided into stripes, dealt out in turn to 'publish_threads' publisher threads. The
+// journal hands over the records in the order they were logged, and each publisher applies the bytes that
+// fall into its stripes to the store, and the offsets that start in them to the index and the cache, in
+// that order too. Concurrent writes to the same bytes thus leave the value that was logged last, which is
+// what replaying the journal leaves too, while writes to different stripes are published in parallel, and
+// nothing can be read before it's durable. The requests then complete in the order they were logged.
+// Without a journal, a request is published on the submitting thread, holding the locks of the stripes it
+// writes to.
+//
+// With admission control, a request is only taken on if its bytes fit in the budget, and otherwise fails
+// with RESOURCE_EXHAUSTED. The bytes are held until the request completes.
+//
+// With a replicator, the journal record is shipped to the followers as well, and the request is only
+// published and completed once a quorum of replicas has it durable. A write that fails to reach a quorum
+// isn't published, though the primary still replays it from its journal if it restarts before the
+// segment holding it is checkpointed.
+
+class PutPipeline {
+public:
+    // Called with the final status of a request. It may be called on the journal's flusher thread or on a
+    // publisher, so it should return quickly.
+    using Completion = std::function<void(const grpc::Status&)>;
+
+    // 'journal' may be null, in which case writes are acknowledged without being logged. 'store' may be
+    // null, in which case the journal is the only place writes are kept. 'cache' and 'index' may be
+    // null, and otherwise must outlive the pipeline. 'publish_threads' is the number of publishers with a
+    // journal, or one per core if it is 0.
+    PutPipeline(std::unique_ptr<Journal> journal, std::unique_ptr<DataStore> store, ReadCache* cache, OffsetIndex* index,
+                size_t publish_threads);
+
+    // Waits for the records the journal still holds to be published
+    ~PutPipeline();
+
+    PutPipeline(const PutPipeline&) = delete;
+    PutPipeline& operator=(const PutPipeline&) = delete;
+
+    // Process 'request' and call 'done' when it completes. 'request' and 'response' must remain valid
+    // until then. The response is filled in before 'done' is called with an OK status. A request that is
+    // refused, because it's invalid, doesn't fit in the budget or goes past the end of the data store,
+    // completes at once; with a journal, the others complete in the order they were logged.
+    void Submit(const fileexchange::OffsetData& request, fileexchange::success_failure* response, Completion done);
+
+    // As Submit, for a record shipped by the primary to this server as a follower: it is neither admitted
+    // nor replicated any further.
+    void SubmitReplicated(const fileexchange::OffsetData& request, fileexchange::success_failure* response, Completion done);
+
+    // Process 'request', blocking until it completes.
+    grpc::Status Process(const fileexchange::OffsetData& request, fileexchange::success_failure* response);
+
+    // 'admission' may be null, in which case every request is taken on, and otherwise must outlive the
+    // pipeline. Set it before submitting any request.
+    void SetAdmissionControl(AdmissionControl* admission)
+    {
+        m_admission = admission;
+    }
+
+    // 'replicator' may be null, in which case records are only logged to the journal, and otherwise must
+    // wrap the pipeline's journal and be destroyed after the last request completes. Set it before
+    // submitting any request.
+    void SetReplicator(Replicator* replicator)
+    {
+        m_replicator = replicator;
+    }
+
+    // The bytes of the requests in flight, and the most admitted at once, or 0 if there is no limit
+    std::uint64_t QueuedBytes() const
+    {
+        return m_admission ? m_admission->InFlightBytes() : 0;
+    }
+    std::uint64_t QueueLimitBytes() const
+    {
+        return m_admission ? m_admission->GetMaxBytes() : 0;
+    }
+
+    // Tell the client of a request refused for lack of room when to retry, in the call's trailing metadata
+    void AddRetryPushback(grpc::ServerContext* context) const;
+
+    // Block until every request handed to the journal before the call has been published, or has failed
+    void WaitForPublished();
+
+private:
+    // A logged request on its way to the store, the index and the cache
+    struct Publication {
+        const fileexchange::OffsetData* request;
+        Completion done;
+        std::atomic<size_t> publishers;     // That have yet to apply their share of it
+        std::atomic<int> err;               // The first error the store returned for it
+        grpc::Status status;
+        bool published;                     // Or failed
+    };
+
+    struct Publisher {
+        std::mutex mutex;
+        std::condition_variable queue_cv;
+        std::deque< std::shared_ptr<Publication> > queue;
+        bool stopping = false;
+        std::thread thread;
+    };
+
+    void Apply(const fileexchange::OffsetData& request, fileexchange::success_failure* response, Completion done, bool replicate);
+
+    // Hand a request that was just logged over to the publishers of its stripes
+    void Dispatch(const std::shared_ptr<Publication>& publication);
+
+    // Apply the records handed over to publisher 'publisher', in the order they were logged
+    void Publish(size_t publisher);
+
+    // Write the bytes of 'request' that fall into the stripes of publisher 'publisher' to the store, and the
+    // offsets that start in them to the index and the cache. Returns 0 or the store's errno value.
+    int PublishStripes(const fileexchange::OffsetData& request, size_t publisher, fileexchange::OffsetData* pieces);
+
+    // Write a request that isn't logged to the store, the index and the cache
+    grpc::Status PublishUnlogged(const fileexchange::OffsetData& request);
+
+    // Complete the requests that are published, up to the first one that isn't. Called with
+    // m_published_mutex held; only one thread completes requests at a time, in order.
+    void Complete(std::unique_lock<std::mutex>& lock);
+
+    std::unique_ptr<Journal> m_journal;
+    std::unique_ptr<DataStore> m_store;
+    ReadCache* m_cache;
+    OffsetIndex* m_index;
+    AdmissionControl* m_admission;
+    Replicator* m_replicator;
+
+    std::vector< std::unique_ptr<Publisher> > m_publishers;
+
+    // Held while publishing a request that isn't logged, by the stripes it writes to
+    std::unique_ptr<std::mutex[]> m_stripe_mutexes;
+
+    // The requests handed to the journal, the ones that were logged and are being published, and how many
+    // have been published or have failed. They are published or fail in the order they were logged, so
+    // those are always the first ones.
+    std::mutex m_published_mutex;
+    std::condition_variable m_published_cv;
+    std::uint64_t m_logged;
+    std::deque< std::shared_ptr<Publication> > m_publishing;
+    std::uint64_t m_published;
+    bool m_completing;
+};
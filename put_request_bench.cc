@@ -0,0 +1,88 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+
+#include "request_arena.h"
+#include "alloc_counter.h"
+
+// Compares building Put requests the way FileExchangeClient::Put used to, with a fresh message and copies
+// of every value, against building them in a reused RequestArena. Reports the time and the number of
+// allocations per request.
+
+using fileexchange::OffsetData;
+
+namespace {
+
+    const size_t iterations = 200000;
+
+    // Defeat the optimiser
+    volatile std::uint64_t sink;
+
+    void build_fresh(const std::vector<unsigned long long>& offsets, const std::vector<std::string>& values)
+    {
+        OffsetData request;
+        for (unsigned long long offset : offsets) {
+            request.add_offsets(offset);
+        }
+        for (std::string value : values) {
+            request.add_values(value);
+        }
+        sink = request.ByteSizeLong();
+    }
+
+    void build_in_arena(const std::vector<unsigned long long>& offsets, const std::vector<std::string_view>& values)
+    {
+        OffsetData& request = RequestArena::ForThisThread().NewRequest();
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            RequestArena::AddWrite(request, offsets[i], values[i]);
+        }
+        sink = request.ByteSizeLong();
+    }
+
+    template <class Build>
+    void measure(const char* name, size_t entries, size_t value_size, Build build)
+    {
+        build();    // Warm up, so that reused storage has grown to size
+        const std::uint64_t allocations_before = allocations_on_this_thread();
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            build();
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        const std::uint64_t allocations = allocations_on_this_thread() - allocations_before;
+
+        std::cout << std::setw(8) << name
+                  << std::setw(9) << entries
+                  << std::setw(12) << value_size
+                  << std::setw(14) << std::chrono::duration<double, std::nano>(elapsed).count() / iterations
+                  << std::setw(16) << static_cast<double>(allocations) / iterations << std::endl;
+    }
+};  // Anonymous namespace
+
+int main()
+{
+    std::cout << std::fixed << std::setprecision(2);
+    std::cout << "    mode  entries  value_size  ns/request  allocs/request" << std::endl;
+    for (size_t entries : { 1, 16 }) {
+        for (size_t value_size : { 8, 64, 1024 }) {
+            std::vector<unsigned long long> offsets;
+            std::vector<std::string> values;
+            std::vector<std::string_view> value_views;
+            for (size_t i = 0; i < entries; ++i) {
+                offsets.push_back((1ULL << 40) + i);
+                values.emplace_back(value_size, 'v');
+            }
+            for (const std::string& value : values) {
+                value_views.emplace_back(value);
+            }
+
+            measure("fresh", entries, value_size, [&] { build_fresh(offsets, values); });
+            measure("arena", entries, value_size, [&] { build_in_arena(offsets, value_views); });
+        }
+    }
+    return 0;
+}
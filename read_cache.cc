@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <mutex>
+
+#include "read_cache.h"
+
+namespace {
+
+    // Bytes charged to every entry on top of its value, for the entry itself and its index node
+    const size_t entry_overhead = 96;
+
+    // Spread consecutive offsets over all the shards (the finaliser of SplitMix64)
+    std::uint64_t mix(std::uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+};  // Anonymous namespace
+
+ReadCache::ReadCache(size_t capacity, size_t num_shards)
+    : m_capacity(capacity)
+    , m_num_shards(std::max<size_t>(1, num_shards))
+    , m_shard_capacity(capacity / m_num_shards)
+    , m_shards(new Shard[m_num_shards])
+{
+}
+
+ReadCache::Shard& ReadCache::ShardOf(std::uint64_t offset) const
+{
+    return m_shards[mix(offset) % m_num_shards];
+}
+
+bool ReadCache::Lookup(std::uint64_t offset, std::string* value) const
+{
+    Shard& shard = ShardOf(offset);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    const auto found = shard.index.find(offset);
+    if (shard.index.end() == found) {
+        shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    Entry& entry = shard.entries[found->second];
+    // Avoid dirtying the cache line when the bit is already set, which is the case for hot entries
+    if (! entry.referenced.load(std::memory_order_relaxed)) {
+        entry.referenced.store(true, std::memory_order_relaxed);
+    }
+    value->assign(entry.value);
+    shard.hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void ReadCache::Insert(std::uint64_t offset, std::string_view value)
+{
+    Store(offset, value, true);
+}
+
+void ReadCache::Fill(std::uint64_t offset, std::string_view value)
+{
+    Store(offset, value, false);
+}
+
+void ReadCache::Store(std::uint64_t offset, std::string_view value, bool replace)
+{
+    Shard& shard = ShardOf(offset);
+    const size_t charge = value.size() + entry_overhead;
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+
+    const auto found = shard.index.find(offset);
+    if ((shard.index.end() != found) && ! replace) {
+        return;
+    }
+    if (shard.index.end() != found) {
+        // Replace the value in place. The entry keeps its position in the clock, as it would if it was read.
+        const size_t position = found->second;
+        Entry& entry = shard.entries[position];
+        shard.size -= entry.value.size() + entry_overhead;
+        if (charge > m_shard_capacity) {
+            shard.index.erase(found);
+            std::string().swap(entry.value);
+            entry.used = false;
+            shard.free_entries.push_back(position);
+            return;
+        }
+        entry.value.assign(value.data(), value.size());
+        entry.referenced.store(true, std::memory_order_relaxed);
+        shard.size += charge;
+        MakeRoom(shard, 0);
+        return;
+    }
+
+    if (charge > m_shard_capacity) {
+        return;
+    }
+    MakeRoom(shard, charge);
+
+    size_t position;
+    if (shard.free_entries.empty()) {
+        position = shard.entries.size();
+        shard.entries.emplace_back();
+    }
+    else {
+        position = shard.free_entries.back();
+        shard.free_entries.pop_back();
+    }
+
+    // New entries start unreferenced, so that values written once and never read go first
+    Entry& entry = shard.entries[position];
+    entry.offset = offset;
+    entry.value.assign(value.data(), value.size());
+    entry.referenced.store(false, std::memory_order_relaxed);
+    entry.used = true;
+    shard.index.emplace(offset, position);
+    shard.size += charge;
+}
+
+void ReadCache::MakeRoom(Shard& shard, size_t needed)
+{
+    while ((shard.size + needed > m_shard_capacity) && ! shard.index.empty()) {
+        if (shard.hand >= shard.entries.size()) {
+            shard.hand = 0;
+        }
+        Entry& entry = shard.entries[shard.hand];
+        if (entry.used) {
+            if (entry.referenced.load(std::memory_order_relaxed)) {
+                entry.referenced.store(false, std::memory_order_relaxed);
+            }
+            else {
+                shard.index.erase(entry.offset);
+                shard.size -= entry.value.size() + entry_overhead;
+                std::string().swap(entry.value);
+                entry.used = false;
+                shard.free_entries.push_back(shard.hand);
+            }
+        }
+        ++shard.hand;
+    }
+}
+
+std::uint64_t ReadCache::Hits() const
+{
+    std::uint64_t hits = 0;
+    for (size_t i = 0; i < m_num_shards; ++i) {
+        hits += m_shards[i].hits.load(std::memory_order_relaxed);
+    }
+    return hits;
+}
+
+std::uint64_t ReadCache::Misses() const
+{
+    std::uint64_t misses = 0;
+    for (size_t i = 0; i < m_num_shards; ++i) {
+        misses += m_shards[i].misses.load(std::memory_order_relaxed);
+    }
+    return misses;
+}
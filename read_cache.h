@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+
+// ReadCache: The values most recently written at each offset, bounded to 'capacity' bytes in total.
+// Offsets are spread over 'num_shards' shards, each with its own lock and its own share of the capacity.
+//
+// Eviction follows the CLOCK algorithm: a hit only sets the entry's reference bit, and the clock hand
+// skips over referenced entries, clearing the bit, until it finds one that wasn't used since its last
+// pass. Since a hit modifies nothing but that atomic bit, lookups only take the shard lock in shared
+// mode, and concurrent hits never wait for each other.
+//
+// An entry is the exact value last inserted at its offset. Writes at other offsets that overlap it are
+// not reflected, so readers must address values by the offsets they were written at.
+
+class ReadCache {
+public:
+    ReadCache(size_t capacity, size_t num_shards);
+
+    ReadCache(const ReadCache&) = delete;
+    ReadCache& operator=(const ReadCache&) = delete;
+
+    // Copy the value cached for 'offset' into 'value'. Returns false on a miss.
+    bool Lookup(std::uint64_t offset, std::string* value) const;
+
+    // Cache 'value' as the value at 'offset', replacing any previous one. Values larger than a shard's
+    // capacity are not cached.
+    void Insert(std::uint64_t offset, std::string_view value);
+
+    // Cache 'value', read from the data file, unless a value was inserted at 'offset' in the meantime.
+    // This keeps a read that raced with a write from replacing the newer value.
+    void Fill(std::uint64_t offset, std::string_view value);
+
+    size_t GetCapacity() const
+    {
+        return m_capacity;
+    }
+
+    std::uint64_t Hits() const;
+    std::uint64_t Misses() const;
+
+private:
+    struct Entry {
+        std::uint64_t offset = 0;
+        std::string value;
+        std::atomic<bool> referenced{false};
+        bool used = false;
+    };
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<std::uint64_t, size_t> index;   // Offset to position in 'entries'
+        std::deque<Entry> entries;
+        std::vector<size_t> free_entries;
+        size_t hand = 0;
+        size_t size = 0;    // Bytes accounted for by the entries in use
+        mutable std::atomic<std::uint64_t> hits{0};
+        mutable std::atomic<std::uint64_t> misses{0};
+    };
+
+    Shard& ShardOf(std::uint64_t offset) const;
+
+    void Store(std::uint64_t offset, std::string_view value, bool replace);
+
+    // Evict entries until 'needed' more bytes fit in the shard. Called with the shard locked exclusively.
+    void MakeRoom(Shard& shard, size_t needed);
+
+    const size_t m_capacity;
+    const size_t m_num_shards;
+    const size_t m_shard_capacity;
+    std::unique_ptr<Shard[]> m_shards;
+};
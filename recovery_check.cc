@@ -0,0 +1,200 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#include <unistd.h>
+#include <sysexits.h>
+
+#include "journal.h"
+#include "checkpoint.h"
+#include "data_store.h"
+#include "offset_index.h"
+#include "put_pipeline.h"
+#include "fast_random.h"
+#include "utils.h"
+
+// Checks that a restart leaves the data file and the offset index as they were before it. Several threads
+// Put values of random lengths to the same few offsets at once, through a PutPipeline with a group-commit
+// journal and several publishers, while checkpoints are taken. Once they are done, the data file and the index are saved, and the
+// server's recovery is run on the same files: it loads the last checkpoint and replays the journal after
+// it over the data file. Any write that reached the data file in a different order than the journal's
+// shows up as a difference. Exits with 1 if there is one.
+//
+// Usage: recovery_check [-e engine] [-t threads] [-n puts_per_thread] [-o offsets] [-p publishers]
+
+namespace {
+
+    const std::uint64_t slot_size = 256;
+    const size_t values_per_put = 4;
+
+    struct Options {
+        std::string engine = "pwrite";
+        size_t threads = 8;
+        size_t puts_per_thread = 2000;
+        size_t offsets = 16;
+        size_t publishers = 4;
+    };
+
+    std::string read_file(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::ostringstream contents;
+        if (! (file && (contents << file.rdbuf()))) {
+            throw std::runtime_error("Failed to read " + path + '.');
+        }
+        return contents.str();
+    }
+
+    std::map<std::uint64_t, std::uint32_t> index_contents(const OffsetIndex& index)
+    {
+        std::map<std::uint64_t, std::uint32_t> contents;
+        for (size_t s = 0; s < index.NumSegments(); ++s) {
+            index.ForEach(s, [&contents](std::uint64_t offset, std::uint32_t length) { contents[offset] = length; });
+        }
+        return contents;
+    }
+
+    // Put from several threads at once to the same offsets, taking checkpoints meanwhile. Returns the number
+    // of checkpoints taken.
+    size_t put_concurrently(const Options& options, const std::string& data_path, const std::string& journal_path, OffsetIndex& index)
+    {
+        std::unique_ptr<DataStore> store = DataStore::Create(options.engine, data_path, options.offsets * slot_size);
+        DataStore& store_ref = *store;
+        std::unique_ptr<Journal> journal(new Journal(journal_path, 64, std::chrono::microseconds(100)));
+        Journal& journal_ref = *journal;
+        PutPipeline pipeline(std::move(journal), std::move(store), nullptr, &index, options.publishers);
+
+        std::atomic<size_t> done(0);
+        std::atomic<size_t> failed(0);
+        std::vector<std::thread> writers;
+        for (size_t t = 0; t < options.threads; ++t) {
+            writers.emplace_back([&options, &pipeline, &done, &failed, t] {
+                FastRandom& random = FastRandom::ForThisThread();
+                fileexchange::OffsetData request;
+                fileexchange::success_failure response;
+                for (size_t i = 0; i < options.puts_per_thread; ++i) {
+                    request.Clear();
+                    for (size_t v = 0; v < values_per_put; ++v) {
+                        request.add_offsets(random.Below(options.offsets) * slot_size);
+                        request.add_values(std::string(1 + random.Below(slot_size), static_cast<char>('a' + (t + i + v) % 26)));
+                    }
+                    if (! pipeline.Process(request, &response).ok()) {
+                        ++failed;
+                    }
+                    ++done;
+                }
+            });
+        }
+
+        // Checkpoints are taken while the first half of the Puts are made, so that some of them catch writes
+        // in flight, and the second half is left for recovery to replay
+        size_t checkpoints = 0;
+        {
+            Checkpointer checkpointer(pipeline, journal_ref, store_ref, index, UINT64_MAX);
+            while (done < options.threads * options.puts_per_thread / 2) {
+                checkpointer.Checkpoint();
+                ++checkpoints;
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+
+        const int err = store_ref.Sync();
+        if (0 != err) {
+            raise_from_system_error_code("Failed to sync " + data_path + '.', err);
+        }
+        if (failed > 0) {
+            throw std::runtime_error(std::to_string(failed) + " Puts failed.");
+        }
+        return checkpoints;
+    }
+
+    void usage [[noreturn]] (const char* prog_name)
+    {
+        std::cerr << "USAGE: " << prog_name << " [-e engine] [-t threads] [-n puts_per_thread] [-o offsets] [-p publishers]"
+                  << std::endl;
+        std::exit(EX_USAGE);
+    }
+};  // Anonymous namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    int opt;
+    while (-1 != (opt = getopt(argc, argv, "e:t:n:o:p:"))) {
+        switch (opt) {
+        case 'e': options.engine = optarg; break;
+        case 't': options.threads = std::strtoul(optarg, nullptr, 10); break;
+        case 'n': options.puts_per_thread = std::strtoul(optarg, nullptr, 10); break;
+        case 'o': options.offsets = std::strtoul(optarg, nullptr, 10); break;
+        case 'p': options.publishers = std::strtoul(optarg, nullptr, 10); break;
+        default: usage(argv[0]);
+        }
+    }
+    if ((0 == options.threads) || (0 == options.offsets)) {
+        usage(argv[0]);
+    }
+
+    std::string directory = "recovery_check.XXXXXX";
+    if (nullptr == mkdtemp(&directory[0])) {
+        std::cerr << "Failed to create a scratch directory: " << strerror(errno) << std::endl;
+        return EX_CANTCREAT;
+    }
+    const std::string data_path = directory + "/data.bin";
+    const std::string journal_path = directory + "/journal.log";
+
+    bool same = false;
+    try {
+        OffsetIndex index(options.offsets, 16);
+        const size_t checkpoints = put_concurrently(options, data_path, journal_path, index);
+        const std::string data = read_file(data_path);
+        const auto offsets = index_contents(index);
+
+        OffsetIndex recovered_index(options.offsets, 16);
+        std::unique_ptr<DataStore> store = DataStore::Create(options.engine, data_path, options.offsets * slot_size);
+        const Checkpointer::Recovery recovery = Checkpointer::Recover(journal_path, *store, recovered_index, 0);
+        store->Sync();
+        store.reset();
+
+        const std::string recovered_data = read_file(data_path);
+        const auto recovered_offsets = index_contents(recovered_index);
+        same = (recovered_data == data) && (recovered_offsets == offsets);
+
+        std::cout << options.threads * options.puts_per_thread << " Puts to " << options.offsets << " offsets, "
+                  << checkpoints << " checkpoints taken, " << recovery.records << " records replayed" << std::endl;
+        if (recovered_data != data) {
+            size_t i = 0;
+            while ((i < data.size()) && (i < recovered_data.size()) && (recovered_data[i] == data[i])) {
+                ++i;
+            }
+            std::cout << "The data file differs after recovery from byte " << i << std::endl;
+        }
+        if (recovered_offsets != offsets) {
+            std::cout << "The index differs after recovery" << std::endl;
+        }
+        std::cout << (same ? "The data file and the index are the same after recovery" : "FAILED") << std::endl;
+    }
+    catch (const std::exception& ex) {
+        std::cerr << ex.what() << std::endl;
+    }
+
+    const std::string remove = "rm -rf '" + directory + "'";
+    if (0 != std::system(remove.c_str())) {
+        std::cerr << "Failed to remove " << directory << std::endl;
+    }
+    return same ? 0 : 1;
+}
@@ -0,0 +1,150 @@
+#include <fstream>
+#include <iomanip>
+#include <algorithm>
+
+#include "replay_stats.h"
+
+namespace {
+
+    const double percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+    const char* const percentile_names[] = { "p50", "p90", "p99", "p99.9" };
+
+    double to_us(std::uint64_t ns)
+    {
+        return ns / 1000.0;
+    }
+
+    void open_for_writing(std::ofstream& ofs, const std::string& path)
+    {
+        ofs.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+        ofs.open(path, std::ios_base::out | std::ios_base::trunc);
+    }
+};  // Anonymous namespace
+
+ReplayStats::ReplayStats(std::chrono::milliseconds interval, size_t max_intervals)
+    : m_start(std::chrono::steady_clock::now())
+    , m_stop(m_start)
+    , m_interval(std::max(interval, std::chrono::milliseconds(1)))
+    , m_max_intervals(std::max<size_t>(max_intervals, 1))
+    , m_intervals(new Interval[m_max_intervals]())
+    , m_last_interval(0)
+    , m_ops(0)
+    , m_bytes(0)
+    , m_failures(0)
+{
+}
+
+void ReplayStats::Record(std::chrono::nanoseconds latency, std::uint64_t ops, std::uint64_t bytes, bool ok)
+{
+    const std::uint64_t latency_ns = latency.count();
+    m_latencies.Record(latency_ns);
+    m_ops.fetch_add(ops, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    if (! ok) {
+        m_failures.fetch_add(ops, std::memory_order_relaxed);
+    }
+
+    const auto since_start = std::chrono::steady_clock::now() - m_start;
+    const size_t index = std::min<size_t>(since_start / m_interval, m_max_intervals - 1);
+    Interval& interval = m_intervals[index];
+    interval.requests.fetch_add(1, std::memory_order_relaxed);
+    interval.ops.fetch_add(ops, std::memory_order_relaxed);
+    interval.bytes.fetch_add(bytes, std::memory_order_relaxed);
+    interval.latency_sum_ns.fetch_add(latency_ns, std::memory_order_relaxed);
+
+    std::uint64_t max = interval.latency_max_ns.load(std::memory_order_relaxed);
+    while ((latency_ns > max) && ! interval.latency_max_ns.compare_exchange_weak(max, latency_ns, std::memory_order_relaxed)) {
+    }
+
+    size_t last = m_last_interval.load(std::memory_order_relaxed);
+    while ((index > last) && ! m_last_interval.compare_exchange_weak(last, index, std::memory_order_relaxed)) {
+    }
+}
+
+void ReplayStats::Stop()
+{
+    m_stop = std::chrono::steady_clock::now();
+}
+
+double ReplayStats::ElapsedSeconds() const
+{
+    return std::chrono::duration<double>(m_stop - m_start).count();
+}
+
+size_t ReplayStats::UsedIntervals() const
+{
+    return m_last_interval.load(std::memory_order_relaxed) + 1;
+}
+
+void ReplayStats::PrintSummary(std::ostream& os) const
+{
+    const double elapsed = ElapsedSeconds();
+    const std::uint64_t ops = m_ops.load(std::memory_order_relaxed);
+    const std::uint64_t bytes = m_bytes.load(std::memory_order_relaxed);
+
+    os << "Total Operations: " << ops << " in " << m_latencies.Count() << " requests, "
+       << m_failures.load(std::memory_order_relaxed) << " failed" << std::endl;
+    os << "Elapsed time: " << elapsed << " seconds" << std::endl;
+    if (elapsed > 0) {
+        os << "Throughput: " << ops / elapsed << " ops/sec, " << bytes / elapsed << " bytes/sec" << std::endl;
+    }
+
+    os << "Request latency (microseconds): mean " << to_us(m_latencies.Mean());
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+        os << ", " << percentile_names[i] << ' ' << to_us(m_latencies.Percentile(percentiles[i]));
+    }
+    os << ", max " << to_us(m_latencies.Max()) << std::endl;
+}
+
+void ReplayStats::WriteJson(const std::string& path) const
+{
+    std::ofstream ofs;
+    open_for_writing(ofs, path);
+
+    const double elapsed = ElapsedSeconds();
+    const std::uint64_t ops = m_ops.load(std::memory_order_relaxed);
+    const std::uint64_t bytes = m_bytes.load(std::memory_order_relaxed);
+
+    ofs << std::setprecision(12);
+    ofs << "{\n";
+    ofs << "    \"elapsed_s\": " << elapsed << ",\n";
+    ofs << "    \"requests\": " << m_latencies.Count() << ",\n";
+    ofs << "    \"ops\": " << ops << ",\n";
+    ofs << "    \"bytes\": " << bytes << ",\n";
+    ofs << "    \"failed_ops\": " << m_failures.load(std::memory_order_relaxed) << ",\n";
+    ofs << "    \"ops_per_s\": " << (elapsed > 0 ? ops / elapsed : 0.0) << ",\n";
+    ofs << "    \"bytes_per_s\": " << (elapsed > 0 ? bytes / elapsed : 0.0) << ",\n";
+    ofs << "    \"latency_us\": {\n";
+    ofs << "        \"mean\": " << to_us(m_latencies.Mean()) << ",\n";
+    for (size_t i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); ++i) {
+        ofs << "        \"" << percentile_names[i] << "\": " << to_us(m_latencies.Percentile(percentiles[i])) << ",\n";
+    }
+    ofs << "        \"max\": " << to_us(m_latencies.Max()) << "\n";
+    ofs << "    },\n";
+    ofs << "    \"interval_ms\": " << m_interval.count() << "\n";
+    ofs << "}\n";
+}
+
+void ReplayStats::WriteTimelineCsv(const std::string& path) const
+{
+    std::ofstream ofs;
+    open_for_writing(ofs, path);
+
+    const double interval_s = std::chrono::duration<double>(m_interval).count();
+    ofs << "interval_start_s,requests,ops,ops_per_s,bytes_per_s,mean_latency_us,max_latency_us\n";
+    for (size_t i = 0; i < UsedIntervals(); ++i) {
+        const Interval& interval = m_intervals[i];
+        const std::uint64_t requests = interval.requests.load(std::memory_order_relaxed);
+        const std::uint64_t ops = interval.ops.load(std::memory_order_relaxed);
+        const std::uint64_t bytes = interval.bytes.load(std::memory_order_relaxed);
+        const std::uint64_t latency_sum = interval.latency_sum_ns.load(std::memory_order_relaxed);
+
+        ofs << i * interval_s << ','
+            << requests << ','
+            << ops << ','
+            << ops / interval_s << ','
+            << bytes / interval_s << ','
+            << (requests > 0 ? to_us(latency_sum) / requests : 0.0) << ','
+            << to_us(interval.latency_max_ns.load(std::memory_order_relaxed)) << '\n';
+    }
+}
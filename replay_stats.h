@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <chrono>
+#include <atomic>
+#include <memory>
+#include <ostream>
+
+#include "latency_histogram.h"
+
+// ReplayStats: What the replay driver measures. Every completed request is recorded into a latency
+// histogram and into a timeline of fixed-length intervals, so that stalls such as fsync storms stand out
+// instead of being averaged away. Like the histogram, Record() is lock-free and may be called from any
+// thread.
+//
+// The timeline has room for 'max_intervals' intervals. Whatever completes after that is accounted to the
+// last one.
+
+class ReplayStats {
+public:
+    ReplayStats(std::chrono::milliseconds interval, size_t max_intervals);
+
+    ReplayStats(const ReplayStats&) = delete;
+    ReplayStats& operator=(const ReplayStats&) = delete;
+
+    // Record a request of 'ops' writes and 'bytes' bytes of values which completed just now.
+    void Record(std::chrono::nanoseconds latency, std::uint64_t ops, std::uint64_t bytes, bool ok = true);
+
+    // Mark the end of the run. The rates are computed over the time from construction until then.
+    void Stop();
+
+    void PrintSummary(std::ostream& os) const;
+
+    // Write the summary as a JSON object. Throws std::system_error on failure.
+    void WriteJson(const std::string& path) const;
+
+    // Write the timeline as CSV, one line per interval. Throws std::system_error on failure.
+    void WriteTimelineCsv(const std::string& path) const;
+
+private:
+    struct Interval {
+        std::atomic<std::uint64_t> requests;
+        std::atomic<std::uint64_t> ops;
+        std::atomic<std::uint64_t> bytes;
+        std::atomic<std::uint64_t> latency_sum_ns;
+        std::atomic<std::uint64_t> latency_max_ns;
+    };
+
+    double ElapsedSeconds() const;
+    size_t UsedIntervals() const;
+
+    const std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::time_point m_stop;
+    const std::chrono::milliseconds m_interval;
+    const size_t m_max_intervals;
+    std::unique_ptr<Interval[]> m_intervals;
+    std::atomic<size_t> m_last_interval;
+
+    LatencyHistogram m_latencies;
+    std::atomic<std::uint64_t> m_ops;
+    std::atomic<std::uint64_t> m_bytes;
+    std::atomic<std::uint64_t> m_failures;
+};
@@ -0,0 +1,270 @@
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+#include <errno.h>
+
+#include <grpc++/create_channel.h>
+#include <grpc++/security/credentials.h>
+
+#include "replicator.h"
+
+using grpc::Status;
+
+using fileexchange::OffsetData;
+using fileexchange::ReplicationAck;
+using fileexchange::ReplicationBatch;
+
+namespace {
+
+    const std::chrono::milliseconds connect_step(100);
+};  // Anonymous namespace
+
+Replicator::Replicator(Journal& journal, const std::vector<std::string>& followers, size_t quorum, size_t max_batch_bytes,
+                       std::chrono::milliseconds connect_timeout)
+    : m_journal(journal)
+    , m_quorum(quorum)
+    , m_max_batch_bytes(max_batch_bytes)
+    , m_connect_timeout(connect_timeout)
+    , m_next_sequence(0)
+    , m_durable(followers.size() + 1, 0)
+    , m_failed(followers.size() + 1, false)
+    , m_logged(0)
+    , m_journal_error(0)
+    , m_completing(false)
+    , m_stopping(false)
+{
+    if ((0 == quorum) || (quorum > followers.size() + 1)) {
+        throw std::invalid_argument("The replication quorum must be between 1 and " + std::to_string(followers.size() + 1) +
+                                    ", the number of replicas.");
+    }
+
+    for (const std::string& address : followers) {
+        std::unique_ptr<Follower> follower(new Follower);
+        follower->address = address;
+        follower->channel = grpc::CreateChannel(address, grpc::InsecureChannelCredentials());
+        follower->stub = fileexchange::Replication::NewStub(follower->channel);
+        m_followers.push_back(std::move(follower));
+    }
+    for (size_t i = 0; i < m_followers.size(); ++i) {
+        m_followers[i]->thread = std::thread(&Replicator::Send, this, i + 1);
+    }
+}
+
+Replicator::~Replicator()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopping = true;
+        for (auto& follower : m_followers) {
+            follower->queue_cv.notify_one();
+        }
+    }
+    for (auto& follower : m_followers) {
+        follower->context.TryCancel();
+        follower->thread.join();
+    }
+}
+
+void Replicator::AppendAsync(const OffsetData& record, Journal::CommitCallback done)
+{
+    const std::shared_ptr<const OffsetData> shipped = m_followers.empty() ? nullptr : std::make_shared<const OffsetData>(record);
+
+    std::lock_guard<std::mutex> append_lock(m_append_mutex);
+    std::uint64_t sequence;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        sequence = ++m_next_sequence;
+        m_pending.push_back({ sequence, std::move(done), 0 });
+        for (size_t i = 0; i < m_followers.size(); ++i) {
+            if (! m_failed[i + 1]) {
+                m_followers[i]->queue.emplace_back(sequence, shipped);
+                m_followers[i]->queue_cv.notify_one();
+            }
+        }
+    }
+
+    m_journal.AppendAsync(record, [this, sequence](int err) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_logged = sequence;
+        if (0 == err) {
+            m_durable[0] = sequence;
+        }
+        else if (! m_failed[0]) {
+            m_failed[0] = true;
+            m_journal_error = err;
+        }
+        Complete(lock);
+    });
+}
+
+void Replicator::Send(size_t replica)
+{
+    Follower& follower = *m_followers[replica - 1];
+
+    // Give the follower some time to come up, rather than fail while it starts
+    if (! Connect(follower)) {
+        bool stopping;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            stopping = m_stopping;
+        }
+        OnFailed(replica);
+        if (! stopping) {
+            std::cerr << "Stopped replicating to " << follower.address << ": Failed to connect within "
+                      << m_connect_timeout.count() << " ms." << std::endl;
+        }
+        return;
+    }
+    follower.stream = follower.stub->Replicate(&follower.context);
+    follower.reading = true;
+    std::thread receiver(&Replicator::Receive, this, replica);
+
+    ReplicationBatch batch;
+    std::vector< std::shared_ptr<const OffsetData> > records;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        follower.queue_cv.wait(lock, [&] { return m_stopping || m_failed[replica] || ! follower.queue.empty(); });
+        if (m_stopping || m_failed[replica]) {
+            break;
+        }
+
+        // Take whatever is waiting, up to a batch
+        batch.Clear();
+        batch.set_first_sequence(follower.queue.front().first);
+        records.clear();
+        size_t bytes = 0;
+        while (! follower.queue.empty() && (records.empty() || (bytes < m_max_batch_bytes))) {
+            records.push_back(std::move(follower.queue.front().second));
+            bytes += records.back()->ByteSizeLong();
+            follower.queue.pop_front();
+        }
+        lock.unlock();
+
+        for (const auto& record : records) {
+            *batch.add_records() = *record;
+        }
+        const bool written = follower.stream->Write(batch);
+        lock.lock();
+        if (! written) {
+            break;
+        }
+    }
+    const bool stopping = m_stopping;
+    const bool reading = follower.reading;
+    lock.unlock();
+
+    // Make sure the receiver stops reading too, unless the follower ended the stream, and then learn why
+    // it ended
+    OnFailed(replica);
+    if (reading) {
+        follower.context.TryCancel();
+    }
+    receiver.join();
+    const Status status = follower.stream->Finish();
+    if (! stopping) {
+        std::cerr << "Stopped replicating to " << follower.address << ": " << status.error_message() << std::endl;
+    }
+}
+
+bool Replicator::Connect(Follower& follower)
+{
+    // Waited for a step at a time, so that stopping doesn't have to wait for the whole timeout
+    const auto deadline = std::chrono::system_clock::now() + m_connect_timeout;
+    while (true) {
+        const auto step_deadline = std::min(deadline, std::chrono::system_clock::now() + connect_step);
+        if (follower.channel->WaitForConnected(step_deadline)) {
+            return true;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopping || (std::chrono::system_clock::now() >= deadline)) {
+            return false;
+        }
+    }
+}
+
+void Replicator::Receive(size_t replica)
+{
+    Follower& follower = *m_followers[replica - 1];
+    ReplicationAck ack;
+    while (follower.stream->Read(&ack)) {
+        OnDurable(replica, ack.durable());
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        follower.reading = false;
+    }
+    OnFailed(replica);
+}
+
+void Replicator::OnDurable(size_t replica, std::uint64_t sequence)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_durable[replica] = std::max(m_durable[replica], sequence);
+    Complete(lock);
+}
+
+void Replicator::OnFailed(size_t replica)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_failed[replica]) {
+        return;
+    }
+    m_failed[replica] = true;
+    Follower& follower = *m_followers[replica - 1];
+    follower.queue.clear();
+    follower.queue_cv.notify_one();
+    Complete(lock);
+}
+
+void Replicator::Complete(std::unique_lock<std::mutex>& lock)
+{
+    if (m_completing) {
+        return;     // The thread completing records will see what changed before it stops
+    }
+    m_completing = true;
+
+    std::vector<Pending> ready;
+    std::vector<std::uint64_t> durable;
+    while (true) {
+        // The last record that a quorum of replicas including the primary have durable, and whether a
+        // quorum is still alive to make the others durable
+        durable = m_durable;
+        std::nth_element(durable.begin(), durable.begin() + (m_quorum - 1), durable.end(), std::greater<std::uint64_t>());
+        const std::uint64_t quorum_durable = std::min(durable[m_quorum - 1], m_durable[0]);
+        const bool reachable = static_cast<size_t>(std::count(m_failed.begin(), m_failed.end(), false)) >= m_quorum;
+
+        ready.clear();
+        while (! m_pending.empty()) {
+            Pending& pending = m_pending.front();
+            if (pending.sequence > m_logged) {
+                break;      // Until the primary's outcome is known
+            }
+            if (pending.sequence <= quorum_durable) {
+                pending.err = 0;
+            }
+            else if (m_failed[0] && (pending.sequence > m_durable[0])) {
+                pending.err = m_journal_error;      // No quorum can have it without the primary
+            }
+            else if (! reachable) {
+                pending.err = ENOTCONN;
+            }
+            else {
+                break;
+            }
+            ready.push_back(std::move(pending));
+            m_pending.pop_front();
+        }
+        if (ready.empty()) {
+            break;
+        }
+
+        lock.unlock();
+        for (Pending& pending : ready) {
+            pending.done(pending.err);
+        }
+        lock.lock();
+    }
+    m_completing = false;
+}
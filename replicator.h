@@ -0,0 +1,108 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#include <grpc++/channel.h>
+#include <grpc++/client_context.h>
+#include <grpc++/support/sync_stream.h>
+
+#include "journal.h"
+#include "file_exchange.pb.h"
+#include "file_exchange.grpc.pb.h"
+
+// Replicator: Journals every record on the primary and on its followers, and reports it durable once
+// 'quorum' of the replicas have it durable, the primary always being one of them.
+//
+// Every follower gets a Replicate stream of its own, over which a thread ships the records in the order
+// they were appended, as many as are waiting at a time in batches of up to 'max_batch_bytes', without
+// waiting for the batches before to be acknowledged. The primary's journal takes the record meanwhile, so
+// that a quorum costs about one round trip per batch on top of the local group commit, rather than one per
+// record. The followers acknowledge every record they have made durable, counting all those before it.
+//
+// Records complete in the order they were appended, as they do with the journal alone. A follower whose
+// stream fails, or that can't be connected to within 'connect_timeout', is dropped until the primary
+// restarts, since it has missed records; once fewer than a quorum of replicas are left, the records that
+// aren't durable on a quorum yet fail with ENOTCONN. Once the primary's journal fails, the records it
+// doesn't have durable fail with the journal's error, whatever the followers have.
+
+class Replicator {
+public:
+    // Throws std::invalid_argument unless 'quorum' is between 1 and the number of replicas
+    Replicator(Journal& journal, const std::vector<std::string>& followers, size_t quorum, size_t max_batch_bytes,
+               std::chrono::milliseconds connect_timeout);
+
+    // Stops shipping records. Only to be destroyed once no record is waiting to complete.
+    ~Replicator();
+
+    Replicator(const Replicator&) = delete;
+    Replicator& operator=(const Replicator&) = delete;
+
+    // As Journal::AppendAsync, but 'done' is called once a quorum has the record durable, or can't have it
+    // durable any more. The records complete one at a time, in the order they were appended.
+    void AppendAsync(const fileexchange::OffsetData& record, Journal::CommitCallback done);
+
+    size_t Replicas() const
+    {
+        return m_durable.size();
+    }
+
+private:
+    struct Pending {
+        std::uint64_t sequence;
+        Journal::CommitCallback done;
+        int err;
+    };
+
+    struct Follower {
+        std::string address;
+        std::shared_ptr<grpc::Channel> channel;
+        std::unique_ptr<fileexchange::Replication::Stub> stub;
+        grpc::ClientContext context;
+        std::unique_ptr< grpc::ClientReaderWriter<fileexchange::ReplicationBatch, fileexchange::ReplicationAck> > stream;
+        std::deque< std::pair< std::uint64_t, std::shared_ptr<const fileexchange::OffsetData> > > queue;
+        std::condition_variable queue_cv;
+        bool reading = false;           // Until the stream ends for the receiver
+        std::thread thread;
+    };
+
+    // Ship the records to the follower that is replica 'replica', and take its acknowledgements
+    void Send(size_t replica);
+    bool Connect(Follower& follower);
+    void Receive(size_t replica);
+
+    // A follower acknowledged records, or its stream ended
+    void OnDurable(size_t replica, std::uint64_t sequence);
+    void OnFailed(size_t replica);
+
+    // Complete the records that a quorum has made durable, or that no quorum can make durable any more.
+    // Called with the lock held; only one thread completes records at a time, in order.
+    void Complete(std::unique_lock<std::mutex>& lock);
+
+    Journal& m_journal;
+    const size_t m_quorum;
+    const size_t m_max_batch_bytes;
+    const std::chrono::milliseconds m_connect_timeout;
+
+    // Held while appending, so that the sequence numbers follow the order of the records in the journal
+    std::mutex m_append_mutex;
+
+    std::mutex m_mutex;
+    std::uint64_t m_next_sequence;
+    std::vector<std::uint64_t> m_durable;       // The last sequence number durable on every replica, the primary first
+    std::vector<bool> m_failed;
+    std::uint64_t m_logged;                     // The last sequence number the primary's journal called back for
+    int m_journal_error;
+    std::deque<Pending> m_pending;
+    bool m_completing;
+    bool m_stopping;
+    std::vector< std::unique_ptr<Follower> > m_followers;   // Replica i is m_followers[i - 1]
+};
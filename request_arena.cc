@@ -0,0 +1,25 @@
+#include "request_arena.h"
+
+using fileexchange::OffsetData;
+using fileexchange::success_failure;
+
+RequestArena::RequestArena(size_t initial_block_size)
+    : m_initial_block(new char[initial_block_size])
+    , m_arena(m_initial_block.get(), initial_block_size)
+    , m_request(google::protobuf::Arena::CreateMessage<OffsetData>(&m_arena))
+    , m_response(google::protobuf::Arena::CreateMessage<success_failure>(&m_arena))
+{
+}
+
+OffsetData& RequestArena::NewRequest()
+{
+    m_request->Clear();
+    m_response->Clear();
+    return *m_request;
+}
+
+RequestArena& RequestArena::ForThisThread()
+{
+    thread_local RequestArena arena;
+    return arena;
+}
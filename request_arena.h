@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+
+#include <google/protobuf/arena.h>
+
+#include "file_exchange.pb.h"
+
+// RequestArena: Storage for building Put requests on one thread. The request and the response live on a
+// protobuf arena whose first block is allocated up front, and they are reused from one call to the next.
+// Clearing a message keeps its string objects and their buffers for the next values, so once they have
+// grown to the usual value size, building a request performs no allocation at all.
+
+class RequestArena {
+public:
+    explicit RequestArena(size_t initial_block_size = 64 * 1024);
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    // Start a new request, reusing the storage of the previous one. The reference stays valid until the
+    // next call.
+    fileexchange::OffsetData& NewRequest();
+
+    fileexchange::success_failure& Response()
+    {
+        return *m_response;
+    }
+
+    static void AddWrite(fileexchange::OffsetData& request, std::uint64_t offset, std::string_view value)
+    {
+        request.add_offsets(offset);
+        request.add_values(value.data(), value.size());
+    }
+
+    // The arena of the calling thread, created on first use
+    static RequestArena& ForThisThread();
+
+private:
+    std::unique_ptr<char[]> m_initial_block;
+    google::protobuf::Arena m_arena;
+    fileexchange::OffsetData* m_request;
+    fileexchange::success_failure* m_response;
+};
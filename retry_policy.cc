@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include "retry_policy.h"
+#include "fast_random.h"
+
+using grpc::Status;
+using grpc::StatusCode;
+
+RetryPolicy::RetryPolicy(const Options& options)
+    : m_options(options)
+    , m_tokens(static_cast<std::int64_t>(options.budget_tokens * milli))
+    , m_hedge_delay_ns(0)
+    , m_attempts(0)
+    , m_failures(0)
+    , m_retries(0)
+    , m_retries_refused(0)
+    , m_hedges(0)
+    , m_hedges_refused(0)
+    , m_hedges_won(0)
+{
+}
+
+bool RetryPolicy::IsRetryable(const Status& status)
+{
+    switch (status.error_code()) {
+    case StatusCode::UNAVAILABLE:
+    case StatusCode::DEADLINE_EXCEEDED:
+    case StatusCode::RESOURCE_EXHAUSTED:
+    case StatusCode::ABORTED:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::chrono::system_clock::time_point RetryPolicy::CallDeadline() const
+{
+    if (0 == m_options.call_timeout.count()) {
+        return std::chrono::system_clock::time_point::max();
+    }
+    return std::chrono::system_clock::now() + m_options.call_timeout;
+}
+
+std::chrono::system_clock::time_point RetryPolicy::AttemptDeadline(std::chrono::system_clock::time_point call_deadline) const
+{
+    if (0 == m_options.attempt_timeout.count()) {
+        return call_deadline;
+    }
+    return std::min(call_deadline, std::chrono::system_clock::now() + m_options.attempt_timeout);
+}
+
+std::chrono::nanoseconds RetryPolicy::Backoff(size_t retry) const
+{
+    const double cap_ns = std::chrono::duration<double, std::nano>(m_options.max_backoff).count();
+    const double base_ns = std::chrono::duration<double, std::nano>(m_options.initial_backoff).count() *
+                           std::pow(m_options.backoff_multiplier, static_cast<double>(retry));
+    // Each thread draws its jitter from a generator of its own, so that backing off takes no lock
+    const double jitter = FastRandom::ForThisThread().Uniform();
+    return std::chrono::nanoseconds(static_cast<std::int64_t>(jitter * std::min(base_ns, cap_ns)));
+}
+
+void RetryPolicy::OnResult(const Status& status, std::chrono::nanoseconds latency)
+{
+    const std::uint64_t attempts = m_attempts.fetch_add(1, std::memory_order_relaxed) + 1;
+    const std::int64_t max_tokens = static_cast<std::int64_t>(m_options.budget_tokens * milli);
+    if (! status.ok()) {
+        m_failures.fetch_add(1, std::memory_order_relaxed);
+        std::int64_t tokens = m_tokens.load(std::memory_order_relaxed);
+        while ((tokens > 0) && ! m_tokens.compare_exchange_weak(tokens, std::max<std::int64_t>(tokens - milli, 0))) {
+        }
+        return;
+    }
+
+    const std::int64_t refund = static_cast<std::int64_t>(m_options.budget_ratio * milli);
+    std::int64_t tokens = m_tokens.load(std::memory_order_relaxed);
+    while ((tokens < max_tokens) && ! m_tokens.compare_exchange_weak(tokens, std::min(tokens + refund, max_tokens))) {
+    }
+
+    if (m_options.hedge_quantile > 0) {
+        m_latencies.Record(latency.count());
+        if ((attempts % hedge_update_interval == 0) && (m_latencies.Count() >= m_options.hedge_min_samples)) {
+            m_hedge_delay_ns = m_latencies.Percentile(m_options.hedge_quantile);
+        }
+    }
+}
+
+bool RetryPolicy::HasBudget() const
+{
+    // Like gRPC, retry only while more than half of the budget is left. What a retry costs is taken away
+    // once it has failed.
+    return 2 * m_tokens.load(std::memory_order_relaxed) > static_cast<std::int64_t>(m_options.budget_tokens * milli);
+}
+
+bool RetryPolicy::AllowRetry()
+{
+    if (! HasBudget()) {
+        m_retries_refused.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_retries.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool RetryPolicy::AllowHedge()
+{
+    if (! HasBudget()) {
+        m_hedges_refused.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    m_hedges.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool RetryPolicy::HedgeDelay(std::chrono::nanoseconds* delay) const
+{
+    const std::uint64_t delay_ns = m_hedge_delay_ns.load(std::memory_order_relaxed);
+    if (0 == delay_ns) {
+        return false;
+    }
+    *delay = std::chrono::nanoseconds(delay_ns);
+    return true;
+}
+
+void RetryPolicy::Report(std::ostream& out) const
+{
+    out << "Retries: " << m_attempts << " attempts, " << m_failures << " failed, " << m_retries << " retried, "
+        << m_retries_refused << " not retried for lack of budget" << std::endl;
+    if (m_options.hedge_quantile > 0) {
+        const auto flags = out.flags();
+        const auto precision = out.precision();
+        out << "Hedging after the p" << 100 * m_options.hedge_quantile << " latency of ";
+        out << std::fixed << std::setprecision(3) << m_hedge_delay_ns / 1e6 << " ms: " << m_hedges << " hedged, " << m_hedges_won << " won by the duplicate, "
+            << m_hedges_refused << " not hedged for lack of budget" << std::endl;
+        out.flags(flags);
+        out.precision(precision);
+    }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <atomic>
+#include <ostream>
+
+#include <grpc++/support/status.h>
+
+#include "latency_histogram.h"
+
+// RetryPolicy: When and how soon calls are retried, and when a duplicate of a call is sent to hedge
+// against a slow reply.
+//  - Deadlines: each attempt gets 'attempt_timeout', and a call with its retries gets 'call_timeout'
+//    altogether. A timeout of 0 means none.
+//  - Backoff: before retry n the caller sleeps for a random time between 0 and
+//    min(initial_backoff * multiplier^n, max_backoff) ("full jitter"), so that clients which failed
+//    together don't retry together.
+//  - Budget: as in gRPC's retry throttling, the policy holds up to 'budget_tokens' tokens. Every failure
+//    takes one away, and every success gives 'budget_ratio' back. Retries and hedges are only made while
+//    more than half the tokens are left, so that a server in trouble isn't swamped with retries.
+//  - Hedging: with 'hedge_quantile' above 0, a duplicate of an idempotent call is sent once it has taken
+//    longer than that quantile of the latencies observed, and whichever completes first is taken. Hedging
+//    starts after 'hedge_min_samples' calls, so that the quantile means something.
+//
+// Only failures that may go away are retried. All methods may be called from several threads concurrently.
+
+class RetryPolicy {
+public:
+    struct Options {
+        size_t max_retries = 3;
+        std::chrono::milliseconds attempt_timeout{0};
+        std::chrono::milliseconds call_timeout{0};
+        std::chrono::milliseconds initial_backoff{10};
+        std::chrono::milliseconds max_backoff{1000};
+        double backoff_multiplier = 2.0;
+        double budget_tokens = 10.0;
+        double budget_ratio = 0.1;
+        double hedge_quantile = 0.0;
+        size_t hedge_min_samples = 100;
+    };
+
+    explicit RetryPolicy(const Options& options);
+
+    RetryPolicy(const RetryPolicy&) = delete;
+    RetryPolicy& operator=(const RetryPolicy&) = delete;
+
+    const Options& GetOptions() const
+    {
+        return m_options;
+    }
+
+    // The trailing metadata in which a server that refused a call asks for the retry to wait at least
+    // that many milliseconds
+    static constexpr const char* pushback_key = "grpc-retry-pushback-ms";
+
+    // Whether a call that failed with 'status' may succeed if retried
+    static bool IsRetryable(const grpc::Status& status);
+
+    // The deadline of a call starting now, or the latest time point if there is none
+    std::chrono::system_clock::time_point CallDeadline() const;
+
+    // The deadline of an attempt starting now, within that of its call
+    std::chrono::system_clock::time_point AttemptDeadline(std::chrono::system_clock::time_point call_deadline) const;
+
+    // How long to sleep before retry number 'retry', counted from 0
+    std::chrono::nanoseconds Backoff(size_t retry) const;
+
+    // Account for the outcome of an attempt, and for its latency if it succeeded
+    void OnResult(const grpc::Status& status, std::chrono::nanoseconds latency);
+
+    // Whether the budget allows another retry, or a hedge. Counts the retry or hedge if it does.
+    bool AllowRetry();
+    bool AllowHedge();
+
+    // Whether to hedge, and if so after how long
+    bool HedgeDelay(std::chrono::nanoseconds* delay) const;
+
+    // Account for a hedged call whose duplicate completed first
+    void OnHedgeWon()
+    {
+        ++m_hedges_won;
+    }
+
+    // Print the attempts, retries and hedges made, and those the budget refused
+    void Report(std::ostream& out) const;
+
+private:
+    static const std::int64_t milli = 1000;
+    static const std::uint64_t hedge_update_interval = 256;
+
+    bool HasBudget() const;
+
+    const Options m_options;
+
+    // The budget in thousandths of a token
+    std::atomic<std::int64_t> m_tokens;
+
+    // The latencies of the successful attempts, and the quantile of them after which calls are hedged,
+    // recomputed every 'hedge_update_interval' calls since computing it takes a while
+    LatencyHistogram m_latencies;
+    std::atomic<std::uint64_t> m_hedge_delay_ns;
+
+    std::atomic<std::uint64_t> m_attempts;
+    std::atomic<std::uint64_t> m_failures;
+    std::atomic<std::uint64_t> m_retries;
+    std::atomic<std::uint64_t> m_retries_refused;
+    std::atomic<std::uint64_t> m_hedges;
+    std::atomic<std::uint64_t> m_hedges_refused;
+    std::atomic<std::uint64_t> m_hedges_won;
+};
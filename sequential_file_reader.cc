@@ -40,12 +40,34 @@ namespace {
         }
 
     };
+
+    // Give 'advice' for the pages of the mapping that hold the given range of bytes. With 'whole_pages'
+    // only the pages that lie entirely within the range are concerned, so as not to affect neighbours.
+    void advise(const std::uint8_t* base, size_t offset, size_t length, int advice, bool whole_pages)
+    {
+        static const size_t page_size = sysconf(_SC_PAGESIZE);
+        size_t begin = offset;
+        size_t end = offset + length;
+        if (whole_pages) {
+            begin = (begin + page_size - 1) / page_size * page_size;
+            end = end / page_size * page_size;
+        }
+        else {
+            begin = begin / page_size * page_size;
+        }
+        if (begin < end) {
+            // Only a hint, so failures are ignored
+            madvise(const_cast<std::uint8_t*>(base) + begin, end - begin, advice);
+        }
+    }
 };  // Anonymous namespace
 
 SequentialFileReader::SequentialFileReader(const std::string& file_name)
     : m_file_path(file_name)
     , m_data(nullptr)
     , m_size(0)
+    , m_read_ahead(default_read_ahead)
+    , m_release_behind(false)
 {
     int fd = open(file_name.c_str(), O_RDONLY);
     if (-1 == fd) {
@@ -76,34 +98,55 @@ SequentialFileReader::SequentialFileReader(const std::string& file_name)
             raise_from_errno("Failed to set intended access pattern useing posix_madvise().");
         }
 
-        m_data.swap(mmap_p);
+        m_data = std::move(mmap_p);
     }
 }
 
 void SequentialFileReader::Read(size_t max_chunk_size)
 {
-    size_t bytes_read = 0;
+    ReadRange(0, m_size, max_chunk_size);
+}
 
-    // Handle empty files. Note that m_data will likely be null, so we take care not to access it.
-    if (0 == m_size) {
+void SequentialFileReader::ReadRange(size_t offset, size_t length, size_t max_chunk_size)
+{
+    if ((offset > m_size) || (length > m_size - offset)) {
+        raise_from_system_error_code("The range goes past the end of the file.", ERANGE);
+    }
+
+    // Handle empty files and ranges. Note that m_data will likely be null, so we take care not to access it.
+    if (0 == length) {
         OnChunkAvailable("", 0);
         return;
     }
 
-    while (bytes_read < m_size) {
-        size_t bytes_to_read = std::min(max_chunk_size, m_size - bytes_read);
-
-        // TODO: Here would be a good point to hint the kernel about the size of out subsequent
-        // read, by using posix_madvise() to give the advice POSIX_MADV_WILLNEED for the following
-        // max_chunk_size bytes after the ones we are about to read now. Hopefully by the time
-        // we need them, they'll be in the cache.
+    const size_t end = offset + length;
+    size_t bytes_read = offset;
+    size_t window = 0;
+    size_t advised_end = offset;
+    while (bytes_read < end) {
+        size_t bytes_to_read = std::min(max_chunk_size, end - bytes_read);
+
+        // Hint the kernel about the size of our subsequent reads, so that hopefully by the time we
+        // need them, they'll be in the cache. The first chunk is included, since it's needed right away.
+        if (m_read_ahead > 0) {
+            window = std::min(m_read_ahead, std::max(2 * window, bytes_to_read));
+            const size_t target = std::min(end, bytes_read + bytes_to_read + window);
+            if (target > advised_end) {
+                advise(m_data.get(), advised_end, target - advised_end, MADV_WILLNEED, false);
+                advised_end = target;
+            }
+        }
 
         OnChunkAvailable(m_data.get() + bytes_read, bytes_to_read);
 
-        // If we implemented the optimisation suggested above, now would be the time to set the
-        // advice POSIX_MADV_SEQUENTIAL for the data we have just finished reading. Note we should
-        // not use POSIX_MADV_DONTNEED because Linux ignores it (see the posix_madvise man page),
-        // and because multiple concurrent reads could suffer from it.
+        // Release the data we have just finished reading. Note we don't use MADV_DONTNEED, as it would
+        // unmap pages the user may still refer to, e.g. through slices queued for sending, and not
+        // POSIX_MADV_DONTNEED either because Linux ignores it (see the posix_madvise man page).
+#ifdef MADV_COLD
+        if (m_release_behind && (bytes_to_read < length)) {
+            advise(m_data.get(), bytes_read, bytes_to_read, MADV_COLD, true);
+        }
+#endif
 
         bytes_read += bytes_to_read;
     }
@@ -2,82 +2,70 @@
 #include <utility>
 #include <stdexcept>
 #include <cstdio>
-#include <sstream>
-#include <sys/errno.h>
 
 #include "utils.h"
 #include "sequential_file_writer.h"
 
-SequentialFileWriter::SequentialFileWriter()
-    : m_no_space(false)
+SequentialFileWriter::SequentialFileWriter(PositionalFileWriter::SyncPolicy sync_policy)
+    : m_sync_policy(sync_policy)
+    , m_writer(new PositionalFileWriter(sync_policy))
+    , m_position(0)
 {
 }
 
 SequentialFileWriter::SequentialFileWriter(SequentialFileWriter&&) = default;
 SequentialFileWriter& SequentialFileWriter::operator=(SequentialFileWriter&&) = default;
+SequentialFileWriter::~SequentialFileWriter() = default;
 
-// Currently the implementation is very simple using standard library facilities. More advanced implementations
-// allowing for better parallelism are possible, e.g. using aio_write().
-
-void SequentialFileWriter::OpenIfNecessary(const std::string& name)
+void SequentialFileWriter::OpenIfNecessary(const std::string& name, std::uint64_t size)
 {
     // FIXME: Sanitise file names. Currently there's nothing preventing the user from giving absolute paths,
     // Paths with .. etc. We should accept simple relative paths only.
 
-    if (m_ofs.is_open()) {
+    if (m_writer->IsOpen()) {
         return;
     }
 
-    using std::ios_base;
-    std::ofstream ofs;
-    ofs.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    // TODO: If the given relative path has a directory component, create it.
+    m_writer.reset(new PositionalFileWriter(m_sync_policy));
+    m_writer->Open(name, size);
+    m_position = 0;
+    return;
+}
 
+void SequentialFileWriter::Write(std::string& data)
+{
+    const size_t size = data.size();
     try {
-        // TODO: If the given relative path has a directory component, create it.
-        ofs.open(name, ios_base::out | ios_base::trunc | ios_base::binary);
+        m_writer->Write(m_position, data);
     }
-    catch (const std::system_error& ex) {
-        RaiseError("opening", ex);
+    catch (const std::system_error&) {
+        Discard();
     }
 
-    m_ofs = std::move(ofs);
-    m_name = name;
-    m_no_space = false;
+    m_position += size;
     return;
 }
 
-void SequentialFileWriter::Write(std::string& data)
+void SequentialFileWriter::Close()
 {
     try {
-        m_ofs << data;
+        m_writer->Close();
     }
-    catch (const std::system_error& ex) {
-        if (m_ofs.is_open()) {
-            m_ofs.close();
-        }
-        std::remove(m_name.c_str());    // Best effort. We expect it to succeed, but we don't check whether it did
-        RaiseError("writing to", ex);
+    catch (const std::system_error&) {
+        Discard();
     }
-
-    data.clear();
-    return;
 }
 
-void SequentialFileWriter::RaiseError(const std::string action_attempted, const std::system_error& ex)
+void SequentialFileWriter::Discard()
 {
-    const int ec = ex.code().value();
-    switch (ec) {
-    case ENOSPC:
-    case EFBIG:
-        m_no_space = true;
-        break;
-
-    // TODO: Also handle permission errors.
-    default:
-        break;
+    const std::string name = m_writer->GetFilePath();
+    try {
+        m_writer->Close();
     }
-
-    std::ostringstream sts;
-    sts << "Error " << action_attempted << " the file " << m_name << ": ";
-    raise_from_system_error_code(sts.str(), ec);
-}
\ No newline at end of file
+    catch (const std::system_error&) {
+        // The first error is the one reported
+    }
+    std::remove(name.c_str());    // Best effort. We expect it to succeed, but we don't check whether it did
+    throw;
+}
@@ -1,35 +1,48 @@
 #pragma once
 
-#include <fstream>
 #include <string>
+#include <memory>
+#include <cstdint>
 
 #include "messages.h"
+#include "positional_file_writer.h"
 #include "utils.h"
 
+// SequentialFileWriter: Writes a file from the start, one chunk after the other. The chunks are written by
+// the I/O thread of a PositionalFileWriter, so that receiving the next chunk overlaps with writing the
+// previous ones.
+
 class SequentialFileWriter {
 public:
-    
-    SequentialFileWriter();
+
+    explicit SequentialFileWriter(PositionalFileWriter::SyncPolicy sync_policy = PositionalFileWriter::SyncPolicy::None);
     SequentialFileWriter(SequentialFileWriter&&);
     SequentialFileWriter& operator=(SequentialFileWriter&&);
+    ~SequentialFileWriter();
 
-    // Open the file at the relative path 'name' for writing. On errors throw std::system_error
-    void OpenIfNecessary(const std::string& name);
+    // Open the file at the relative path 'name' for writing. If 'size' is not 0, the file is preallocated
+    // to that size. On errors throw std::system_error
+    void OpenIfNecessary(const std::string& name, std::uint64_t size = 0);
 
     // Write data from a string. On errors throws an exception drived from std::system_error
     // This method may take ownership of the string. Hence no assumption may be made about
     // the data it contains after it returns.
     void Write(std::string& data);
 
+    // Wait for the data to be written, and sync it as the policy requires. On errors throws an exception
+    // derived from std::system_error.
+    void Close();
+
     bool NoSpaceLeft() const
     {
-        return m_no_space;
+        return m_writer->NoSpaceLeft();
     }
 
 private:
-    std::string m_name;
-    std::ofstream m_ofs;
-    bool m_no_space;
+    PositionalFileWriter::SyncPolicy m_sync_policy;
+    std::unique_ptr<PositionalFileWriter> m_writer;
+    std::uint64_t m_position;
 
-    void RaiseError [[noreturn]] (const std::string action_attempted, const std::system_error& ex);
+    // Remove the partly written file, and rethrow the current exception
+    void Discard [[noreturn]] ();
 };
@@ -0,0 +1,115 @@
+#include <iostream>
+#include <limits>
+#include <algorithm>
+
+#include "workload_file.h"
+
+namespace {
+
+    bool is_space(char c)
+    {
+        return (' ' == c) || ('\t' == c) || ('\r' == c) || ('\v' == c) || ('\f' == c);
+    }
+
+    // Remove and return the first whitespace-delimited token of 'text'
+    std::string_view next_token(std::string_view& text)
+    {
+        size_t begin = 0;
+        while ((begin < text.size()) && is_space(text[begin])) {
+            ++begin;
+        }
+        size_t end = begin;
+        while ((end < text.size()) && ! is_space(text[end])) {
+            ++end;
+        }
+
+        const std::string_view token = text.substr(begin, end - begin);
+        text.remove_prefix(end);
+        return token;
+    }
+
+    bool parse_offset(std::string_view token, std::uint64_t& offset)
+    {
+        if (token.empty()) {
+            return false;
+        }
+
+        std::uint64_t value = 0;
+        for (const char c : token) {
+            if ((c < '0') || (c > '9')) {
+                return false;
+            }
+            const unsigned digit = c - '0';
+            if (value > (std::numeric_limits<std::uint64_t>::max() - digit) / 10) {
+                return false;   // Overflow
+            }
+            value = value * 10 + digit;
+        }
+
+        offset = value;
+        return true;
+    }
+};  // Anonymous namespace
+
+WorkloadFile::WorkloadFile(const std::string& file_name)
+    : SequentialFileReader(file_name)
+    , m_invalid_commands(0)
+{
+    // The whole mapping in a single chunk, as the writes refer into it
+    Read(std::numeric_limits<size_t>::max());
+}
+
+void WorkloadFile::OnChunkAvailable(const void* data, size_t size)
+{
+    std::string_view text(static_cast<const char*>(data), size);
+
+    // A rough guess of one write per 16 bytes avoids most of the reallocations on big files
+    m_writes.reserve(size / 16);
+
+    while (! text.empty()) {
+        const size_t end = text.find_first_of(";\n");
+        ParseCommand(text.substr(0, end));
+        if (std::string_view::npos == end) {
+            break;
+        }
+        text.remove_prefix(end + 1);
+    }
+}
+
+void WorkloadFile::ParseCommand(std::string_view command)
+{
+    std::string_view rest = command;
+    const std::string_view offset_token = next_token(rest);
+    const std::string_view value = next_token(rest);
+
+    if (offset_token.empty() && value.empty()) {
+        return;     // Blank command, e.g. after a trailing ';'
+    }
+
+    WorkloadWrite write { 0, value };
+    if (value.empty() || ! parse_offset(offset_token, write.offset)) {
+        ++m_invalid_commands;
+        std::cerr << "Invalid command format: ";
+        std::cerr.write(command.data(), command.size()) << std::endl;
+        return;
+    }
+    m_writes.push_back(write);
+}
+
+std::vector<fileexchange::OffsetData> WorkloadFile::BuildRequests(size_t max_entries) const
+{
+    max_entries = std::max<size_t>(max_entries, 1);
+
+    std::vector<fileexchange::OffsetData> requests;
+    requests.reserve((m_writes.size() + max_entries - 1) / max_entries);
+    for (size_t first = 0; first < m_writes.size(); first += max_entries) {
+        const size_t last = std::min(first + max_entries, m_writes.size());
+        requests.emplace_back();
+        fileexchange::OffsetData& request = requests.back();
+        for (size_t i = first; i < last; ++i) {
+            request.add_offsets(m_writes[i].offset);
+            request.add_values(m_writes[i].value.data(), m_writes[i].value.size());
+        }
+    }
+    return requests;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+
+#include "sequential_file_reader.h"
+#include "file_exchange.pb.h"
+
+// WorkloadFile: A trace of writes to replay. The file is mapped into memory and tokenised in place, so the
+// values are views into the mapping rather than copies, and loading costs no allocation per write.
+//
+// Every line holds commands separated by ';', and every command is an offset and a value separated by
+// whitespace. Anything after the value is ignored. Invalid commands are reported on std::cerr and skipped.
+
+struct WorkloadWrite {
+    std::uint64_t offset;
+    std::string_view value;     // Valid as long as the WorkloadFile is
+};
+
+class WorkloadFile : public SequentialFileReader {
+public:
+    // Map and parse the file. Throws std::system_error if it can't be read.
+    explicit WorkloadFile(const std::string& file_name);
+
+    const std::vector<WorkloadWrite>& Writes() const
+    {
+        return m_writes;
+    }
+
+    size_t InvalidCommands() const
+    {
+        return m_invalid_commands;
+    }
+
+    // Build the requests for the whole workload up front, with up to 'max_entries' writes each, so that
+    // building them doesn't count towards the time measured when sending them.
+    std::vector<fileexchange::OffsetData> BuildRequests(size_t max_entries) const;
+
+protected:
+    virtual void OnChunkAvailable(const void* data, size_t size) override;
+
+private:
+    void ParseCommand(std::string_view command);
+
+    std::vector<WorkloadWrite> m_writes;
+    size_t m_invalid_commands;
+};
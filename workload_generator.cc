@@ -0,0 +1,172 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "workload_generator.h"
+
+namespace {
+
+    // Terms of the zeta sum that are added up one by one. The rest is approximated by an integral.
+    const std::uint64_t exact_zeta_terms = 1 << 20;
+
+    // The sum of 1 / i^theta for i from 1 to n
+    double zeta(std::uint64_t n, double theta)
+    {
+        const std::uint64_t exact = std::min(n, exact_zeta_terms);
+        double sum = 0;
+        for (std::uint64_t i = 1; i <= exact; ++i) {
+            sum += 1.0 / std::pow(static_cast<double>(i), theta);
+        }
+        if (n > exact) {
+            // The terms from exact + 1 to n, as the integral of x^-theta from exact + 0.5 to n + 0.5
+            const double a = exact + 0.5;
+            const double b = n + 0.5;
+            sum += (std::pow(b, 1 - theta) - std::pow(a, 1 - theta)) / (1 - theta);
+        }
+        return sum;
+    }
+
+    // Spread consecutive ranks over the whole space (splitmix64's finaliser)
+    std::uint64_t scramble(std::uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+};  // Anonymous namespace
+
+WorkloadGenerator::OffsetDistribution WorkloadGenerator::ParseOffsetDistribution(const std::string& name)
+{
+    if ("sequential" == name) {
+        return OffsetDistribution::Sequential;
+    }
+    if ("uniform" == name) {
+        return OffsetDistribution::Uniform;
+    }
+    if ("zipfian" == name) {
+        return OffsetDistribution::Zipfian;
+    }
+    if ("hotspot" == name) {
+        return OffsetDistribution::Hotspot;
+    }
+    throw std::invalid_argument("Unknown offset distribution \"" + name + "\". Expected sequential, uniform, zipfian or hotspot.");
+}
+
+WorkloadGenerator::SizeDistribution WorkloadGenerator::ParseSizeDistribution(const std::string& name)
+{
+    if ("fixed" == name) {
+        return SizeDistribution::Fixed;
+    }
+    if ("uniform" == name) {
+        return SizeDistribution::Uniform;
+    }
+    if ("exponential" == name) {
+        return SizeDistribution::Exponential;
+    }
+    throw std::invalid_argument("Unknown value size distribution \"" + name + "\". Expected fixed, uniform or exponential.");
+}
+
+WorkloadGenerator::WorkloadGenerator(const Options& options)
+    : m_options(options)
+    , m_next_slot(0)
+    , m_zeta_n(0)
+    , m_alpha(0)
+    , m_eta(0)
+    , m_threshold_2(0)
+{
+    if (0 == options.slots) {
+        throw std::invalid_argument("The workload needs at least one slot.");
+    }
+    const size_t largest = (SizeDistribution::Fixed == options.sizes) ? options.value_size : options.max_value_size;
+    if ((0 == largest) || (largest > options.slot_size)) {
+        throw std::invalid_argument("The values must fit in a slot of " + std::to_string(options.slot_size) + " bytes.");
+    }
+    if ((SizeDistribution::Fixed != options.sizes) && (options.min_value_size > options.max_value_size)) {
+        throw std::invalid_argument("The smallest value size is larger than the largest.");
+    }
+    if ((options.hot_fraction <= 0) || (options.hot_fraction > 1)) {
+        throw std::invalid_argument("The hot fraction of the slots must be in (0, 1].");
+    }
+
+    if (OffsetDistribution::Zipfian == options.offsets) {
+        const double theta = options.zipf_skew;
+        if ((theta <= 0) || (theta >= 1)) {
+            throw std::invalid_argument("The zipfian skew must be in (0, 1).");
+        }
+        const double n = static_cast<double>(options.slots);
+        m_zeta_n = zeta(options.slots, theta);
+        m_alpha = 1 / (1 - theta);
+        m_eta = (1 - std::pow(2 / n, 1 - theta)) / (1 - zeta(2, theta) / m_zeta_n);
+        m_threshold_2 = 1 + std::pow(0.5, theta);
+    }
+
+    // Letters, so that the values compress about as well as text does
+    FastRandom random(options.slots);
+    m_value_pool.resize(largest + value_starts);
+    for (char& c : m_value_pool) {
+        c = static_cast<char>('a' + random.Below(26));
+    }
+}
+
+GeneratedOperation WorkloadGenerator::Next(FastRandom& random)
+{
+    GeneratedOperation operation;
+    operation.is_read = (m_options.read_fraction > 0) && (random.Uniform() < m_options.read_fraction);
+    operation.offset = NextSlot(random) * m_options.slot_size;
+    operation.length = NextValueSize(random);
+    if (! operation.is_read) {
+        operation.value = std::string_view(m_value_pool.data() + random.Below(value_starts), operation.length);
+    }
+    return operation;
+}
+
+std::uint64_t WorkloadGenerator::NextSlot(FastRandom& random)
+{
+    const std::uint64_t slots = m_options.slots;
+    switch (m_options.offsets) {
+    case OffsetDistribution::Sequential:
+        return m_next_slot.fetch_add(1, std::memory_order_relaxed) % slots;
+    case OffsetDistribution::Uniform:
+        return random.Below(slots);
+    case OffsetDistribution::Zipfian:
+        return scramble(NextZipfianRank(random)) % slots;
+    case OffsetDistribution::Hotspot: {
+        const std::uint64_t hot_slots = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(slots * m_options.hot_fraction));
+        if ((hot_slots == slots) || (random.Uniform() < m_options.hot_probability)) {
+            return random.Below(hot_slots);
+        }
+        return hot_slots + random.Below(slots - hot_slots);
+    }
+    }
+    return 0;
+}
+
+std::uint64_t WorkloadGenerator::NextZipfianRank(FastRandom& random)
+{
+    // Gray et al., "Quickly Generating Billion-Record Synthetic Databases", as in YCSB
+    const double u = random.Uniform();
+    const double uz = u * m_zeta_n;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < m_threshold_2) {
+        return 1;
+    }
+    const std::uint64_t rank = static_cast<std::uint64_t>(m_options.slots * std::pow(m_eta * u - m_eta + 1, m_alpha));
+    return std::min(rank, m_options.slots - 1);
+}
+
+size_t WorkloadGenerator::NextValueSize(FastRandom& random)
+{
+    switch (m_options.sizes) {
+    case SizeDistribution::Fixed:
+        return m_options.value_size;
+    case SizeDistribution::Uniform:
+        return m_options.min_value_size + random.Below(m_options.max_value_size - m_options.min_value_size + 1);
+    case SizeDistribution::Exponential: {
+        const double size = -std::log(1 - random.Uniform()) * m_options.value_size;
+        return std::clamp<size_t>(static_cast<size_t>(size), m_options.min_value_size, m_options.max_value_size);
+    }
+    }
+    return m_options.value_size;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <atomic>
+
+#include "fast_random.h"
+
+// WorkloadGenerator: Synthesises operations instead of reading them from a trace, for scenarios there are
+// no traces of, and at rates a trace can't be parsed at. The offsets are whole slots of 'slot_size' bytes,
+// out of 'slots', drawn from one of these distributions:
+//   sequential  One slot after the other, wrapping around, across all the threads
+//   uniform     Any slot, equally likely
+//   zipfian     Slot popularity follows Zipf's law with exponent 'zipf_skew', in (0, 1), as in YCSB.
+//               The popular slots are scattered over the space by hashing their rank.
+//   hotspot     'hot_probability' of the operations go to the first 'hot_fraction' of the slots, and the
+//               rest to the others, uniformly within each part
+// The values are 'value_size' bytes ("fixed"), uniformly between 'min_value_size' and 'max_value_size'
+// ("uniform"), or exponentially distributed with a mean of 'value_size' within the same bounds
+// ("exponential"). A value never spans two slots. 'read_fraction' of the operations are reads.
+//
+// The values are views into a pool of random letters that the generator owns. Next() may be called from
+// several threads concurrently, each with a FastRandom of its own.
+
+struct GeneratedOperation {
+    bool is_read;
+    std::uint64_t offset;
+    size_t length;
+    std::string_view value;     // Empty for reads. Valid as long as the WorkloadGenerator is.
+};
+
+class WorkloadGenerator {
+public:
+    enum class OffsetDistribution { Sequential, Uniform, Zipfian, Hotspot };
+    enum class SizeDistribution { Fixed, Uniform, Exponential };
+
+    struct Options {
+        OffsetDistribution offsets = OffsetDistribution::Uniform;
+        std::uint64_t slots = 1 << 18;
+        size_t slot_size = 4096;
+        double zipf_skew = 0.99;
+        double hot_fraction = 0.2;
+        double hot_probability = 0.8;
+        SizeDistribution sizes = SizeDistribution::Fixed;
+        size_t value_size = 1024;
+        size_t min_value_size = 1;
+        size_t max_value_size = 4096;
+        double read_fraction = 0.0;
+    };
+
+    // Parse "sequential", "uniform", "zipfian" or "hotspot". Throws std::invalid_argument on anything else.
+    static OffsetDistribution ParseOffsetDistribution(const std::string& name);
+
+    // Parse "fixed", "uniform" or "exponential". Throws std::invalid_argument on anything else.
+    static SizeDistribution ParseSizeDistribution(const std::string& name);
+
+    // Throws std::invalid_argument if the options contradict each other. The zipfian distribution takes
+    // time proportional to the number of slots, up to a million, to set up.
+    explicit WorkloadGenerator(const Options& options);
+
+    WorkloadGenerator(const WorkloadGenerator&) = delete;
+    WorkloadGenerator& operator=(const WorkloadGenerator&) = delete;
+
+    GeneratedOperation Next(FastRandom& random);
+
+private:
+    // The values start at one of this many positions in the pool
+    static const size_t value_starts = 4096;
+
+    std::uint64_t NextSlot(FastRandom& random);
+    std::uint64_t NextZipfianRank(FastRandom& random);
+    size_t NextValueSize(FastRandom& random);
+
+    const Options m_options;
+    std::atomic<std::uint64_t> m_next_slot;
+    std::string m_value_pool;
+
+    // The constants of Gray et al.'s zipfian generator
+    double m_zeta_n;
+    double m_alpha;
+    double m_eta;
+    double m_threshold_2;
+};